@@ -124,11 +124,16 @@ void EngineController::SetPosition(const std::string& fen,
         full_moves * 2 - (starting_board.flipped() ? 1 : 2);
   }
 
+  // Replay the game from the start. Where the moves follow the previous tree,
+  // MakeMove() keeps the matching child and hands its siblings to the pool's
+  // background release. On a ponder miss (or any other divergence) the old
+  // branch is dropped the same way at the point where the moves differ. The
+  // subtree of the reached position is kept with all its visits and becomes
+  // the root of the next search.
   current_head_ = gamebegin_node_;
   for (const auto& move : moves) {
     MakeMove(move);
   }
-  node_pool_->ReleaseChildren(current_head_);
 }
 
 void EngineController::Go(const GoParams& params) {
@@ -144,7 +149,8 @@ void EngineController::Go(const GoParams& params) {
 
   search_ = std::make_unique<Search>(current_head_, node_pool_.get(),
                                      network_.get(), best_move_callback_,
-                                     info_callback_, limits, uci_options_);
+                                     info_callback_, limits, uci_options_,
+                                     &worker_pool_);
 
   search_->StartThreads(uci_options_ ? uci_options_->GetIntValue(kThreadsOption)
                                      : kDefaultThreads);
@@ -85,6 +85,8 @@ class EngineController {
   std::unique_ptr<NodePool> node_pool_;
   Node* current_head_ = nullptr;
   Node* gamebegin_node_ = nullptr;
+  // Must outlive search_.
+  SearchWorkerPool worker_pool_;
   std::unique_ptr<Search> search_;
 };
 
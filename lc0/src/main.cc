@@ -16,6 +16,18 @@
   along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string>
+#include <vector>
+#include "selfplay/loop.h"
 #include "uciloop.h"
 
-int main(int argc, const char** argv) { lczero::UciLoop(argc, argv); }
+int main(int argc, const char** argv) {
+  // "lc0 selfplay [flags]" plays training games, without it lc0 speaks UCI.
+  if (argc > 1 && std::string(argv[1]) == "selfplay") {
+    std::vector<const char*> args(argv, argv + argc);
+    args.erase(args.begin() + 1);
+    lczero::SelfPlayLoop(args.size(), args.data());
+    return 0;
+  }
+  lczero::UciLoop(argc, argv);
+}
@@ -46,30 +46,100 @@ void NodePool::AllocateNewBatch() {
   }
 }
 
-void NodePool::ReleaseNode(Node* node) { pool_.push_back(node); }
+void NodePool::ReleaseNode(Node* node) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pool_.push_back(node);
+}
+
+void NodePool::CollectSubtree(Node* node, std::vector<Node*>* nodes) {
+  // Read the sibling before the node goes to the pool.
+  for (Node* iter = node->child; iter;) {
+    Node* next = iter->sibling;
+    CollectSubtree(iter, nodes);
+    iter = next;
+  }
+  nodes->push_back(node);
+}
 
 void NodePool::ReleaseChildren(Node* node) {
+  std::vector<Node*> nodes;
   for (Node* iter = node->child; iter; iter = iter->sibling) {
-    ReleaseSubtree(iter);
+    CollectSubtree(iter, &nodes);
   }
   node->child = nullptr;
+  std::lock_guard<std::mutex> lock(mutex_);
+  pool_.insert(pool_.end(), nodes.begin(), nodes.end());
 }
 
 void NodePool::ReleaseSubtree(Node* node) {
-  for (Node* iter = node->child; iter; iter = iter->sibling) {
-    ReleaseSubtree(iter);
-    ReleaseNode(iter);
+  std::vector<Node*> nodes;
+  CollectSubtree(node, &nodes);
+  std::lock_guard<std::mutex> lock(mutex_);
+  pool_.insert(pool_.end(), nodes.begin(), nodes.end());
+}
+
+void NodePool::ReleaseSubtreeAsync(Node* node) {
+  std::lock_guard<std::mutex> lock(release_mutex_);
+  if (!release_thread_.joinable()) {
+    release_thread_ = std::thread([this]() { ReleaseWorker(); });
+  }
+  release_queue_.push_back(node);
+  release_cv_.notify_all();
+}
+
+void NodePool::WaitForAsyncRelease() {
+  std::unique_lock<std::mutex> lock(release_mutex_);
+  release_cv_.wait(lock,
+                   [this]() { return release_queue_.empty() && !release_busy_; });
+}
+
+void NodePool::ReleaseWorker() {
+  std::vector<Node*> roots;
+  std::vector<Node*> nodes;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(release_mutex_);
+      release_busy_ = false;
+      release_cv_.notify_all();
+      release_cv_.wait(lock, [this]() {
+        return release_stop_ || !release_queue_.empty();
+      });
+      // Finish the queued work even when stopping, WaitForAsyncRelease()
+      // callers rely on it.
+      if (release_queue_.empty()) return;
+      roots.swap(release_queue_);
+      release_busy_ = true;
+    }
+    // Nobody else references these nodes, so no lock is needed to walk them.
+    nodes.clear();
+    for (Node* root : roots) CollectSubtree(root, &nodes);
+    roots.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    pool_.insert(pool_.end(), nodes.begin(), nodes.end());
+  }
+}
+
+NodePool::~NodePool() {
+  {
+    std::lock_guard<std::mutex> lock(release_mutex_);
+    release_stop_ = true;
+    release_cv_.notify_all();
   }
+  if (release_thread_.joinable()) release_thread_.join();
 }
 
 void NodePool::ReleaseAllChildrenExceptOne(Node* root, Node* subtree) {
   Node* child = nullptr;
-  for (Node* iter = root->child; iter; iter = iter->sibling) {
+  for (Node* iter = root->child; iter;) {
+    Node* next = iter->sibling;
     if (iter == subtree) {
       child = iter;
     } else {
-      ReleaseSubtree(iter);
+      iter->parent = nullptr;
+      iter->sibling = nullptr;
+      ReleaseSubtreeAsync(iter);
     }
+    iter = next;
   }
   root->child = child;
   if (child) {
@@ -18,8 +18,11 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 #include "chess/board.h"
 
 namespace lczero {
@@ -79,27 +82,46 @@ int ComputeRepetitions(const Node*);
 
 class NodePool {
  public:
+  ~NodePool();
+
   // Allocates a new node and initializes it with all zeros.
   Node* GetNode();
   // Return node to the pool.
   void ReleaseNode(Node*);
   // Releases all children of the node, except specified. Also updates pointers
-  // accordingly.
+  // accordingly. Released subtrees are returned to the pool by a background
+  // thread, so this doesn't have to walk them.
   void ReleaseAllChildrenExceptOne(Node* root, Node* subtree);
   // Releases all children, but doesn't release the node isself.
   void ReleaseChildren(Node*);
   // Release all children of the node and the node itself.
   void ReleaseSubtree(Node*);
+  // Same as ReleaseSubtree(), but done in a background thread. The subtree
+  // must already be unlinked from the tree and must not be touched anymore.
+  void ReleaseSubtreeAsync(Node*);
+  // Blocks until all subtrees passed to ReleaseSubtreeAsync() are released.
+  void WaitForAsyncRelease();
 
   // Returns total number of nodes allocated.
   uint64_t GetAllocatedNodeCount() const;
 
  private:
   void AllocateNewBatch();
+  // Appends the node and all its descendants to *nodes.
+  static void CollectSubtree(Node* node, std::vector<Node*>* nodes);
+  void ReleaseWorker();
 
   mutable std::mutex mutex_;
   std::vector<Node*> pool_;
   std::vector<std::unique_ptr<Node[]>> allocations_;
+
+  // Background releasing. Protected by release_mutex_.
+  std::mutex release_mutex_;
+  std::condition_variable release_cv_;
+  std::vector<Node*> release_queue_;
+  bool release_busy_ = false;
+  bool release_stop_ = false;
+  std::thread release_thread_;
 };
 
 }  // namespace lczero
\ No newline at end of file
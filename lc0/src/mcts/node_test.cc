@@ -0,0 +1,89 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2018 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include "src/mcts/node.h"
+
+namespace lczero {
+
+namespace {
+// Adds `count` children to the node.
+void AddChildren(NodePool* pool, Node* node, int count) {
+  Node* prev = nullptr;
+  for (int i = 0; i < count; ++i) {
+    Node* child = pool->GetNode();
+    child->parent = node;
+    if (prev) {
+      prev->sibling = child;
+    } else {
+      node->child = child;
+    }
+    prev = child;
+  }
+}
+}  // namespace
+
+TEST(NodePool, ReleaseSubtree) {
+  NodePool pool;
+  Node* root = pool.GetNode();
+  AddChildren(&pool, root, 3);
+  AddChildren(&pool, root->child, 2);
+  EXPECT_EQ(pool.GetAllocatedNodeCount(), 6);
+
+  pool.ReleaseChildren(root);
+  EXPECT_EQ(root->child, nullptr);
+  EXPECT_EQ(pool.GetAllocatedNodeCount(), 1);
+
+  AddChildren(&pool, root, 2);
+  pool.ReleaseSubtree(root);
+  EXPECT_EQ(pool.GetAllocatedNodeCount(), 0);
+}
+
+TEST(NodePool, ReleaseAllChildrenExceptOne) {
+  NodePool pool;
+  Node* root = pool.GetNode();
+  AddChildren(&pool, root, 4);
+  for (Node* iter = root->child; iter; iter = iter->sibling) {
+    AddChildren(&pool, iter, 5);
+  }
+  Node* kept = root->child->sibling;
+  kept->n = 42;
+  EXPECT_EQ(pool.GetAllocatedNodeCount(), 25);
+
+  pool.ReleaseAllChildrenExceptOne(root, kept);
+  pool.WaitForAsyncRelease();
+  EXPECT_EQ(root->child, kept);
+  EXPECT_EQ(kept->sibling, nullptr);
+  EXPECT_EQ(kept->n, 42);
+  EXPECT_NE(kept->child, nullptr);
+  EXPECT_EQ(pool.GetAllocatedNodeCount(), 7);
+
+  // No matching child: everything goes.
+  pool.ReleaseAllChildrenExceptOne(root, nullptr);
+  pool.WaitForAsyncRelease();
+  EXPECT_EQ(root->child, nullptr);
+  EXPECT_EQ(pool.GetAllocatedNodeCount(), 1);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
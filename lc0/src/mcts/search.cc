@@ -19,8 +19,11 @@
 #include "mcts/search.h"
 #include "mcts/node.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include "neural/network_tf.h"
+#include "utils/random.h"
 
 namespace lczero {
 
@@ -40,6 +43,15 @@ const char* kFlipHistoryOption = "(oldbug) Flip opponents history";
 
 const bool kDefaultFlipMove = true;
 const char* kFlipMoveOption = "(oldbug) Flip black's moves";
+
+const bool kDefaultNoise = false;
+const char* kNoiseOption = "Add Dirichlet noise at root node";
+
+const bool kDefaultRandomize = false;
+const char* kRandomizeOption = "Pick moves in proportion to visits";
+
+const int kDefaultTempDecay = 0;
+const char* kTempDecayOption = "Temperature decay (0 = off)";
 }  // namespace
 
 void Search::PopulateUciParams(UciOptions* options) {
@@ -59,13 +71,28 @@ void Search::PopulateUciParams(UciOptions* options) {
 
   options->Add(std::make_unique<CheckOption>(kFlipMoveOption, kDefaultFlipMove,
                                              std::function<void(bool)>{}));
+
+  options->Add(std::make_unique<CheckOption>(
+      kNoiseOption, kDefaultNoise, std::function<void(bool)>{}, "noise"));
+
+  options->Add(std::make_unique<CheckOption>(kRandomizeOption,
+                                             kDefaultRandomize,
+                                             std::function<void(bool)>{},
+                                             "randomize"));
+
+  // Like --tempdecay of the old engine, it also turns randomization on.
+  options->Add(std::make_unique<SpinOption>(kTempDecayOption,
+                                            kDefaultTempDecay, 0, 1000,
+                                            std::function<void(int)>{},
+                                            "tempdecay"));
 }
 
 Search::Search(Node* root_node, NodePool* node_pool, const Network* network,
                BestMoveInfo::Callback best_move_callback,
                UciInfo::Callback info_callback, const SearchLimits& limits,
-               UciOptions* uci_options)
-    : root_node_(root_node),
+               UciOptions* uci_options, SearchWorkerPool* worker_pool)
+    : worker_pool_(worker_pool),
+      root_node_(root_node),
       node_pool_(node_pool),
       network_(network),
       limits_(limits),
@@ -84,10 +111,16 @@ Search::Search(Node* root_node, NodePool* node_pool, const Network* network,
       kFlipHistory(uci_options ? uci_options->GetBoolValue(kFlipHistoryOption)
                                : kDefaultFlipHistory),
       kFlipMove(uci_options ? uci_options->GetBoolValue(kFlipMoveOption)
-                            : kDefaultFlipMove) {}
+                            : kDefaultFlipMove),
+      kNoise(uci_options ? uci_options->GetBoolValue(kNoiseOption)
+                         : kDefaultNoise),
+      kRandomize(uci_options ? uci_options->GetBoolValue(kRandomizeOption)
+                             : kDefaultRandomize),
+      kTempDecay(uci_options ? uci_options->GetIntValue(kTempDecayOption)
+                             : kDefaultTempDecay) {}
 
-void Search::Worker() {
-  std::vector<Node*> nodes_to_process;
+void Search::Worker(SearchWorkerScratch* scratch) {
+  std::vector<Node*>& nodes_to_process = scratch->nodes_to_process;
 
   // do {} while  instead of  while{} because at least one iteration is
   // necessary to get candidates.
@@ -143,6 +176,9 @@ void Search::Worker() {
             n->p /= total;
           }
         }
+        // Other threads only descend into the root once it has a visit, so
+        // there's nobody reading these priors yet.
+        if (kNoise && node == root_node_) AddRootNoise();
         ++idx_in_computation;
       }
     }
@@ -218,6 +254,27 @@ Node* GetBestChild(Node* parent) {
   }
   return best_node;
 }
+
+// Returns a child picked with probability proportional to visits^(1/tau).
+Node* GetRandomChild(Node* parent, float tau) {
+  // Relative to the most visited child, so that small temperatures don't
+  // overflow.
+  const Node* best_node = GetBestChild(parent);
+  if (!best_node || best_node->n == 0) return GetBestChild(parent);
+  const float best = best_node->n;
+  std::vector<double> cumulative;
+  double sum = 0.0;
+  for (Node* node = parent->child; node; node = node->sibling) {
+    sum += std::pow(node->n / best, 1.0f / tau);
+    cumulative.push_back(sum);
+  }
+  const double toss = Random::Get().GetDouble(sum);
+  const auto idx = std::upper_bound(cumulative.begin(), cumulative.end(), toss) -
+                   cumulative.begin();
+  Node* node = parent->child;
+  for (int i = 0; i < idx && node->sibling; ++i) node = node->sibling;
+  return node;
+}
 }  // namespace
 
 // A nodes_mutex_ must be locked when this function is called.
@@ -267,6 +324,10 @@ void Search::MaybeTriggerStop() {
   if (limits_.time_ms >= 0 && GetTimeSinceStart() >= limits_.time_ms) {
     stop_ = true;
   }
+  if (limits_.visits >= 0) {
+    std::shared_lock<std::shared_mutex> nodes_lock(nodes_mutex_);
+    if (root_node_->n >= limits_.visits) stop_ = true;
+  }
   if (stop_ && !responded_bestmove_) {
     responded_bestmove_ = true;
     SendUciInfo();
@@ -424,17 +485,51 @@ InputPlanes Search::EncodeNode(const Node* node) {
 
 Move Search::GetBestMove() const {
   std::shared_lock<std::shared_mutex> lock(nodes_mutex_);
-  Node* best_node = GetBestChild(root_node_);
+  Node* best_node = kRandomize || kTempDecay > 0
+                        ? GetRandomChild(root_node_, GetTemperature())
+                        : GetBestChild(root_node_);
   Move move = best_node->move;
   if (!best_node->board.flipped()) move.Mirror();
   return move;
 }
 
+float Search::GetTemperature() const {
+  if (kTempDecay <= 0) return 1.0f;
+  // Same schedule as the old engine: 1 at the start of the game, going down
+  // faster with larger decay constants, but not below 0.05.
+  const float adjusted_ply =
+      1.0f + (root_node_->ply_count + 1.0f) * kTempDecay / 50.0f;
+  return std::max(0.05f, 1.0f / (1.0f + std::log(adjusted_ply)));
+}
+
+void Search::AddRootNoise() {
+  const float kEpsilon = 0.25f;
+  const float kAlpha = 0.3f;
+  std::vector<float> noise;
+  float total = 0.0f;
+  for (Node* n = root_node_->child; n; n = n->sibling) {
+    noise.push_back(Random::Get().GetGamma(kAlpha, 1.0f));
+    total += noise.back();
+  }
+  // Sums to 0 or a denormal, don't try to normalize.
+  if (total < std::numeric_limits<float>::min()) return;
+  int idx = 0;
+  for (Node* n = root_node_->child; n; n = n->sibling) {
+    n->p = n->p * (1 - kEpsilon) + kEpsilon * noise[idx++] / total;
+  }
+}
+
 void Search::StartThreads(int how_many) {
   std::lock_guard<std::mutex> lock(counters_mutex_);
-  while (threads_.size() < how_many) {
-    threads_.emplace_back([&]() { this->Worker(); });
-  }
+  // A root kept from the previous move already has its priors.
+  if (kNoise && root_node_->child) AddRootNoise();
+  worker_pool_->Start(this, how_many);
+}
+
+void Search::RunBlocking() {
+  if (kNoise && root_node_->child) AddRootNoise();
+  SearchWorkerScratch scratch;
+  Worker(&scratch);
 }
 
 void Search::Stop() {
@@ -454,12 +549,64 @@ void Search::AbortAndWait() {
     responded_bestmove_ = true;
     stop_ = true;
   }
-  while (!threads_.empty()) {
-    threads_.back().join();
-    threads_.pop_back();
-  }
+  worker_pool_->Wait(this);
 }
 
 Search::~Search() { AbortAndWait(); }
 
+void SearchWorkerPool::Start(Search* search, int how_many) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Threads may still be finishing the previous search.
+  search_ = nullptr;
+  cv_.wait(lock, [this]() { return running_ == 0; });
+  while (static_cast<int>(threads_.size()) < how_many) {
+    const int index = threads_.size();
+    threads_.emplace_back([this, index]() { ThreadLoop(index); });
+  }
+  search_ = search;
+  active_threads_ = how_many;
+  ++generation_;
+  cv_.notify_all();
+}
+
+void SearchWorkerPool::Wait(Search* search) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (search_ == search) search_ = nullptr;
+  cv_.wait(lock, [this]() { return running_ == 0; });
+}
+
+void SearchWorkerPool::ThreadLoop(int index) {
+  SearchWorkerScratch scratch;
+  std::uint64_t seen_generation = 0;
+  while (true) {
+    Search* search;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [&]() {
+        return stop_ || (search_ && generation_ != seen_generation &&
+                         index < active_threads_);
+      });
+      if (stop_) return;
+      seen_generation = generation_;
+      search = search_;
+      ++running_;
+    }
+    search->Worker(&scratch);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --running_;
+      cv_.notify_all();
+    }
+  }
+}
+
+SearchWorkerPool::~SearchWorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_all();
+  }
+  for (auto& thread : threads_) thread.join();
+}
+
 }  // namespace lczero
\ No newline at end of file
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <functional>
 #include <shared_mutex>
 #include <thread>
@@ -30,15 +31,57 @@ namespace lczero {
 
 struct SearchLimits {
   std::int64_t nodes = -1;
+  // Visits of the root, including those kept from the previous move.
+  std::int64_t visits = -1;
   std::int64_t time_ms = -1;
 };
 
+class Search;
+
+// Per-thread buffers which are reused from batch to batch and from search to
+// search.
+struct SearchWorkerScratch {
+  std::vector<Node*> nodes_to_process;
+};
+
+// Search threads which are kept alive between searches, so that starting a
+// search is just handing the new Search object to threads which are already
+// waiting.
+class SearchWorkerPool {
+ public:
+  ~SearchWorkerPool();
+
+  // Makes the first @how_many threads run search->Worker(), creating threads
+  // if there are not enough yet. Returns immediately.
+  void Start(Search* search, int how_many);
+  // Prevents threads which didn't pick up the search yet from doing so, and
+  // blocks until all threads have left search->Worker().
+  void Wait(Search* search);
+
+ private:
+  void ThreadLoop(int index);
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::thread> threads_;
+  // Search which threads should pick up. nullptr when there's none.
+  Search* search_ = nullptr;
+  // Incremented on every Start(), so that a thread doesn't pick up the same
+  // search twice.
+  std::uint64_t generation_ = 0;
+  // Threads with index below that take part in the current search.
+  int active_threads_ = 0;
+  // Number of threads currently inside Worker().
+  int running_ = 0;
+  bool stop_ = false;
+};
+
 class Search {
  public:
   Search(Node* root_node, NodePool* node_pool, const Network* network,
          BestMoveInfo::Callback best_move_callback,
          UciInfo::Callback info_callback, const SearchLimits& limits,
-         UciOptions* uci_options);
+         UciOptions* uci_options, SearchWorkerPool* worker_pool);
 
   ~Search();
 
@@ -48,6 +91,14 @@ class Search {
   // Starts worker threads and returns immediately.
   void StartThreads(int how_many);
 
+  // Searches in the calling thread until a limit is reached. Used by
+  // self-play, which runs many games side by side instead.
+  void RunBlocking();
+
+  // Can run several copies of it in separate threads. Normally called by the
+  // SearchWorkerPool.
+  void Worker(SearchWorkerScratch* scratch);
+
   // Stops search. At the end bestmove will be returned. The function is not
   // blocking, so it returns before search is actually done.
   void Stop();
@@ -56,19 +107,22 @@ class Search {
   // Aborts the search, and blocks until all worker thread finish.
   void AbortAndWait();
 
-  // Returns best move, from the point of view of white player.
+  // Returns best move, from the point of view of white player. With
+  // randomization on, the move is picked in proportion to its visits.
   Move GetBestMove() const;
 
  private:
-  // Can run several copies of it in separate threads.
-  void Worker();
-
   uint64_t GetTimeSinceStart() const;
   void MaybeTriggerStop();
   void MaybeOutputInfo();
 
   void SendUciInfo();  // Requires nodes_mutex_ to be held.
 
+  // Mixes Dirichlet noise into the priors of the root children.
+  void AddRootNoise();
+  // Root temperature for picking the move, decaying with the game ply.
+  float GetTemperature() const;
+
   Node* PickNodeToExtend(Node* node);
   InputPlanes EncodeNode(const Node* node);
   void ExtendNode(Node* node);
@@ -76,7 +130,7 @@ class Search {
   std::mutex counters_mutex_;
   bool stop_ = false;
   bool responded_bestmove_ = false;
-  std::vector<std::thread> threads_;
+  SearchWorkerPool* const worker_pool_;
 
   Node* root_node_;
   NodePool* node_pool_;
@@ -99,6 +153,9 @@ class Search {
   const bool kPopulateMoves;
   const bool kFlipHistory;
   const bool kFlipMove;
+  const bool kNoise;
+  const bool kRandomize;
+  const int kTempDecay;
 };
 
 }  // namespace lczero
\ No newline at end of file
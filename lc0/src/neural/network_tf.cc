@@ -153,7 +153,7 @@ class TFNetworkComputation : public NetworkComputation {
  public:
   TFNetworkComputation(const TFNetwork* network) : network_(network) {}
   void AddInput(InputPlanes&& input) override {
-    raw_input_.emplace_back(input);
+    raw_input_.emplace_back(std::move(input));
   }
   void ComputeBlocking() override {
     PrepareInput();
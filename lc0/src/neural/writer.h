@@ -0,0 +1,74 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2018 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <zlib.h>
+#include <cstdint>
+#include <string>
+
+namespace lczero {
+
+// One training sample in the v3 format of training/tf/chunkparser.py. Written
+// as is, so the multi-byte fields assume a little endian host.
+#pragma pack(push, 1)
+struct V3TrainingData {
+  std::uint32_t version;
+  // Visit distribution of the root children, indexed by Move::as_nn_index()
+  // of the move from the point of view of the side to move. That index is
+  // below 1858 for those moves, which is why v3 could drop the rest.
+  float probabilities[1858];
+  // 8 positions of history, 13 planes each: our pieces, their pieces and
+  // "repeated at least once". Square 0 is the highest bit of the first byte.
+  std::uint64_t planes[104];
+  std::uint8_t castling_us_ooo;
+  std::uint8_t castling_us_oo;
+  std::uint8_t castling_them_ooo;
+  std::uint8_t castling_them_oo;
+  std::uint8_t side_to_move;
+  std::uint8_t rule50_count;
+  std::uint8_t move_count;
+  // Game result from the point of view of the side to move.
+  std::int8_t result;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(V3TrainingData) == 8276, "Wrong struct size");
+
+// Writes training samples to a gzipped chunk file.
+class TrainingDataWriter {
+ public:
+  // Creates the chunk file, throws if that fails.
+  TrainingDataWriter(const std::string& filename);
+  // Closes the file if Finalize() wasn't called, ignoring errors.
+  ~TrainingDataWriter() {
+    if (fout_) gzclose(fout_);
+  }
+
+  void WriteChunk(const V3TrainingData& data);
+  // Closes the file. No more writes after that.
+  void Finalize();
+
+  std::string GetFileName() const { return filename_; }
+
+ private:
+  std::string filename_;
+  gzFile fout_;
+};
+
+}  // namespace lczero
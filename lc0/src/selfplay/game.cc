@@ -0,0 +1,161 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2018 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "selfplay/game.h"
+
+namespace lczero {
+
+namespace {
+// Reverses the bits of every byte: the training data has the first square of
+// each byte in its highest bit.
+std::uint64_t ReverseBitsInBytes(std::uint64_t v) {
+  v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+  v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+  return v;
+}
+}  // namespace
+
+SelfPlayGame::SelfPlayGame(const Network* network, UciOptions* options,
+                           const SearchLimits& limits)
+    : network_(network), options_(options), limits_(limits) {
+  ChessBoard starting_board;
+  starting_board.SetFromFen(ChessBoard::kStartingFen);
+  current_head_ = node_pool_.GetNode();
+  current_head_->board = starting_board;
+  current_head_->board_flipped = starting_board;
+  current_head_->board_flipped.Mirror();
+}
+
+void SelfPlayGame::Play() {
+  while ((result_ = ComputeGameResult()) == GameResult::UNDECIDED) {
+    Move best_move;
+    {
+      Search search(current_head_, &node_pool_, network_,
+                    [&best_move](const BestMoveInfo& info) {
+                      best_move = info.bestmove;
+                    },
+                    [](const UciInfo&) {}, limits_, options_, &worker_pool_);
+      search.RunBlocking();
+    }
+    training_data_.push_back(GetTrainingData());
+    MakeMove(best_move);
+  }
+}
+
+GameResult SelfPlayGame::ComputeGameResult() const {
+  const auto& board = current_head_->board;
+  if (board.GenerateValidMoves().empty()) {
+    if (!board.IsUnderCheck()) return GameResult::DRAW;
+    // Checkmated, the side to move lost.
+    return board.flipped() ? GameResult::WHITE_WON : GameResult::BLACK_WON;
+  }
+  if (!board.HasMatingMaterial()) return GameResult::DRAW;
+  if (current_head_->no_capture_ply >= 100) return GameResult::DRAW;
+  if (current_head_->repetitions >= 2) return GameResult::DRAW;
+  return GameResult::UNDECIDED;
+}
+
+V3TrainingData SelfPlayGame::GetTrainingData() const {
+  V3TrainingData result{};
+  result.version = 3;
+
+  // Visit distribution of the search.
+  float total_n = 0.0f;
+  for (Node* n = current_head_->child; n; n = n->sibling) total_n += n->n;
+  if (total_n > 0.0f) {
+    for (Node* n = current_head_->child; n; n = n->sibling) {
+      result.probabilities[n->move.as_nn_index()] = n->n / total_n;
+    }
+  }
+
+  // History planes, all from the point of view of the side to move. Every
+  // other position is the opponent's, its flipped board is ours.
+  const Node* node = current_head_;
+  for (int i = 0; i < 8 && node; ++i, node = node->parent) {
+    const ChessBoard& board = i % 2 == 0 ? node->board : node->board_flipped;
+    std::uint64_t* planes = &result.planes[i * 13];
+    planes[0] = (board.ours() * board.pawns()).as_int();
+    planes[1] = (board.our_knights()).as_int();
+    planes[2] = (board.ours() * board.bishops()).as_int();
+    planes[3] = (board.ours() * board.rooks()).as_int();
+    planes[4] = (board.ours() * board.queens()).as_int();
+    planes[5] = (board.our_king()).as_int();
+    planes[6] = (board.theirs() * board.pawns()).as_int();
+    planes[7] = (board.their_knights()).as_int();
+    planes[8] = (board.theirs() * board.bishops()).as_int();
+    planes[9] = (board.theirs() * board.rooks()).as_int();
+    planes[10] = (board.theirs() * board.queens()).as_int();
+    planes[11] = (board.their_king()).as_int();
+    planes[12] = node->repetitions >= 1 ? ~0ull : 0ull;
+    for (int j = 0; j < 13; ++j) planes[j] = ReverseBitsInBytes(planes[j]);
+  }
+
+  const auto& board = current_head_->board;
+  result.castling_us_ooo = board.castlings().we_can_000();
+  result.castling_us_oo = board.castlings().we_can_00();
+  result.castling_them_ooo = board.castlings().they_can_000();
+  result.castling_them_oo = board.castlings().they_can_00();
+  result.side_to_move = board.flipped();
+  result.rule50_count = current_head_->no_capture_ply;
+  // Not used by the training.
+  result.move_count = 0;
+  return result;
+}
+
+void SelfPlayGame::WriteTrainingData(TrainingDataWriter* writer) const {
+  const int white_result = result_ == GameResult::WHITE_WON
+                               ? 1
+                               : result_ == GameResult::BLACK_WON ? -1 : 0;
+  for (auto data : training_data_) {
+    data.result = data.side_to_move ? -white_result : white_result;
+    writer->WriteChunk(data);
+  }
+}
+
+void SelfPlayGame::MakeMove(Move move) {
+  moves_.push_back(move);
+  if (current_head_->board.flipped()) move.Mirror();
+
+  Node* new_head = nullptr;
+  for (Node* n = current_head_->child; n; n = n->sibling) {
+    if (n->move == move) {
+      new_head = n;
+      break;
+    }
+  }
+  // The parents stay, they're the history planes of the later samples.
+  node_pool_.ReleaseAllChildrenExceptOne(current_head_, new_head);
+  if (!new_head) {
+    new_head = node_pool_.GetNode();
+    current_head_->child = new_head;
+    new_head->parent = current_head_;
+    new_head->move = move;
+    new_head->board_flipped = current_head_->board;
+    const bool capture = new_head->board_flipped.ApplyMove(move);
+    new_head->board = new_head->board_flipped;
+    new_head->board.Mirror();
+    new_head->ply_count = current_head_->ply_count + 1;
+    new_head->no_capture_ply = capture ? 0 : current_head_->no_capture_ply + 1;
+  }
+  // Children which were never extended don't have it yet.
+  new_head->repetitions = ComputeRepetitions(new_head);
+  current_head_ = new_head;
+}
+
+}  // namespace lczero
@@ -0,0 +1,72 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2018 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+#include "mcts/node.h"
+#include "mcts/search.h"
+#include "neural/network.h"
+#include "neural/writer.h"
+#include "ucioptions.h"
+
+namespace lczero {
+
+enum class GameResult { UNDECIDED, WHITE_WON, DRAW, BLACK_WON };
+
+// Plays one game of the network against itself from the starting position,
+// keeping a training sample for every move.
+class SelfPlayGame {
+ public:
+  // Search parameters (noise, randomization, batch size...) come from
+  // @options, which must have been populated by Search::PopulateUciParams().
+  SelfPlayGame(const Network* network, UciOptions* options,
+               const SearchLimits& limits);
+
+  // Plays the game to the end, searching in the calling thread.
+  void Play();
+
+  GameResult GetGameResult() const { return result_; }
+  int GetPlyCount() const { return moves_.size(); }
+  // Moves played, from the point of view of white player.
+  const std::vector<Move>& GetMoves() const { return moves_; }
+
+  // Writes the samples, with the result of the game filled in.
+  void WriteTrainingData(TrainingDataWriter* writer) const;
+
+ private:
+  GameResult ComputeGameResult() const;
+  V3TrainingData GetTrainingData() const;
+  void MakeMove(Move move);
+
+  const Network* const network_;
+  UciOptions* const options_;
+  const SearchLimits limits_;
+
+  NodePool node_pool_;
+  // Never started, the search runs in the game's thread. Must outlive any
+  // Search.
+  SearchWorkerPool worker_pool_;
+  Node* current_head_ = nullptr;
+  std::vector<Move> moves_;
+  // Results are still 0, they're only known at the end.
+  std::vector<V3TrainingData> training_data_;
+  GameResult result_ = GameResult::UNDECIDED;
+};
+
+}  // namespace lczero
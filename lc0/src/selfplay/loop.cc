@@ -0,0 +1,150 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2018 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "selfplay/loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <experimental/filesystem>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include "neural/loader.h"
+#include "neural/network_tf.h"
+#include "neural/writer.h"
+#include "selfplay/game.h"
+#include "ucioptions.h"
+
+namespace lczero {
+
+namespace {
+const char* kWeightsOption = "Network weights file path";
+const char* kAutoDiscover = "<autodiscover>";
+
+const int kDefaultGames = 1;
+const char* kGamesOption = "Number of games to play";
+
+const int kDefaultParallelism = 8;
+const char* kParallelismOption = "Number of games to play in parallel";
+
+const int kDefaultVisits = 800;
+const char* kVisitsOption = "Visits per move";
+
+const char* kTrainingDirOption = "Directory for training data";
+
+void SendResponse(const std::string& response) {
+  static std::mutex output_mutex;
+  std::lock_guard<std::mutex> lock(output_mutex);
+  std::cout << response << std::endl;
+}
+
+const char* ResultString(GameResult result) {
+  switch (result) {
+    case GameResult::WHITE_WON:
+      return "1-0";
+    case GameResult::BLACK_WON:
+      return "0-1";
+    case GameResult::DRAW:
+      return "1/2-1/2";
+    default:
+      return "*";
+  }
+}
+
+// Continues the numbering of the chunks already in @dir, like the old engine
+// does.
+int CountChunks(const std::string& dir) {
+  namespace fs = std::experimental::filesystem;
+  int count = 0;
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    if (fs::is_regular_file(entry.path())) ++count;
+  }
+  return count;
+}
+}  // namespace
+
+void SelfPlayLoop(int argc, const char** argv) {
+  UciOptions options(argc, argv);
+  options.Add(std::make_unique<StringOption>(kWeightsOption, kAutoDiscover,
+                                             nullptr, "weights", 'w'));
+  options.Add(std::make_unique<SpinOption>(kGamesOption, kDefaultGames, 1,
+                                           999999, nullptr, "games"));
+  options.Add(std::make_unique<SpinOption>(kParallelismOption,
+                                           kDefaultParallelism, 1, 256,
+                                           nullptr, "parallelism", 'p'));
+  options.Add(std::make_unique<SpinOption>(kVisitsOption, kDefaultVisits, 1,
+                                           1000000, nullptr, "visits", 'v'));
+  options.Add(std::make_unique<StringOption>(kTrainingDirOption, "training",
+                                             nullptr, "training-dir"));
+  Search::PopulateUciParams(&options);
+  if (!options.ProcessAllFlags()) return;
+
+  std::string net_path = options.GetOption(kWeightsOption)->GetStringValue();
+  if (net_path == kAutoDiscover) {
+    net_path = DiscoveryWeightsFile(options.GetProgramName());
+  }
+  Weights weights = LoadWeightsFromFile(net_path);
+  // All games evaluate their positions through this one network.
+  const std::unique_ptr<Network> network = MakeTensorflowNetwork(weights);
+
+  const std::string dir = options.GetOption(kTrainingDirOption)->GetStringValue();
+  std::experimental::filesystem::create_directories(dir);
+  std::atomic<int> next_chunk{CountChunks(dir)};
+
+  SearchLimits limits;
+  limits.visits = options.GetIntValue(kVisitsOption);
+  const int total_games = options.GetIntValue(kGamesOption);
+  std::atomic<int> next_game{0};
+
+  // Every thread plays games one after another. The games take turns on the
+  // network, which keeps it busy while the others walk their trees.
+  std::vector<std::thread> threads;
+  const int parallelism =
+      std::min(options.GetIntValue(kParallelismOption), total_games);
+  for (int i = 0; i < parallelism; ++i) {
+    threads.emplace_back([&]() {
+      for (int game_id = next_game++; game_id < total_games;
+           game_id = next_game++) {
+        const auto start = std::chrono::steady_clock::now();
+        SelfPlayGame game(network.get(), &options, limits);
+        game.Play();
+
+        const std::string filename =
+            dir + "/training." + std::to_string(next_chunk++) + ".gz";
+        TrainingDataWriter writer(filename);
+        game.WriteTrainingData(&writer);
+        writer.Finalize();
+
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+        std::string moves;
+        for (const auto& move : game.GetMoves()) moves += " " + move.as_string();
+        SendResponse("game " + std::to_string(game_id + 1) + "/" +
+                     std::to_string(total_games) + " " +
+                     ResultString(game.GetGameResult()) + " plies " +
+                     std::to_string(game.GetPlyCount()) + " time " +
+                     std::to_string(seconds) + "s chunk " + filename +
+                     " moves" + moves);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+}
+
+}  // namespace lczero
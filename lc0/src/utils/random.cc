@@ -0,0 +1,42 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2018 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "utils/random.h"
+
+namespace lczero {
+
+Random::Random() : gen_(std::random_device()()) {}
+
+Random& Random::Get() {
+  static Random rand;
+  return rand;
+}
+
+double Random::GetDouble(double max) {
+  std::uniform_real_distribution<> dist(0.0, max);
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dist(gen_);
+}
+
+float Random::GetGamma(float alpha, float beta) {
+  std::gamma_distribution<float> dist(alpha, beta);
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dist(gen_);
+}
+
+}  // namespace lczero
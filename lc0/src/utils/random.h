@@ -0,0 +1,43 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2018 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <random>
+
+namespace lczero {
+
+// Process-wide random number generator, safe to use from several threads.
+class Random {
+ public:
+  static Random& Get();
+
+  // Uniform in [0, max).
+  double GetDouble(double max);
+  // Sample of the gamma distribution with shape alpha and scale beta.
+  float GetGamma(float alpha, float beta);
+
+ private:
+  Random();
+
+  std::mutex mutex_;
+  std::mt19937 gen_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,371 @@
+#!/usr/bin/env python3
+
+# This file is part of Leela Chess.
+# Copyright (C) 2018 The Leela Chess Authors
+#
+# Leela Chess is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Leela Chess is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Leela Chess. If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Measures how fast a UCI engine answers a GUI, by driving it over pipes
+the way a GUI does in fast games.
+
+Scenarios:
+  startup   uci, then the first isready. With --uci in the engine
+            arguments this includes loading the network.
+  isready   isready pings while the engine is idle.
+  movetime  position + go movetime bursts, sent as soon as the previous
+            bestmove arrives, with isready right after each bestmove.
+  stop      go infinite, then stop after a random delay, followed by a
+            storm of extra stop and isready commands.
+  ponder    setoption Ponder, then go ponder, and ponderhit or stop
+            after a random delay.
+
+Each measured latency is in milliseconds:
+  isready_cold           first isready to readyok
+  isready                isready to readyok while idle
+  isready_after_bestmove isready to readyok right after a bestmove
+  movetime_overshoot     bestmove arrival minus go time, minus movetime
+  stop                   stop to bestmove
+  ponderhit_overshoot    ponderhit to bestmove, minus movetime
+  ponder_stop            stop to bestmove while pondering
+
+A bestmove that arrives when none is expected, before the stop or
+ponderhit it should answer, or not in time, is counted as a protocol
+error.
+
+Example, failing if the 99th percentile of stop latency is above 50 ms:
+  uci_latency.py --engine ./lczero --args "-w weights.txt" --limit stop=50
+"""
+
+import argparse
+import json
+import queue
+import random
+import shlex
+import subprocess
+import sys
+import threading
+import time
+
+POSITIONS = [
+    "position startpos",
+    "position startpos moves e2e4 e7e5 g1f3 b8c6 f1b5",
+    "position startpos moves d2d4 g8f6 c2c4 e7e6 b1c3 f8b4",
+    "position fen r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R w KQ - 0 8",
+    "position fen 8/5pk1/6p1/8/3R4/6P1/5PKP/r7 b - - 0 40",
+]
+
+PONDER_POSITIONS = [
+    ("position startpos moves e2e4", "e7e5"),
+    ("position startpos moves d2d4", "d7d5"),
+    ("position startpos moves e2e4 c7c5 g1f3", "d7d6"),
+]
+
+class ProtocolError(Exception):
+    pass
+
+class Engine:
+    def __init__(self, command, log):
+        self.proc = subprocess.Popen(command, stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE,
+                                     stderr=subprocess.DEVNULL,
+                                     universal_newlines=True, bufsize=1)
+        self.lines = queue.Queue()
+        self.log = log
+        self.reader = threading.Thread(target=self.read, daemon=True)
+        self.reader.start()
+
+    def read(self):
+        # Timestamped as they are read, so waiting in the main thread
+        # does not add to the latencies.
+        for line in self.proc.stdout:
+            self.lines.put((time.monotonic(), line.strip()))
+        self.lines.put((time.monotonic(), None))
+
+    def send(self, command):
+        if self.log:
+            print(">> " + command, file=sys.stderr)
+        now = time.monotonic()
+        self.proc.stdin.write(command + "\n")
+        self.proc.stdin.flush()
+        return now
+
+    def wait_for(self, prefix, timeout, unexpected=None):
+        """
+        Returns the time the first line starting with prefix arrived.
+        Lines starting with unexpected before it raise a ProtocolError.
+        """
+        deadline = time.monotonic() + timeout
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                raise ProtocolError("no '%s' within %.1f s" % (prefix, timeout))
+            try:
+                stamp, line = self.lines.get(timeout=remaining)
+            except queue.Empty:
+                continue
+            if line is None:
+                raise ProtocolError("engine exited waiting for '%s'" % prefix)
+            if self.log:
+                print("<< " + line, file=sys.stderr)
+            if line.startswith(prefix):
+                return stamp
+            if unexpected and line.startswith(unexpected):
+                raise ProtocolError("unexpected '%s' waiting for '%s'"
+                                    % (line, prefix))
+
+    def sync(self, timeout):
+        """
+        Waits until the engine answers isready, returns the number of
+        bestmoves that arrived before readyok.
+        """
+        sent = self.send("isready")
+        stray = 0
+        deadline = sent + timeout
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                raise ProtocolError("no 'readyok' within %.1f s" % timeout)
+            try:
+                stamp, line = self.lines.get(timeout=remaining)
+            except queue.Empty:
+                continue
+            if line is None:
+                raise ProtocolError("engine exited waiting for 'readyok'")
+            if self.log:
+                print("<< " + line, file=sys.stderr)
+            if line.startswith("bestmove"):
+                stray += 1
+            if line == "readyok":
+                return stray
+
+    def quit(self):
+        try:
+            self.send("quit")
+            self.proc.wait(timeout=10)
+        except (OSError, subprocess.TimeoutExpired):
+            self.proc.kill()
+
+class Results:
+    def __init__(self):
+        self.samples = {}
+        self.errors = []
+
+    def add(self, name, seconds):
+        self.samples.setdefault(name, []).append(seconds * 1000.0)
+
+    def error(self, scenario, message):
+        self.errors.append("%s: %s" % (scenario, message))
+
+    @staticmethod
+    def percentile(values, p):
+        ordered = sorted(values)
+        index = min(len(ordered) - 1, int(round(p / 100.0 * (len(ordered) - 1))))
+        return ordered[index]
+
+    def summary(self):
+        table = {}
+        for name, values in self.samples.items():
+            table[name] = {
+                "count": len(values),
+                "min": min(values),
+                "mean": sum(values) / len(values),
+                "p50": self.percentile(values, 50),
+                "p90": self.percentile(values, 90),
+                "p99": self.percentile(values, 99),
+                "max": max(values),
+            }
+        return table
+
+    def print(self):
+        print("%-24s %6s %9s %9s %9s %9s %9s" %
+              ("latency (ms)", "count", "min", "p50", "p90", "p99", "max"))
+        for name, s in sorted(self.summary().items()):
+            print("%-24s %6d %9.1f %9.1f %9.1f %9.1f %9.1f" %
+                  (name, s["count"], s["min"], s["p50"], s["p90"],
+                   s["p99"], s["max"]))
+        print("protocol errors: %d" % len(self.errors))
+        for e in self.errors:
+            print("  " + e)
+
+def run_startup(engine, cfg, results):
+    engine.send("uci")
+    engine.wait_for("uciok", cfg.timeout)
+    sent = engine.send("isready")
+    results.add("isready_cold", engine.wait_for("readyok", cfg.timeout) - sent)
+
+def run_isready(engine, cfg, results):
+    for _ in range(cfg.iterations):
+        sent = engine.send("isready")
+        results.add("isready", engine.wait_for("readyok", cfg.timeout) - sent)
+
+def run_movetime(engine, cfg, results):
+    for movetime in cfg.movetime:
+        for i in range(cfg.iterations):
+            engine.send(POSITIONS[i % len(POSITIONS)])
+            sent = engine.send("go movetime %d" % movetime)
+            stamp = engine.wait_for("bestmove", cfg.timeout + movetime / 1000.0)
+            results.add("movetime_overshoot", stamp - sent - movetime / 1000.0)
+            sent = engine.send("isready")
+            results.add("isready_after_bestmove",
+                        engine.wait_for("readyok", cfg.timeout,
+                                        unexpected="bestmove") - sent)
+
+def run_stop(engine, cfg, results, rng):
+    for i in range(cfg.iterations):
+        engine.send(POSITIONS[i % len(POSITIONS)])
+        engine.send("go infinite")
+        time.sleep(rng.uniform(0, cfg.max_delay / 1000.0))
+        sent = engine.send("stop")
+        # A GUI that loses patience repeats itself.
+        for _ in range(cfg.storm):
+            engine.send("stop")
+            engine.send("isready")
+        stamp = engine.wait_for("bestmove", cfg.timeout)
+        if stamp < sent:
+            results.error("stop", "bestmove before stop, go infinite ended")
+        else:
+            results.add("stop", stamp - sent)
+        # One readyok per isready of the storm, then ours.
+        for _ in range(cfg.storm):
+            engine.wait_for("readyok", cfg.timeout, unexpected="bestmove")
+        stray = engine.sync(cfg.timeout)
+        if stray:
+            results.error("stop", "%d extra bestmove after one go" % stray)
+
+def run_ponder(engine, cfg, results, rng):
+    movetime = cfg.movetime[0]
+    engine.send("setoption name Ponder value true")
+    for i in range(cfg.iterations):
+        position, reply = PONDER_POSITIONS[i % len(PONDER_POSITIONS)]
+        engine.send("%s %s" % (position, reply))
+        engine.send("go ponder movetime %d" % movetime)
+        time.sleep(rng.uniform(0, cfg.max_delay / 1000.0))
+        if i % 2 == 0:
+            sent = engine.send("ponderhit")
+            try:
+                stamp = engine.wait_for("bestmove",
+                                        cfg.timeout + movetime / 1000.0)
+            except ProtocolError as e:
+                results.error("ponder", str(e))
+                engine.sync(cfg.timeout)
+                continue
+            if stamp < sent:
+                results.error("ponder", "bestmove before ponderhit")
+            else:
+                results.add("ponderhit_overshoot",
+                            stamp - sent - movetime / 1000.0)
+        else:
+            sent = engine.send("stop")
+            stamp = engine.wait_for("bestmove", cfg.timeout)
+            if stamp < sent:
+                results.error("ponder", "bestmove before stop")
+            else:
+                results.add("ponder_stop", stamp - sent)
+        stray = engine.sync(cfg.timeout)
+        if stray:
+            results.error("ponder", "%d extra bestmove after one go" % stray)
+
+def get_configuration():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--engine", type=str, required=True,
+                        help="engine executable")
+    parser.add_argument("--args", type=str, default="",
+                        help="engine arguments, in one string")
+    parser.add_argument("--scenarios", type=str,
+                        default="startup,isready,movetime,stop,ponder",
+                        help="comma separated scenarios to run")
+    parser.add_argument("--iterations", type=int, default=20,
+                        help="repetitions per scenario and movetime")
+    parser.add_argument("--movetime", type=int, nargs="+", default=[10, 100],
+                        help="movetimes in ms, ponder uses the first")
+    parser.add_argument("--max-delay", type=int, default=200,
+                        help="longest random delay before stop or ponderhit, in ms")
+    parser.add_argument("--storm", type=int, default=3,
+                        help="extra stop and isready pairs after each stop")
+    parser.add_argument("--timeout", type=float, default=30.0,
+                        help="seconds to wait for an answer")
+    parser.add_argument("--seed", type=int, default=1,
+                        help="seed for the random delays")
+    parser.add_argument("--limit", type=str, action="append", default=[],
+                        help="fail if the p99 of a latency is above it, "
+                             "as name=ms, for example stop=50")
+    parser.add_argument("--json", type=str, default="",
+                        help="also write the results to this file")
+    parser.add_argument("--verbose", action="store_true",
+                        help="log the conversation to stderr")
+    return parser.parse_args()
+
+def check_limits(cfg, summary):
+    failed = False
+    for limit in cfg.limit:
+        name, _, ms = limit.partition("=")
+        if name not in summary:
+            print("limit %s: no samples" % name)
+            failed = True
+            continue
+        p99 = summary[name]["p99"]
+        ok = p99 <= float(ms)
+        print("limit %s: p99 %.1f ms, limit %s ms, %s" %
+              (name, p99, ms, "ok" if ok else "FAILED"))
+        failed = failed or not ok
+    return not failed
+
+def main():
+    cfg = get_configuration()
+    rng = random.Random(cfg.seed)
+    results = Results()
+    engine = Engine([cfg.engine] + shlex.split(cfg.args), cfg.verbose)
+    scenarios = cfg.scenarios.split(",")
+    try:
+        if "startup" in scenarios:
+            run_startup(engine, cfg, results)
+        else:
+            engine.send("uci")
+            engine.wait_for("uciok", cfg.timeout)
+            engine.sync(cfg.timeout)
+        for scenario in scenarios:
+            try:
+                if scenario == "isready":
+                    run_isready(engine, cfg, results)
+                elif scenario == "movetime":
+                    run_movetime(engine, cfg, results)
+                elif scenario == "stop":
+                    run_stop(engine, cfg, results, rng)
+                elif scenario == "ponder":
+                    run_ponder(engine, cfg, results, rng)
+                elif scenario != "startup":
+                    print("unknown scenario %s" % scenario, file=sys.stderr)
+                    return 2
+            except ProtocolError as e:
+                results.error(scenario, str(e))
+                # Give the engine a chance to get back in step.
+                engine.sync(cfg.timeout)
+    except ProtocolError as e:
+        results.error("engine", str(e))
+    finally:
+        engine.quit()
+
+    results.print()
+    summary = results.summary()
+    if cfg.json:
+        with open(cfg.json, "w") as f:
+            json.dump({"latency_ms": summary, "errors": results.errors}, f,
+                      indent=2)
+    ok = check_limits(cfg, summary)
+    return 0 if ok and not results.errors else 1
+
+if __name__ == "__main__":
+    sys.exit(main())
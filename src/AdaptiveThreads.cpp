@@ -0,0 +1,118 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+
+#include "AdaptiveThreads.h"
+#include "Parameters.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+std::atomic<std::uint64_t> AdaptiveThreads::m_evals{0};
+std::atomic<std::uint64_t> AdaptiveThreads::m_eval_wait_us{0};
+std::atomic<std::uint64_t> AdaptiveThreads::m_collisions{0};
+
+AdaptiveThreads& AdaptiveThreads::get() {
+    static AdaptiveThreads adaptive_threads;
+    return adaptive_threads;
+}
+
+// Start at the configured count, so the first probe goes down.
+AdaptiveThreads::AdaptiveThreads()
+    : m_threads(cfg_num_threads), m_direction(-1) {
+}
+
+void AdaptiveThreads::search_started() {
+    m_start = std::chrono::steady_clock::now();
+    m_start_evals = m_evals.load();
+    m_start_wait_us = m_eval_wait_us.load();
+    m_start_collisions = m_collisions.load();
+}
+
+void AdaptiveThreads::search_finished(int playouts) {
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - m_start).count();
+    const auto evals = m_evals.load() - m_start_evals;
+    if (evals < MIN_EVALS || elapsed < MIN_SECONDS) {
+        return;
+    }
+    const auto collisions = m_collisions.load() - m_start_collisions;
+    const auto wait_us = m_eval_wait_us.load() - m_start_wait_us;
+
+    update(evals / elapsed,
+           double(collisions) / std::max(1.0, double(playouts + collisions)),
+           wait_us / 1000.0 / evals);
+}
+
+void AdaptiveThreads::update(double rate, double collision_rate,
+                             double wait_ms) {
+    myprintf("auto-threads: %d threads, %.0f evals/s, "
+             "%.1f%% collisions, %.2f ms per eval\n",
+             threads(), rate, 100.0 * collision_rate, wait_ms);
+
+    if (m_probing) {
+        m_probing = false;
+        if (rate > m_rate * (1.0 + MIN_GAIN)) {
+            myprintf("auto-threads: keeping %d threads (%.0f -> %.0f evals/s)\n",
+                     m_probe_threads, m_rate, rate);
+            m_threads = m_probe_threads;
+            m_rate = rate;
+            // Keep the direction, the next probe goes one step further.
+            return;
+        }
+        myprintf("auto-threads: back to %d threads (%.0f -> %.0f evals/s)\n",
+                 m_threads, m_rate, rate);
+        m_direction = -m_direction;
+        m_hold = HOLD_SEARCHES;
+        // The load may have changed, so measure the old count again.
+        m_rate = 0.0;
+        return;
+    }
+
+    // Smooth the rate at the current count, so one noisy search does not
+    // decide the next comparison.
+    m_rate = m_rate > 0.0 ? 0.5 * (m_rate + rate) : rate;
+    if (m_hold > 0) {
+        m_hold--;
+        return;
+    }
+    start_probe(collision_rate);
+}
+
+void AdaptiveThreads::start_probe(double collision_rate) {
+    const auto max_threads = std::max(1, cfg_num_threads);
+    if (m_direction > 0 && collision_rate > MAX_COLLISION_RATE) {
+        m_direction = -1;
+    }
+    auto candidate = std::min(std::max(m_threads + m_direction, 1), max_threads);
+    if (candidate == m_threads) {
+        m_direction = -m_direction;
+        if (m_direction > 0 && collision_rate > MAX_COLLISION_RATE) {
+            return;
+        }
+        candidate = std::min(std::max(m_threads + m_direction, 1), max_threads);
+        if (candidate == m_threads) {
+            return;
+        }
+    }
+    m_probe_threads = candidate;
+    m_probing = true;
+}
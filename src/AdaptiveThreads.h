@@ -0,0 +1,91 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ADAPTIVETHREADS_H_INCLUDED
+#define ADAPTIVETHREADS_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Picks the number of search threads with --auto-threads. The best count
+// depends on the net, the backend and whatever else runs on the host, so
+// it is found by trial: after each search the rate of network evaluations
+// is compared with the rate at the previous count, and the count is moved
+// one step at a time between 1 and cfg_num_threads. Too many threads show
+// up as collisions (threads finding a node already being expanded) before
+// they show up in the rate, so a high collision rate blocks going up.
+//
+// There is a single evaluation per search thread in flight, so there is
+// no separate batch size to adapt: the thread count is the batch size.
+class AdaptiveThreads {
+public:
+    static AdaptiveThreads& get();
+
+    // Threads to use for the next search.
+    int threads() const { return m_probing ? m_probe_threads : m_threads; }
+
+    void search_started();
+    // playouts: completed playouts of the search.
+    void search_finished(int playouts);
+
+    // Counters, updated by the search threads.
+    static void count_eval(std::chrono::microseconds wait) {
+        m_evals.fetch_add(1, std::memory_order_relaxed);
+        m_eval_wait_us.fetch_add(wait.count(), std::memory_order_relaxed);
+    }
+    static void count_collision() {
+        m_collisions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Searches shorter than this say little about the rate.
+    static constexpr auto MIN_EVALS = 200;
+    static constexpr auto MIN_SECONDS = 0.1;
+    // A new count must beat the old one by this much to be kept.
+    static constexpr auto MIN_GAIN = 0.03;
+    // Don't add threads if more playouts than this collide.
+    static constexpr auto MAX_COLLISION_RATE = 0.10;
+    // Searches to wait after a rejected change before trying again.
+    static constexpr auto HOLD_SEARCHES = 8;
+
+private:
+    AdaptiveThreads();
+    void update(double rate, double collision_rate, double wait_ms);
+    void start_probe(double collision_rate);
+
+    int m_threads;
+    int m_probe_threads{0};
+    bool m_probing{false};
+    int m_direction{1};
+    int m_hold{0};
+    // Evaluations per second at m_threads, 0 if not measured yet.
+    double m_rate{0.0};
+
+    std::chrono::steady_clock::time_point m_start;
+    std::uint64_t m_start_evals{0};
+    std::uint64_t m_start_wait_us{0};
+    std::uint64_t m_start_collisions{0};
+
+    static std::atomic<std::uint64_t> m_evals;
+    static std::atomic<std::uint64_t> m_eval_wait_us;
+    static std::atomic<std::uint64_t> m_collisions;
+};
+
+#endif
@@ -21,7 +21,6 @@
 #include <algorithm>
 
 #include "Bitboard.h"
-#include "Random.h"
 
 uint8_t PopCnt16[1 << 16];
 int SquareDistance[SQUARE_NB][SQUARE_NB];
@@ -54,7 +53,88 @@ namespace {
   Bitboard RookTable[0x19000];  // To store rook attacks
   Bitboard BishopTable[0x1480]; // To store bishop attacks
 
-  void init_magics(Bitboard table[], Magic magics[], Direction directions[]);
+  // Magics for the 32 bit and the 64 bit index of Magic::index(), found
+  // with the PRNG search Stockfish runs at startup. That search took most
+  // of the startup time, so the results are stored instead.
+  const Bitboard RookMagicNumbers[2][SQUARE_NB] = {
+    {
+      0x1240001000802180ULL, 0x08C1100A00808020ULL, 0x0842801104042001ULL, 0x0010280400818008ULL,
+      0x0024498100200A11ULL, 0x20C20C0801000801ULL, 0x0120009080800142ULL, 0x0A0201E001008001ULL,
+      0x1501500102040201ULL, 0x0060902000402018ULL, 0x1810040300106008ULL, 0x0008404000804410ULL,
+      0x0880520241004005ULL, 0x0002441002008082ULL, 0x0101452000010082ULL, 0x004040A318010001ULL,
+      0x8A40052108100020ULL, 0x8040060040008A01ULL, 0x10A0140A08082020ULL, 0x0600618050100104ULL,
+      0x3018510180080102ULL, 0x0044930100100204ULL, 0x0004820040000901ULL, 0x4080006600007101ULL,
+      0x00210285800084DAULL, 0x00210285800084DAULL, 0x8010418821052001ULL, 0x020020A842084012ULL,
+      0x9800081400C28509ULL, 0xC380123810000402ULL, 0x6100820050208401ULL, 0x0800410400000082ULL,
+      0x068004900000A840ULL, 0x00400A448000E010ULL, 0x0C010020000C4082ULL, 0x0080080109108030ULL,
+      0x2902009000082008ULL, 0x040808060040600DULL, 0x8404081000229025ULL, 0x0040104000210085ULL,
+      0x85218000102180C0ULL, 0x0248400000009060ULL, 0x2000801221048070ULL, 0x1010100012022801ULL,
+      0x1900404200320104ULL, 0x0040407400000201ULL, 0x11010003004B0006ULL, 0x000080800800640BULL,
+      0x080C20040C0290A4ULL, 0x8080288040024040ULL, 0x02040208001000C8ULL, 0x0708004000AC02D0ULL,
+      0x120400400018480AULL, 0x0100404010000204ULL, 0x0012008000288015ULL, 0x0100404004000281ULL,
+      0x003042820B00110AULL, 0x003042820B00110AULL, 0x6512630100500820ULL, 0x1044300A62012042ULL,
+      0x086C06D108150008ULL, 0x0008048100044281ULL, 0x0420860118120043ULL, 0x0300408904084063ULL
+    },
+    {
+      0x0280132180004001ULL, 0x12C0044020001002ULL, 0x0200084010208202ULL, 0x4080041002800801ULL,
+      0x4080020801040080ULL, 0x6200100200010408ULL, 0x0480008001000200ULL, 0x0280010001A44080ULL,
+      0x0804800080284000ULL, 0x6044401000402000ULL, 0xC002801001200084ULL, 0x0010800800100080ULL,
+      0x0800800800800400ULL, 0x1104801400220080ULL, 0x0042000200080401ULL, 0x0A24802080005100ULL,
+      0x2080208000904000ULL, 0x0000828020004000ULL, 0x0010008020001084ULL, 0x4082020020401009ULL,
+      0x4018808004000800ULL, 0x6011010008040002ULL, 0x0000840081080210ULL, 0x4201020016448403ULL,
+      0x0000A09280024008ULL, 0x0010400040201001ULL, 0x0000804200120020ULL, 0x10004212000A0020ULL,
+      0x0006004600082030ULL, 0x8280020080800400ULL, 0x35A1000101020004ULL, 0x02000042000400A1ULL,
+      0x4000401020800080ULL, 0x0090002000400050ULL, 0x800020008080100AULL, 0x0020210009001000ULL,
+      0x0427001007000800ULL, 0x0180020080800400ULL, 0x0540025184000810ULL, 0x88C0410052000094ULL,
+      0x0880004020004000ULL, 0x400150002000C002ULL, 0x4450002408002000ULL, 0x004800801000800CULL,
+      0x0008000C00818008ULL, 0x8080204004080110ULL, 0xB400010250040028ULL, 0x0100904120820014ULL,
+      0x0100204006800380ULL, 0x0000832000400280ULL, 0x0100200011004100ULL, 0x0210090010002100ULL,
+      0x2008800400080080ULL, 0x0004042010400801ULL, 0x0040020890010400ULL, 0x4100390400814600ULL,
+      0x008C800044102101ULL, 0x1801001420844001ULL, 0x2000082000104101ULL, 0x0221012104081001ULL,
+      0x0801000290080005ULL, 0x0002002B50084C02ULL, 0x4008100082610804ULL, 0x8004808041040822ULL
+    }
+  };
+  const Bitboard BishopMagicNumbers[2][SQUARE_NB] = {
+    {
+      0x46021442A0020A50ULL, 0x050021030294C228ULL, 0x0B41002210060826ULL, 0x4C18084001640502ULL,
+      0x808840C080451041ULL, 0x100400024A061202ULL, 0x9052034808040086ULL, 0x441002440001A405ULL,
+      0x049A009800800412ULL, 0x049A009800800412ULL, 0x0401840880110401ULL, 0x8080022440000405ULL,
+      0x114004081A0090A5ULL, 0x82130C2542011111ULL, 0x8509090008800D04ULL, 0x05101A2203000021ULL,
+      0x0A2C882008184020ULL, 0x5102068512242021ULL, 0x8254002801105022ULL, 0x1042080203012004ULL,
+      0x210A000000212802ULL, 0x8401D00004002121ULL, 0x0808243080015005ULL, 0x0148024040088C81ULL,
+      0x844A080102445404ULL, 0x6041010004086800ULL, 0x02020440AC048184ULL, 0x0020202008C04900ULL,
+      0x0424880424010101ULL, 0x2408843000103082ULL, 0x80809C0800440400ULL, 0x4230410402010D03ULL,
+      0x2020208200040415ULL, 0x3084090080440C20ULL, 0x10080040040C0024ULL, 0x4A81004401002808ULL,
+      0xE101901000011204ULL, 0x0084900000208081ULL, 0x0800888380088E04ULL, 0x14084410000202C1ULL,
+      0x1488040021040222ULL, 0x0220E12008022A07ULL, 0x3101100000805205ULL, 0x40800806080500D2ULL,
+      0x02111100040C40A1ULL, 0x0910C48004285190ULL, 0x0100060020C60D21ULL, 0x1140108620030806ULL,
+      0x20080301201A0A01ULL, 0x0A04020420862C02ULL, 0x0504016448290904ULL, 0x1C09021080244181ULL,
+      0x0244000310500020ULL, 0x09420D0281220818ULL, 0x04C40901A0200404ULL, 0x0404410A01100112ULL,
+      0x1404440020030062ULL, 0x0201140007100242ULL, 0x0201140007100242ULL, 0x0084040000000B01ULL,
+      0x1830241108080440ULL, 0x5010012890400290ULL, 0x0808011A08401A02ULL, 0x2408A02400C00604ULL
+    },
+    {
+      0x0C08081028882700ULL, 0x0010900101429280ULL, 0x0810408081000408ULL, 0x0404440080008800ULL,
+      0x002C052000010002ULL, 0x0192011008080200ULL, 0x00B4020805442800ULL, 0x0000802101202002ULL,
+      0x0000301019010420ULL, 0x0000301019010420ULL, 0x0014120802002400ULL, 0x0004A11045024002ULL,
+      0x0301045040000002ULL, 0x0003011028040A30ULL, 0x2000412410220808ULL, 0x010300820082A002ULL,
+      0x8040002202042100ULL, 0x0004030808081040ULL, 0x4208009242040920ULL, 0x4884001844010800ULL,
+      0x2804000210140010ULL, 0x402080910080C02CULL, 0x4003208288082240ULL, 0x0401000480880140ULL,
+      0x2912130040041800ULL, 0x1802502002040800ULL, 0x000808040C022023ULL, 0x0001080004004091ULL,
+      0x6020840200802000ULL, 0x000111014A008080ULL, 0x0004004088980402ULL, 0x02C0908402020080ULL,
+      0x0042484080A00280ULL, 0x8001042028420802ULL, 0x8204008200204200ULL, 0x0220020080080080ULL,
+      0x2D00420400020090ULL, 0x0812020200054820ULL, 0x1241440C04510D00ULL, 0xA400A2020008412AULL,
+      0x490210028819A040ULL, 0x0A04480470408440ULL, 0x4099008041001008ULL, 0xC001004208000480ULL,
+      0x0000221040402C00ULL, 0x8101022202000411ULL, 0x8004581800404520ULL, 0x1048120C00408028ULL,
+      0x00009808021000A0ULL, 0x0001005110082208ULL, 0x0023188208160008ULL, 0x0001102042020122ULL,
+      0x0084151042022006ULL, 0x00003802081A0808ULL, 0x0108020818010114ULL, 0x0208121414202000ULL,
+      0x3A81404848084000ULL, 0x0000184404148200ULL, 0x0804000022095000ULL, 0x2A20440188840404ULL,
+      0x1800404010020208ULL, 0x00138060E2020208ULL, 0x8A1A087014208420ULL, 0x08880150048A0084ULL
+    }
+  };
+
+  void init_magics(Bitboard table[], Magic magics[], Direction directions[],
+                   const Bitboard magic_numbers[]);
 
   // bsf_index() returns the index into BSFTable[] to look up the bitscan. Uses
   // Matt Taylor's folding for 32 bit case, extended to 64 bit by Kim Walisch.
@@ -202,8 +282,8 @@ void Bitboards::init() {
   Direction RookDirections[] = { NORTH,  EAST,  SOUTH,  WEST };
   Direction BishopDirections[] = { NORTH_EAST, SOUTH_EAST, SOUTH_WEST, NORTH_WEST };
 
-  init_magics(RookTable, RookMagics, RookDirections);
-  init_magics(BishopTable, BishopMagics, BishopDirections);
+  init_magics(RookTable, RookMagics, RookDirections, RookMagicNumbers[Is64Bit]);
+  init_magics(BishopTable, BishopMagics, BishopDirections, BishopMagicNumbers[Is64Bit]);
 
   for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
   {
@@ -249,14 +329,11 @@ namespace {
   // chessprogramming.wikispaces.com/Magic+Bitboards. In particular, here we
   // use the so called "fancy" approach.
 
-  void init_magics(Bitboard table[], Magic magics[], Direction directions[]) {
-
-    // Optimal PRNG seeds to pick the correct magics in the shortest time
-    int seeds[][RANK_NB] = { { 8977, 44560, 54343, 38998,  5731, 95205, 104912, 17020 },
-                             {  728, 10316, 55013, 32803, 12281, 15100,  16645,   255 } };
+  void init_magics(Bitboard table[], Magic magics[], Direction directions[],
+                   const Bitboard magic_numbers[]) {
 
     Bitboard occupancy[4096], reference[4096], edges, b;
-    int epoch[4096] = {}, cnt = 0, size = 0;
+    int size = 0;
 
     for (Square s = SQ_A1; s <= SQ_H8; ++s)
     {
@@ -293,33 +370,14 @@ namespace {
         if (HasPext)
             continue;
 
-        Random rng(seeds[Is64Bit][rank_of(s)]);
-
-        // Find a magic for square 's' picking up an (almost) random number
-        // until we find the one that passes the verification test.
-        for (int i = 0; i < size; )
+        // Every occupancy maps to an index that looks up its sliding
+        // attack. Occupancies sharing an index have the same attack.
+        m.magic = magic_numbers[s];
+        for (int i = 0; i < size; ++i)
         {
-            for (m.magic = 0; popcount((m.magic * m.mask) >> 56) < 6; )
-                m.magic = rng.SparseRand<Bitboard>();
-
-            // A good magic must map every possible occupancy to an index that
-            // looks up the correct sliding attack in the attacks[s] database.
-            // Note that we build up the database for square 's' as a side
-            // effect of verifying the magic. Keep track of the attempt count
-            // and save it in epoch[], little speed-up trick to avoid resetting
-            // m.attacks[] after every failed attempt.
-            for (++cnt, i = 0; i < size; ++i)
-            {
-                unsigned idx = m.index(occupancy[i]);
-
-                if (epoch[idx] < cnt)
-                {
-                    epoch[idx] = cnt;
-                    m.attacks[idx] = reference[i];
-                }
-                else if (m.attacks[idx] != reference[i])
-                    break;
-            }
+            unsigned idx = m.index(occupancy[i]);
+            assert(!m.attacks[idx] || m.attacks[idx] == reference[i]);
+            m.attacks[idx] = reference[i];
         }
     }
   }
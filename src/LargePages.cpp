@@ -0,0 +1,244 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "LargePages.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+std::array<std::atomic<size_t>, LargePages::NUM_BACKINGS> LargePages::m_bytes{};
+
+static float to_mib(size_t bytes) {
+    return bytes / (1024.0f * 1024.0f);
+}
+
+const char* LargePages::name(Backing b) {
+    switch (b) {
+        case HUGETLB:     return "hugetlbfs";
+        case TRANSPARENT: return "transparent";
+        case SMALL:       return "4 KiB pages";
+        default:          return "unknown";
+    }
+}
+
+void* LargePages::allocate(size_t bytes) {
+    bytes = (bytes + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+#ifdef __linux__
+    // Reserved huge pages, if the administrator set any aside.
+    auto ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+        m_bytes[HUGETLB] += bytes;
+        return ptr;
+    }
+
+    // Transparent huge pages need 2 MiB aligned memory, so map a page
+    // more than needed and trim both ends.
+    auto raw = mmap(nullptr, bytes + LARGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    auto start = reinterpret_cast<std::uintptr_t>(raw);
+    auto aligned = (start + LARGE_PAGE_SIZE - 1) & ~std::uintptr_t{LARGE_PAGE_SIZE - 1};
+    if (aligned > start) {
+        munmap(raw, aligned - start);
+    }
+    auto tail = start + bytes + LARGE_PAGE_SIZE - (aligned + bytes);
+    if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+    }
+    ptr = reinterpret_cast<void*>(aligned);
+    if (madvise(ptr, bytes, MADV_HUGEPAGE) == 0) {
+        m_bytes[TRANSPARENT] += bytes;
+    } else {
+        m_bytes[SMALL] += bytes;
+    }
+    return ptr;
+#else
+    m_bytes[SMALL] += bytes;
+    return ::operator new(bytes);
+#endif
+}
+
+void LargePages::advise(const void* ptr, size_t bytes) {
+#ifdef __linux__
+    auto start = reinterpret_cast<std::uintptr_t>(ptr);
+    auto first = (start + LARGE_PAGE_SIZE - 1) & ~std::uintptr_t{LARGE_PAGE_SIZE - 1};
+    auto last = (start + bytes) & ~std::uintptr_t{LARGE_PAGE_SIZE - 1};
+    if (last <= first) {
+        return;
+    }
+    if (madvise(reinterpret_cast<void*>(first), last - first,
+                MADV_HUGEPAGE) == 0) {
+        m_bytes[TRANSPARENT] += last - first;
+    }
+#else
+    (void)ptr;
+    (void)bytes;
+#endif
+}
+
+void LargePages::dump() {
+    for (auto b = 0; b < NUM_BACKINGS; b++) {
+        myprintf("Large pages: %-12s %9.1f MiB\n",
+                 name(Backing(b)), to_mib(m_bytes[b]));
+    }
+#ifdef __linux__
+    // Advised memory only gets huge pages if the kernel had them free,
+    // so also report what the process actually has.
+    auto smaps = std::fopen("/proc/self/smaps_rollup", "r");
+    if (smaps) {
+        char line[256];
+        while (std::fgets(line, sizeof(line), smaps)) {
+            size_t kib;
+            if (std::sscanf(line, "AnonHugePages: %zu kB", &kib) == 1) {
+                myprintf("Large pages: %-12s %9.1f MiB\n",
+                         "in use (THP)", to_mib(kib * 1024));
+            }
+        }
+        std::fclose(smaps);
+    }
+#endif
+}
+
+std::atomic<size_t> LargePages::Pool::s_pools{0};
+
+static void* next_free(void* ptr) {
+    void* next;
+    std::memcpy(&next, ptr, sizeof(next));
+    return next;
+}
+
+static void set_next_free(void* ptr, void* next) {
+    std::memcpy(ptr, &next, sizeof(next));
+}
+
+LargePages::Pool::Pool(size_t object_size) : m_id(s_pools++) {
+    // Keep the alignment operator new would give.
+    constexpr auto align = alignof(std::max_align_t);
+    m_object_size = (std::max(object_size, sizeof(void*)) + align - 1)
+                    & ~(align - 1);
+    assert(m_id < MAX_POOLS);
+    assert(m_object_size <= CHUNK_SIZE);
+}
+
+// Set once the thread's lists are gone. The main thread still frees
+// objects from static destructors after that.
+static thread_local bool thread_lists_gone = false;
+
+LargePages::Pool::ThreadLists::~ThreadLists() {
+    for (auto& list : lists) {
+        if (list.pool) {
+            list.pool->drain(list, list.count);
+        }
+    }
+    thread_lists_gone = true;
+}
+
+LargePages::Pool::FreeList& LargePages::Pool::thread_list() {
+    thread_local ThreadLists thread_lists;
+    auto& list = thread_lists.lists[m_id];
+    list.pool = this;
+    return list;
+}
+
+void LargePages::Pool::refill(FreeList& list, size_t count) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < count; i++) {
+        auto ptr = m_free;
+        if (ptr) {
+            m_free = next_free(ptr);
+        } else {
+            if (static_cast<size_t>(m_end - m_next) < m_object_size) {
+                m_next = static_cast<char*>(LargePages::allocate(CHUNK_SIZE));
+                m_end = m_next + CHUNK_SIZE;
+            }
+            ptr = m_next;
+            m_next += m_object_size;
+        }
+        set_next_free(ptr, list.head);
+        list.head = ptr;
+        list.count++;
+    }
+}
+
+void LargePages::Pool::drain(FreeList& list, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    // Unlink the first count objects, then splice them in whole.
+    auto head = list.head;
+    auto tail = head;
+    for (size_t i = 1; i < count; i++) {
+        tail = next_free(tail);
+    }
+    list.head = next_free(tail);
+    list.count -= count;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    set_next_free(tail, m_free);
+    m_free = head;
+}
+
+void* LargePages::Pool::allocate() {
+    if (thread_lists_gone) {
+        auto list = FreeList{};
+        refill(list, 1);
+        return list.head;
+    }
+    auto& list = thread_list();
+    if (!list.head) {
+        refill(list, BATCH);
+    }
+    auto ptr = list.head;
+    list.head = next_free(ptr);
+    list.count--;
+    return ptr;
+}
+
+void LargePages::Pool::free(void* ptr) {
+    if (thread_lists_gone) {
+        auto list = FreeList{this, ptr, 1};
+        set_next_free(ptr, nullptr);
+        drain(list, 1);
+        return;
+    }
+    auto& list = thread_list();
+    set_next_free(ptr, list.head);
+    list.head = ptr;
+    list.count++;
+    // Nodes are often freed by another thread than made them, so do not
+    // let one thread sit on them.
+    if (list.count >= 2 * BATCH) {
+        drain(list, BATCH);
+    }
+}
@@ -0,0 +1,103 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LARGEPAGES_H_INCLUDED
+#define LARGEPAGES_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+// Memory for the big long-lived allocations, the search tree, the NNCache
+// and the CPU weights, backed by 2 MiB pages where the OS allows it, so
+// walking them misses the TLB less. With --large-pages, regions are taken
+// from the reserved hugetlbfs pages first, then from anonymous memory
+// advised for transparent huge pages, and else from normal pages.
+// Without it, or on other platforms than Linux, everything uses normal
+// pages.
+class LargePages {
+public:
+    static constexpr size_t LARGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    enum Backing {
+        HUGETLB,
+        TRANSPARENT,
+        SMALL,
+        NUM_BACKINGS
+    };
+
+    // bytes is rounded up to whole pages. The memory is never returned,
+    // so this is for regions that live until exit. Throws std::bad_alloc.
+    static void* allocate(size_t bytes);
+    // Ask for transparent huge pages for memory that is already in use.
+    // Only the 2 MiB aligned part of it is eligible, and the kernel
+    // collapses the pages in the background.
+    static void advise(const void* ptr, size_t bytes);
+
+    // Print what was obtained of each kind.
+    static void dump();
+
+    // Fixed size objects carved out of large page regions. Each thread
+    // keeps its own free list, refilled from and returned to the shared
+    // one BATCH objects at a time, so the lock is taken rarely.
+    class Pool {
+    public:
+        explicit Pool(size_t object_size);
+        void* allocate();
+        void free(void* ptr);
+
+    private:
+        static constexpr size_t CHUNK_SIZE = 16 * LARGE_PAGE_SIZE;
+        static constexpr size_t MAX_POOLS = 4;
+        static constexpr size_t BATCH = 64;
+
+        // Singly linked through the freed objects.
+        struct FreeList {
+            Pool* pool{nullptr};
+            void* head{nullptr};
+            size_t count{0};
+        };
+        // A thread's lists go back to their pools when it exits.
+        struct ThreadLists {
+            ~ThreadLists();
+            std::array<FreeList, MAX_POOLS> lists;
+        };
+
+        FreeList& thread_list();
+        void refill(FreeList& list, size_t count);
+        void drain(FreeList& list, size_t count);
+
+        static std::atomic<size_t> s_pools;
+        size_t m_id;
+        size_t m_object_size;
+
+        std::mutex m_mutex;
+        char* m_next{nullptr};
+        char* m_end{nullptr};
+        void* m_free{nullptr};
+    };
+
+private:
+    static const char* name(Backing b);
+    static std::array<std::atomic<size_t>, NUM_BACKINGS> m_bytes;
+};
+
+#endif
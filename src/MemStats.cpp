@@ -0,0 +1,73 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <cstdio>
+
+#include "MemStats.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+std::array<std::atomic<size_t>, MemStats::NUM_SUBSYSTEMS> MemStats::m_bytes{};
+
+static float to_mib(size_t bytes) {
+    return bytes / (1024.0f * 1024.0f);
+}
+
+const char* MemStats::name(Subsystem s) {
+    switch (s) {
+        case TREE_NODES:     return "tree nodes";
+        case CHILD_VECTORS:  return "child vectors";
+        case NNCACHE:        return "NNCache";
+        case TRAINING:       return "training data";
+        case CPU_WEIGHTS:    return "CPU weights";
+        case OPENCL_BUFFERS: return "OpenCL buffers";
+        default:             return "unknown";
+    }
+}
+
+size_t MemStats::total() {
+    auto bytes = size_t{0};
+    for (auto s = 0; s < NUM_SUBSYSTEMS; s++) {
+        bytes += get(Subsystem(s));
+    }
+    return bytes;
+}
+
+void MemStats::dump() {
+    for (auto s = 0; s < NUM_SUBSYSTEMS; s++) {
+        myprintf_so("info string %-14s %9.1f MiB\n",
+                    name(Subsystem(s)), to_mib(get(Subsystem(s))));
+    }
+    myprintf_so("info string %-14s %9.1f MiB\n", "total", to_mib(total()));
+}
+
+std::string MemStats::summary() {
+    char buf[256];
+    std::snprintf(buf, sizeof(buf),
+        "memory %.1f MiB (tree %.1f, cache %.1f, weights %.1f, opencl %.1f, training %.1f)",
+        to_mib(total()),
+        to_mib(get(TREE_NODES) + get(CHILD_VECTORS)),
+        to_mib(get(NNCACHE)),
+        to_mib(get(CPU_WEIGHTS)),
+        to_mib(get(OPENCL_BUFFERS)),
+        to_mib(get(TRAINING)));
+    return buf;
+}
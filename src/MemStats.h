@@ -0,0 +1,68 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMSTATS_H_INCLUDED
+#define MEMSTATS_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+// Bytes in use per subsystem. The owners update the counters where they
+// allocate and free, so the numbers can be read at any time. Container
+// overhead is estimated, so expect the totals to be a few % off.
+class MemStats {
+public:
+    enum Subsystem {
+        TREE_NODES,
+        CHILD_VECTORS,
+        NNCACHE,
+        TRAINING,
+        CPU_WEIGHTS,
+        OPENCL_BUFFERS,
+        NUM_SUBSYSTEMS
+    };
+
+    static void add(Subsystem s, size_t bytes) {
+        m_bytes[s].fetch_add(bytes, std::memory_order_relaxed);
+    }
+    static void sub(Subsystem s, size_t bytes) {
+        m_bytes[s].fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    static void set(Subsystem s, size_t bytes) {
+        m_bytes[s].store(bytes, std::memory_order_relaxed);
+    }
+    static size_t get(Subsystem s) {
+        return m_bytes[s].load(std::memory_order_relaxed);
+    }
+    static size_t total();
+
+    // Table of all subsystems, for the memstats command.
+    static void dump();
+    // One line summary for the search output.
+    static std::string summary();
+
+private:
+    static const char* name(Subsystem s);
+    static std::array<std::atomic<size_t>, NUM_SUBSYSTEMS> m_bytes;
+};
+
+#endif
@@ -17,23 +17,151 @@
 */
 
 #include "config.h"
+#include <algorithm>
+#include <cassert>
 #include <functional>
+#include <memory>
 
 #include "NNCache.h"
+#include "LargePages.h"
+#include "MemStats.h"
+#include "Parameters.h"
 #include "Utils.h"
 
 NNCache::NNCache(int size) : m_size(size) {}
 
+// Never destroyed, the cache itself is only destroyed at exit.
+static LargePages::Pool& entry_pool(size_t size) {
+    static auto pool = new LargePages::Pool(size);
+    return *pool;
+}
+
+void* NNCache::Entry::operator new(std::size_t size) {
+    if (!cfg_large_pages) {
+        return ::operator new(size);
+    }
+    assert(size == sizeof(Entry));
+    return entry_pool(size).allocate();
+}
+
+void NNCache::Entry::operator delete(void* ptr) {
+    if (!cfg_large_pages) {
+        ::operator delete(ptr);
+        return;
+    }
+    if (ptr) {
+        entry_pool(sizeof(Entry)).free(ptr);
+    }
+}
+
 NNCache& NNCache::get_NNCache(void) {
     static NNCache cache;
     return cache;
 }
 
-bool NNCache::lookup(Key hash, Network::Netresult & result) {
+NNCache::L1Cache& NNCache::get_L1Cache() {
+    // Allocated on first use, so threads that never probe pay nothing.
+    thread_local auto l1 = []() {
+        MemStats::add(MemStats::NNCACHE, sizeof(L1Cache));
+        return std::make_unique<L1Cache>();
+    }();
+    return *l1;
+}
+
+void NNCache::l1_store(std::uint64_t hash, const Network::Netresult& result) {
+    auto& entry = get_L1Cache().entries[hash % L1_SIZE];
+    const auto old_capacity = entry.result.first.capacity();
+    entry.hash = hash;
+    entry.valid = true;
+    entry.result = result;
+    const auto new_capacity = entry.result.first.capacity();
+    if (new_capacity != old_capacity) {
+        MemStats::add(MemStats::NNCACHE,
+                      new_capacity * sizeof(Network::scored_node));
+        MemStats::sub(MemStats::NNCACHE,
+                      old_capacity * sizeof(Network::scored_node));
+    }
+}
+
+size_t NNCache::entry_size(const Entry& entry) {
+    // Map node: next pointer, key, value and cached hash, plus a bucket.
+    constexpr auto map_overhead = 4 * sizeof(void*) + sizeof(std::uint64_t);
+    return sizeof(Entry)
+        + entry.result.first.capacity() * sizeof(Network::scored_node)
+        + map_overhead + sizeof(size_t);
+}
+
+void NNCache::evict() {
+    // Ends within one turn of the clock, every pass clears a reference.
+    while (!m_order.empty()) {
+        const auto hash = m_order.front();
+        m_order.pop_front();
+        auto iter = m_cache.find(hash);
+        if (iter == m_cache.end()) {
+            continue;
+        }
+        if (iter->second->referenced) {
+            iter->second->referenced = false;
+            m_order.push_back(hash);
+            continue;
+        }
+        const auto bytes = entry_size(*iter->second);
+        m_bytes -= bytes;
+        MemStats::sub(MemStats::NNCACHE, bytes);
+        m_cache.erase(iter);
+        return;
+    }
+}
+
+void NNCache::l1_publish_stats(L1Cache& l1) {
+    m_l1_hits += l1.hits;
+    m_l1_lookups += l1.lookups;
+    l1.hits = 0;
+    l1.lookups = 0;
+    for (auto d = 0; d < DEPTH_BUCKETS; d++) {
+        m_depth_hits[d] += l1.depth_hits[d];
+        m_depth_lookups[d] += l1.depth_lookups[d];
+        l1.depth_hits[d] = 0;
+        l1.depth_lookups[d] = 0;
+    }
+}
+
+void NNCache::l1_mark_referenced(L1Cache& l1) {
+    for (size_t i = 0; i < l1.num_referenced; i++) {
+        auto iter = m_cache.find(l1.referenced[i]);
+        if (iter != m_cache.end()) {
+            iter->second->referenced = true;
+        }
+    }
+    l1.num_referenced = 0;
+}
+
+bool NNCache::lookup(Key hash, Network::Netresult & result, int ply) {
+    auto& l1 = get_L1Cache();
+    const auto depth = std::min(std::max(ply - m_root_ply.load(), 0),
+                                DEPTH_BUCKETS - 1);
+    ++l1.depth_lookups[depth];
+    if (++l1.lookups == L1_STATS_INTERVAL) {
+        l1_publish_stats(l1);
+    }
+    const auto& l1_entry = l1.entries[hash % L1_SIZE];
+    if (l1_entry.valid && l1_entry.hash == hash) {
+        ++l1.hits;
+        ++l1.depth_hits[depth];
+        result = l1_entry.result;
+        l1.referenced[l1.num_referenced++] = hash;
+        if (l1.num_referenced == L1_REFERENCE_BATCH) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            l1_mark_referenced(l1);
+        }
+        return true;
+    }
+
     std::lock_guard<std::mutex> lock(m_mutex);
+    l1_mark_referenced(l1);
 #ifndef NDEBUG
     if (m_lookups % 10000 == 0) {
-        dump_stats();
+        print_stats();
     }
 #endif
     ++m_lookups;
@@ -43,51 +171,90 @@ bool NNCache::lookup(Key hash, Network::Netresult & result) {
         return false;  // Not found.
     }
 
-    const auto& entry = iter->second;
+    auto& entry = iter->second;
 
     // Found it.
     ++m_hits;
+    ++l1.depth_hits[depth];
+    entry->referenced = true;
     result = entry->result;
+    l1_store(hash, result);
     return true;
 }
 
 void NNCache::insert(Key hash,
                      const Network::Netresult& result) {
+    l1_store(hash, result);
+
     std::lock_guard<std::mutex> lock(m_mutex);
+    l1_mark_referenced(get_L1Cache());
 
     if (m_cache.find(hash) != m_cache.end()) {
         return;  // Already in the cache.
     }
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
+    auto entry = std::make_unique<Entry>(result);
+    const auto bytes = entry_size(*entry);
+    m_bytes += bytes;
+    MemStats::add(MemStats::NNCACHE, bytes);
+    m_cache.emplace(hash, std::move(entry));
     m_order.push_back(hash);
     ++m_inserts;
 
-    // If the cache is too large, remove the oldest entry.
+    // If the cache is too large, make room.
     if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+        evict();
     }
 }
 
 void NNCache::resize(int size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    l1_mark_referenced(get_L1Cache());
     m_size = size;
     while (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+        evict();
+    }
+}
+
+void NNCache::set_max_memory(size_t bytes) {
+    auto average_entry = size_t{ENTRY_SIZE_ESTIMATE};
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Prefer the measured size once there is a decent sample.
+        if (m_cache.size() >= 1000) {
+            average_entry = m_bytes / m_cache.size();
+        }
     }
+    resize(static_cast<int>(std::max(size_t{1000}, bytes / average_entry)));
 }
 
 void NNCache::set_size_from_playouts(int max_playouts) {
     // cache hits are generally from last several moves so setting cache
     // size based on playouts increases the hit rate while balancing memory
-    // usage for low playout instances. 50'000 cache entries is ~250 MB
+    // usage for low playout instances. 50'000 cache entries is ~17 MB
     auto max_size = std::min(50'000, std::max(6'000, 3 * max_playouts));
     NNCache::get_NNCache().resize(max_size);
 }
 
 void NNCache::dump_stats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    print_stats();
+}
+
+void NNCache::print_stats() const {
     Utils::myprintf("NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %u size\n",
         m_hits, m_lookups, 100. * m_hits / (m_lookups + 1),
         m_inserts, m_cache.size());
+    Utils::myprintf("NNCache L1: %d/%d hits/lookups = %.1f%% hitrate\n",
+        m_l1_hits.load(), m_l1_lookups.load(),
+        100. * m_l1_hits / (m_l1_lookups + 1));
+    for (auto d = 0; d < DEPTH_BUCKETS; d++) {
+        if (m_depth_lookups[d] == 0) {
+            continue;
+        }
+        Utils::myprintf("NNCache depth %2d%s: %d/%d hits/lookups = %.1f%% hitrate\n",
+            d, d == DEPTH_BUCKETS - 1 ? "+" : " ",
+            m_depth_hits[d].load(), m_depth_lookups[d].load(),
+            100. * m_depth_hits[d] / m_depth_lookups[d]);
+    }
 }
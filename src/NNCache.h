@@ -21,6 +21,8 @@
 
 #include "config.h"
 
+#include <array>
+#include <atomic>
 #include <deque>
 #include <mutex>
 #include <unordered_map>
@@ -38,8 +40,13 @@ public:
     // Resize NNCache
     void resize(int size);
 
-    // Try and find an existing entry.
-    bool lookup(std::uint64_t hash, Network::Netresult & result);
+    // Resize NNCache to use about this many bytes
+    void set_max_memory(size_t bytes);
+
+    // Try and find an existing entry. The calling thread's L1 is probed
+    // first, then the shared cache. ply is the game ply of the position,
+    // for the hit rates by depth below the search root.
+    bool lookup(std::uint64_t hash, Network::Netresult & result, int ply);
 
     // Insert a new entry.
     void insert(std::uint64_t hash,
@@ -50,10 +57,32 @@ public:
         return {m_hits, m_lookups};
     }
 
+    // Return the hit rate ratio of the per-thread caches. Threads publish
+    // their counts every L1_STATS_INTERVAL lookups.
+    std::pair<int, int> l1_hit_rate() const {
+        return {m_l1_hits, m_l1_lookups};
+    }
+
+    // The game ply of the position being searched. Lookups are counted by
+    // their depth below it.
+    void set_root_ply(int ply) {
+        m_root_ply = ply;
+    }
+
+    // Lookups at this depth or deeper are counted together.
+    static constexpr int DEPTH_BUCKETS = 16;
+
+    // Return the hits and lookups at a depth below the search root,
+    // counting both the L1 and the shared cache. Published with the L1
+    // counts.
+    std::pair<int, int> depth_hit_rate(int depth) const {
+        return {m_depth_hits[depth], m_depth_lookups[depth]};
+    }
+
     void dump_stats();
 
 private:
-    NNCache(int size = 50000);  // ~ 250MB for LZGo - TODO for LZChess
+    NNCache(int size = 50000);  // ~ 17MB for LZChess
 
     std::mutex m_mutex;
 
@@ -63,16 +92,71 @@ private:
     int m_hits{0};
     int m_lookups{0};
     int m_inserts{0};
+    size_t m_bytes{0};
+    std::atomic<int> m_l1_hits{0};
+    std::atomic<int> m_l1_lookups{0};
+    std::atomic<int> m_root_ply{0};
+    std::array<std::atomic<int>, DEPTH_BUCKETS> m_depth_hits{};
+    std::array<std::atomic<int>, DEPTH_BUCKETS> m_depth_lookups{};
+
+    // Per-thread direct-mapped cache in front of the shared one. The
+    // search keeps probing the same part of the tree from the same thread,
+    // so most repeated lookups never have to take m_mutex.
+    static constexpr size_t L1_SIZE = 512;
+    static constexpr int L1_STATS_INTERVAL = 1000;
+    static constexpr size_t L1_REFERENCE_BATCH = 64;
+
+    struct L1Entry {
+        std::uint64_t hash{0};
+        bool valid{false};
+        Network::Netresult result;
+    };
+
+    struct L1Cache {
+        std::array<L1Entry, L1_SIZE> entries;
+        int hits{0};
+        int lookups{0};
+        std::array<int, DEPTH_BUCKETS> depth_hits{};
+        std::array<int, DEPTH_BUCKETS> depth_lookups{};
+        // Hashes hit here since the last time this thread held m_mutex.
+        // They are marked referenced in the shared cache then, so its
+        // clock does not evict the entries the search uses most.
+        std::array<std::uint64_t, L1_REFERENCE_BATCH> referenced;
+        size_t num_referenced{0};
+    };
+
+    static L1Cache& get_L1Cache();
+    static void l1_store(std::uint64_t hash, const Network::Netresult& result);
+    void l1_publish_stats(L1Cache& l1);
+    // Needs m_mutex.
+    void l1_mark_referenced(L1Cache& l1);
 
     struct Entry {
         Entry( const Network::Netresult& r)
             : result(r) {}
-        Network::Netresult result;  // ~ 3KB for LZGo - TODO for LZChess
+        // With --large-pages, entries come from a pool of large pages.
+        static void* operator new(std::size_t size);
+        static void operator delete(void* ptr);
+        Network::Netresult result;  // ~ 300 bytes for LZChess
+        // Hit since the clock hand last passed it.
+        bool referenced{false};
     };
 
+    // Typical entry_size() with 30 legal moves.
+    static constexpr size_t ENTRY_SIZE_ESTIMATE = 350;
+
+    // Bytes used by an entry, including its map node and m_order slot.
+    static size_t entry_size(const Entry& entry);
+    // CLOCK replacement: the hand passes over the entries in the order
+    // they were added. An entry hit since the last pass gets a second
+    // chance, the first one that was not is evicted. Entries the search
+    // keeps coming back to, like those near the root, stay in the cache.
+    void evict();
+    void print_stats() const;
+
     // Map from hash to {features, result}
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
-    // Order entries were added to the map.
+    std::unordered_map<std::uint64_t, std::unique_ptr<Entry>> m_cache;
+    // The clock, the front is under the hand.
     std::deque<size_t> m_order;
 };
 
@@ -31,7 +31,13 @@
 #include <memory>
 #include <cmath>
 #include <array>
+#include <chrono>
 #include <thread>
+#ifdef USE_OPENCL_SELFCHECK
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#endif
 #include <boost/utility.hpp>
 #include <boost/format.hpp>
 #include "zlib.h"
@@ -52,6 +58,9 @@
 
 #include "Random.h"
 #include "Network.h"
+#include "AdaptiveThreads.h"
+#include "LargePages.h"
+#include "MemStats.h"
 #include "NNCache.h"
 #include "Utils.h"
 #include "Parameters.h"
@@ -71,38 +80,48 @@ size_t Network::m_format_version{0};
 std::unordered_map<Move, int, std::hash<int>> Network::old_move_lookup;
 std::unordered_map<Move, int, std::hash<int>> Network::new_move_lookup;
 
-// Input + residual block tower
-static std::vector<std::vector<float>> conv_weights;
-static std::vector<std::vector<float>> conv_biases;
-static std::vector<std::vector<float>> batchnorm_means;
-static std::vector<std::vector<float>> batchnorm_stddivs;
-
-// Policy head
-static std::vector<float> conv_pol_w;
-static std::vector<float> conv_pol_b;
-static std::array<float, Network::NUM_POLICY_INPUT_PLANES> bn_pol_w1;
-static std::array<float, Network::NUM_POLICY_INPUT_PLANES> bn_pol_w2;
-
-// TODO: These are compile time sized,
-// It would be nicer to dynamically size.
-// Just a little memory optimization.
-// But maybe there is a reason they must be array not vector?
-static std::array<float, Network::V1_NUM_OUTPUT_POLICY*8*8*Network::NUM_POLICY_INPUT_PLANES> v1_ip_pol_w;
-static std::array<float, Network::V1_NUM_OUTPUT_POLICY> v1_ip_pol_b;
-static std::array<float, Network::V2_NUM_OUTPUT_POLICY*8*8*Network::NUM_POLICY_INPUT_PLANES> v2_ip_pol_w;
-static std::array<float, Network::V2_NUM_OUTPUT_POLICY> v2_ip_pol_b;
-
-// Value head
-static std::vector<float> conv_val_w;
-static std::vector<float> conv_val_b;
-static std::array<float, Network::NUM_VALUE_INPUT_PLANES> bn_val_w1;
-static std::array<float, Network::NUM_VALUE_INPUT_PLANES> bn_val_w2;
-
-static std::array<float, Network::NUM_VALUE_CHANNELS*8*8*Network::NUM_VALUE_INPUT_PLANES> ip1_val_w;
-static std::array<float, Network::NUM_VALUE_CHANNELS> ip1_val_b;
-
-static std::array<float, Network::NUM_VALUE_CHANNELS> ip2_val_w;
-static std::array<float, 1> ip2_val_b;
+// The weights of a network, as the CPU evaluates them. The main network
+// is also uploaded to OpenCL, the small network only runs on the CPU.
+struct Network::Weights {
+    size_t format_version{0};
+
+    // Input + residual block tower
+    std::vector<std::vector<float>> conv_weights;
+    std::vector<std::vector<float>> conv_biases;
+    std::vector<std::vector<float>> batchnorm_means;
+    std::vector<std::vector<float>> batchnorm_stddivs;
+
+    // Policy head
+    std::vector<float> conv_pol_w;
+    std::vector<float> conv_pol_b;
+    std::array<float, Network::NUM_POLICY_INPUT_PLANES> bn_pol_w1;
+    std::array<float, Network::NUM_POLICY_INPUT_PLANES> bn_pol_w2;
+
+    // TODO: These are compile time sized,
+    // It would be nicer to dynamically size.
+    // Just a little memory optimization.
+    // But maybe there is a reason they must be array not vector?
+    std::array<float, Network::V1_NUM_OUTPUT_POLICY*8*8*Network::NUM_POLICY_INPUT_PLANES> v1_ip_pol_w;
+    std::array<float, Network::V1_NUM_OUTPUT_POLICY> v1_ip_pol_b;
+    std::array<float, Network::V2_NUM_OUTPUT_POLICY*8*8*Network::NUM_POLICY_INPUT_PLANES> v2_ip_pol_w;
+    std::array<float, Network::V2_NUM_OUTPUT_POLICY> v2_ip_pol_b;
+
+    // Value head
+    std::vector<float> conv_val_w;
+    std::vector<float> conv_val_b;
+    std::array<float, Network::NUM_VALUE_INPUT_PLANES> bn_val_w1;
+    std::array<float, Network::NUM_VALUE_INPUT_PLANES> bn_val_w2;
+
+    std::array<float, Network::NUM_VALUE_CHANNELS*8*8*Network::NUM_VALUE_INPUT_PLANES> ip1_val_w;
+    std::array<float, Network::NUM_VALUE_CHANNELS> ip1_val_b;
+
+    std::array<float, Network::NUM_VALUE_CHANNELS> ip2_val_w;
+    std::array<float, 1> ip2_val_b;
+};
+
+static Network::Weights main_weights;
+// Only loaded with --small-weights.
+static Network::Weights small_weights;
 
 size_t Network::get_format_version() {
     return m_format_version;
@@ -198,20 +217,60 @@ std::vector<float> Network::zeropad_U(const std::vector<float>& U,
 
 extern "C" void openblas_set_num_threads(int num_threads);
 
-std::pair<int, int> Network::load_network(std::istream& wtfile) {
+static size_t weight_bytes(const std::vector<float>& weights) {
+    return weights.capacity() * sizeof(float);
+}
+
+static size_t weight_bytes(const std::vector<std::vector<float>>& weights) {
+    auto bytes = weights.capacity() * sizeof(std::vector<float>);
+    for (const auto& w : weights) {
+        bytes += weight_bytes(w);
+    }
+    return bytes;
+}
+
+// The Winograd transformed filters are most of the tower weights. They are
+// already filled in, so their pages are collapsed in the background.
+static void advise_large_pages(const Network::Weights& w) {
+    for (const auto& conv : w.conv_weights) {
+        LargePages::advise(conv.data(), weight_bytes(conv));
+    }
+}
+
+// Only the head for the loaded format version is in use, the arrays for
+// the other one are never touched.
+static size_t cpu_weight_bytes(const Network::Weights& w) {
+    auto bytes = weight_bytes(w.conv_weights) + weight_bytes(w.conv_biases)
+        + weight_bytes(w.batchnorm_means) + weight_bytes(w.batchnorm_stddivs)
+        + weight_bytes(w.conv_pol_w) + weight_bytes(w.conv_pol_b)
+        + weight_bytes(w.conv_val_w) + weight_bytes(w.conv_val_b)
+        + sizeof(w.bn_pol_w1) + sizeof(w.bn_pol_w2)
+        + sizeof(w.bn_val_w1) + sizeof(w.bn_val_w2)
+        + sizeof(w.ip1_val_w) + sizeof(w.ip1_val_b)
+        + sizeof(w.ip2_val_w) + sizeof(w.ip2_val_b);
+    if (w.format_version == 1) {
+        bytes += sizeof(w.v1_ip_pol_w) + sizeof(w.v1_ip_pol_b);
+    } else {
+        bytes += sizeof(w.v2_ip_pol_w) + sizeof(w.v2_ip_pol_b);
+    }
+    return bytes;
+}
+
+std::pair<int, int> Network::load_network(std::istream& wtfile,
+                                          Weights& w) {
     // Read format version
     auto line = std::string{};
     if (std::getline(wtfile, line)) {
         auto iss = std::stringstream{ line };
         // First line is the file format version id
-        iss >> m_format_version;
+        iss >> w.format_version;
         if (iss.fail()
-            || m_format_version > MAX_FORMAT_VERSION
-            || m_format_version < 1) {
+            || w.format_version > MAX_FORMAT_VERSION
+            || w.format_version < 1) {
             myprintf("Weights file is the wrong version.\n");
             return {0, 0};
         } else {
-            assert(m_format_version <= MAX_FORMAT_VERSION);
+            assert(w.format_version <= MAX_FORMAT_VERSION);
         }
     } else {
         myprintf("Weights file is empty.\n");
@@ -219,7 +278,7 @@ std::pair<int, int> Network::load_network(std::istream& wtfile) {
     }
     // Count size of the network
     myprintf("Detecting residual layers...");
-    myprintf("v%d...", m_format_version);
+    myprintf("v%d...", w.format_version);
     // First line was the version number
     auto linecount = size_t{1};
     auto channels = 0;
@@ -244,7 +303,7 @@ std::pair<int, int> Network::load_network(std::istream& wtfile) {
     auto residual_blocks = linecount - (1 + 4 + 14);
     if (residual_blocks % 8 != 0) {
         myprintf("\nInconsistent number of weights in the file.\n");
-        myprintf("%d %d %d %d\n", m_format_version, residual_blocks, linecount, get_hist_planes());
+        myprintf("%d %d %d %d\n", w.format_version, residual_blocks, linecount, get_hist_planes());
         return {0, 0};
     }
     residual_blocks /= 8;
@@ -280,55 +339,55 @@ std::pair<int, int> Network::load_network(std::istream& wtfile) {
         }
         if (linecount < plain_conv_wts) {
             if (linecount % 4 == 0) {
-                conv_weights.emplace_back(weights);
+                w.conv_weights.emplace_back(weights);
             } else if (linecount % 4 == 1) {
                 // Redundant in our model, but they encode the
                 // number of outputs so we have to read them in.
-                conv_biases.emplace_back(weights);
+                w.conv_biases.emplace_back(weights);
             } else if (linecount % 4 == 2) {
-                batchnorm_means.emplace_back(weights);
+                w.batchnorm_means.emplace_back(weights);
             } else if (linecount % 4 == 3) {
                 process_bn_var(weights);
-                batchnorm_stddivs.emplace_back(weights);
+                w.batchnorm_stddivs.emplace_back(weights);
             }
         } else if (linecount == plain_conv_wts) {
-            conv_pol_w = std::move(weights);
+            w.conv_pol_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 1) {
-            conv_pol_b = std::move(weights);
+            w.conv_pol_b = std::move(weights);
         } else if (linecount == plain_conv_wts + 2) {
-            std::copy(begin(weights), end(weights), begin(bn_pol_w1));
+            std::copy(begin(weights), end(weights), begin(w.bn_pol_w1));
         } else if (linecount == plain_conv_wts + 3) {
             process_bn_var(weights);
-            std::copy(begin(weights), end(weights), begin(bn_pol_w2));
+            std::copy(begin(weights), end(weights), begin(w.bn_pol_w2));
         } else if (linecount == plain_conv_wts + 4) {
-            if (m_format_version == 1) {
-                std::copy(begin(weights), end(weights), begin(v1_ip_pol_w));
+            if (w.format_version == 1) {
+                std::copy(begin(weights), end(weights), begin(w.v1_ip_pol_w));
             } else {
-                std::copy(begin(weights), end(weights), begin(v2_ip_pol_w));
+                std::copy(begin(weights), end(weights), begin(w.v2_ip_pol_w));
             }
         } else if (linecount == plain_conv_wts + 5) {
-            if (m_format_version == 1) {
-                std::copy(begin(weights), end(weights), begin(v1_ip_pol_b));
+            if (w.format_version == 1) {
+                std::copy(begin(weights), end(weights), begin(w.v1_ip_pol_b));
             } else {
-                std::copy(begin(weights), end(weights), begin(v2_ip_pol_b));
+                std::copy(begin(weights), end(weights), begin(w.v2_ip_pol_b));
             }
         } else if (linecount == plain_conv_wts + 6) {
-            conv_val_w = std::move(weights);
+            w.conv_val_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 7) {
-            conv_val_b = std::move(weights);
+            w.conv_val_b = std::move(weights);
         } else if (linecount == plain_conv_wts + 8) {
-            std::copy(begin(weights), end(weights), begin(bn_val_w1));
+            std::copy(begin(weights), end(weights), begin(w.bn_val_w1));
         } else if (linecount == plain_conv_wts + 9) {
             process_bn_var(weights);
-            std::copy(begin(weights), end(weights), begin(bn_val_w2));
+            std::copy(begin(weights), end(weights), begin(w.bn_val_w2));
         } else if (linecount == plain_conv_wts + 10) {
-            std::copy(begin(weights), end(weights), begin(ip1_val_w));
+            std::copy(begin(weights), end(weights), begin(w.ip1_val_w));
         } else if (linecount == plain_conv_wts + 11) {
-            std::copy(begin(weights), end(weights), begin(ip1_val_b));
+            std::copy(begin(weights), end(weights), begin(w.ip1_val_b));
         } else if (linecount == plain_conv_wts + 12) {
-            std::copy(begin(weights), end(weights), begin(ip2_val_w));
+            std::copy(begin(weights), end(weights), begin(w.ip2_val_w));
         } else if (linecount == plain_conv_wts + 13) {
-            std::copy(begin(weights), end(weights), begin(ip2_val_b));
+            std::copy(begin(weights), end(weights), begin(w.ip2_val_b));
         }
         linecount++;
     }
@@ -336,7 +395,8 @@ std::pair<int, int> Network::load_network(std::istream& wtfile) {
     return {channels, residual_blocks};
 }
 
-std::pair<int, int> Network::load_network_file(std::string filename) {
+std::pair<int, int> Network::load_network_file(std::string filename,
+                                               Weights& weights) {
     // gzopen supports both gz and non-gz files, will decompress or just read directly as needed.
     auto gzhandle = gzopen(filename.c_str(), "rb");
     if (gzhandle == nullptr) {
@@ -358,38 +418,26 @@ std::pair<int, int> Network::load_network_file(std::string filename) {
         assert(bytesRead <= chunkBufferSize);
         buffer.write(chunkBuffer.data(), bytesRead);
     }
-    auto result = load_network(buffer);
+    auto result = load_network(buffer, weights);
     gzclose(gzhandle);
     return result;
 }
 
-void Network::initialize(void) {
-    if (initialized) return;
-    initialized = true;
-
-    init_move_map();
-
-    // Load network from file
-    size_t channels, residual_blocks;
-    assert(m_format_version == 0);
-    std::tie(channels, residual_blocks) = load_network_file(cfg_weightsfile);
-    assert(m_format_version > 0);
-    if (channels == 0) {
-        exit(EXIT_FAILURE);
-    }
-
+// Transform the loaded weights into what forward_cpu (and OpenCL) use.
+void Network::prepare_weights(Weights& weights, size_t channels,
+                              size_t residual_blocks) {
     auto weight_index = size_t{0};
     // Input convolution
     // Winograd transform convolution weights
-    conv_weights[weight_index] =
-        winograd_transform_f(conv_weights[weight_index],
+    weights.conv_weights[weight_index] =
+        winograd_transform_f(weights.conv_weights[weight_index],
                              channels, get_input_channels());
     weight_index++;
 
     // Residual block convolutions
     for (auto i = size_t{0}; i < residual_blocks * 2; i++) {
-		conv_weights[weight_index] =
-            winograd_transform_f(conv_weights[weight_index],
+		weights.conv_weights[weight_index] =
+            winograd_transform_f(weights.conv_weights[weight_index],
                                  channels, channels);
         weight_index++;
     }
@@ -398,27 +446,85 @@ void Network::initialize(void) {
     // still have non-zero biases.
     // Move biases to batchnorm means to make the output match without having
     // to separately add the biases.
-    for (auto i = size_t{0}; i < conv_biases.size(); i++) {
-        for (auto j = size_t{0}; j < batchnorm_means[i].size(); j++) {
-            batchnorm_means[i][j] -= conv_biases[i][j];
-            conv_biases[i][j] = 0.0f;
+    for (auto i = size_t{0}; i < weights.conv_biases.size(); i++) {
+        for (auto j = size_t{0}; j < weights.batchnorm_means[i].size(); j++) {
+            weights.batchnorm_means[i][j] -= weights.conv_biases[i][j];
+            weights.conv_biases[i][j] = 0.0f;
         }
     }
 
-    if ((bn_val_w1.size() != conv_val_b.size()) ||
-        (bn_pol_w1.size() != conv_pol_b.size()) ) {
+    if ((weights.bn_val_w1.size() != weights.conv_val_b.size()) ||
+        (weights.bn_pol_w1.size() != weights.conv_pol_b.size()) ) {
             throw std::runtime_error("Weights are malformed. Incorrect number "
              "of policy/value output planes.");
     }
 
-    for (auto i = size_t{0}; i < bn_val_w1.size(); i++) {
-        bn_val_w1[i] -= conv_val_b[i];
-        conv_val_b[i] = 0.0f;
+    for (auto i = size_t{0}; i < weights.bn_val_w1.size(); i++) {
+        weights.bn_val_w1[i] -= weights.conv_val_b[i];
+        weights.conv_val_b[i] = 0.0f;
     }
 
-    for (auto i = size_t{0}; i < bn_pol_w1.size(); i++) {
-        bn_pol_w1[i] -= conv_pol_b[i];
-        conv_pol_b[i] = 0.0f;
+    for (auto i = size_t{0}; i < weights.bn_pol_w1.size(); i++) {
+        weights.bn_pol_w1[i] -= weights.conv_pol_b[i];
+        weights.conv_pol_b[i] = 0.0f;
+    }
+}
+
+void Network::initialize(void) {
+    if (initialized) return;
+    initialized = true;
+
+    init_move_map();
+
+    // The head arrays are in the Weights structs. Advised before loading,
+    // they get large pages as they are first written.
+    if (cfg_large_pages) {
+        LargePages::advise(&main_weights, sizeof(main_weights));
+        if (!cfg_small_weightsfile.empty()) {
+            LargePages::advise(&small_weights, sizeof(small_weights));
+        }
+    }
+
+    // Load network from file
+    size_t channels, residual_blocks;
+    assert(m_format_version == 0);
+    std::tie(channels, residual_blocks) = load_network_file(cfg_weightsfile,
+                                                            main_weights);
+    if (channels == 0) {
+        exit(EXIT_FAILURE);
+    }
+    m_format_version = main_weights.format_version;
+    assert(m_format_version > 0);
+    prepare_weights(main_weights, channels, residual_blocks);
+    if (cfg_large_pages) {
+        advise_large_pages(main_weights);
+    }
+    auto cpu_bytes = cpu_weight_bytes(main_weights);
+
+    if (!cfg_small_weightsfile.empty()) {
+        myprintf("Loading small network.\n");
+        size_t small_channels, small_residual_blocks;
+        std::tie(small_channels, small_residual_blocks) =
+            load_network_file(cfg_small_weightsfile, small_weights);
+        if (small_channels == 0) {
+            exit(EXIT_FAILURE);
+        }
+        // The input planes and the policy mapping depend on the version.
+        if (small_weights.format_version != m_format_version) {
+            myprintf("The small network must have the same format version "
+                     "as the main network.\n");
+            exit(EXIT_FAILURE);
+        }
+        prepare_weights(small_weights, small_channels, small_residual_blocks);
+        if (cfg_large_pages) {
+            advise_large_pages(small_weights);
+        }
+        cpu_bytes += cpu_weight_bytes(small_weights);
+    }
+
+    MemStats::set(MemStats::CPU_WEIGHTS, cpu_bytes);
+    if (cfg_large_pages) {
+        LargePages::dump();
     }
 
 #ifdef USE_OPENCL
@@ -432,70 +538,70 @@ void Network::initialize(void) {
         auto kwg = tuners[2];
         auto vwm = tuners[3];
 
-        weight_index = 0;
+        auto weight_index = size_t{0};
 
         size_t m_ceil = ceilMultiple(ceilMultiple(channels, mwg), vwm);
         size_t k_ceil = ceilMultiple(ceilMultiple(get_input_channels(), kwg), vwm);
 
-        auto Upad = zeropad_U(conv_weights[weight_index],
+        auto Upad = zeropad_U(main_weights.conv_weights[weight_index],
                               channels, get_input_channels(),
                               m_ceil, k_ceil);
 
         // Winograd filter transformation changes filter size to 4x4
         opencl_net->push_input_convolution(WINOGRAD_ALPHA, get_input_channels(), channels,
-                Upad, batchnorm_means[weight_index], batchnorm_stddivs[weight_index]);
+                Upad, main_weights.batchnorm_means[weight_index], main_weights.batchnorm_stddivs[weight_index]);
         weight_index++;
 
         // residual blocks
         for (auto i = size_t{0}; i < residual_blocks; i++) {
-            auto Upad1 = zeropad_U(conv_weights[weight_index],
+            auto Upad1 = zeropad_U(main_weights.conv_weights[weight_index],
                                    channels, channels,
                                    m_ceil, m_ceil);
-            auto Upad2 = zeropad_U(conv_weights[weight_index + 1],
+            auto Upad2 = zeropad_U(main_weights.conv_weights[weight_index + 1],
                                    channels, channels,
                                    m_ceil, m_ceil);
             opencl_net->push_residual(WINOGRAD_ALPHA, channels, channels,
                                       Upad1,
-                                      batchnorm_means[weight_index],
-                                      batchnorm_stddivs[weight_index],
+                                      main_weights.batchnorm_means[weight_index],
+                                      main_weights.batchnorm_stddivs[weight_index],
                                       Upad2,
-                                      batchnorm_means[weight_index + 1],
-                                      batchnorm_stddivs[weight_index + 1]);
+                                      main_weights.batchnorm_means[weight_index + 1],
+                                      main_weights.batchnorm_stddivs[weight_index + 1]);
             weight_index += 2;
         }
 
         // Output head convolutions
-        std::vector<float> bn_pol_means(bn_pol_w1.begin(), bn_pol_w1.end());
-        std::vector<float> bn_pol_stddivs(bn_pol_w2.begin(), bn_pol_w2.end());
+        std::vector<float> bn_pol_means(main_weights.bn_pol_w1.begin(), main_weights.bn_pol_w1.end());
+        std::vector<float> bn_pol_stddivs(main_weights.bn_pol_w2.begin(), main_weights.bn_pol_w2.end());
 
-        std::vector<float> bn_val_means(bn_val_w1.begin(), bn_val_w1.end());
-        std::vector<float> bn_val_stddivs(bn_val_w2.begin(), bn_val_w2.end());
+        std::vector<float> bn_val_means(main_weights.bn_val_w1.begin(), main_weights.bn_val_w1.end());
+        std::vector<float> bn_val_stddivs(main_weights.bn_val_w2.begin(), main_weights.bn_val_w2.end());
 
         std::vector<float> ip_pol_w_vec;
         std::vector<float> ip_pol_b_vec;
         if (m_format_version == 1) {
-            ip_pol_w_vec = std::vector<float>(v1_ip_pol_w.begin(), v1_ip_pol_w.end());
-            ip_pol_b_vec = std::vector<float>(v1_ip_pol_b.begin(), v1_ip_pol_b.end());
+            ip_pol_w_vec = std::vector<float>(main_weights.v1_ip_pol_w.begin(), main_weights.v1_ip_pol_w.end());
+            ip_pol_b_vec = std::vector<float>(main_weights.v1_ip_pol_b.begin(), main_weights.v1_ip_pol_b.end());
         } else {
-            ip_pol_w_vec = std::vector<float>(v2_ip_pol_w.begin(), v2_ip_pol_w.end());
-            ip_pol_b_vec = std::vector<float>(v2_ip_pol_b.begin(), v2_ip_pol_b.end());
+            ip_pol_w_vec = std::vector<float>(main_weights.v2_ip_pol_w.begin(), main_weights.v2_ip_pol_w.end());
+            ip_pol_b_vec = std::vector<float>(main_weights.v2_ip_pol_b.begin(), main_weights.v2_ip_pol_b.end());
         }
 
-        std::vector<float> ip_val_w_vec(ip1_val_w.begin(), ip1_val_w.end());
-        std::vector<float> ip_val_b_vec(ip1_val_b.begin(), ip1_val_b.end());
+        std::vector<float> ip_val_w_vec(main_weights.ip1_val_w.begin(), main_weights.ip1_val_w.end());
+        std::vector<float> ip_val_b_vec(main_weights.ip1_val_b.begin(), main_weights.ip1_val_b.end());
 
         constexpr unsigned int width = 8;
         constexpr unsigned int height = 8;
 
         opencl_net->push_policy(channels, NUM_POLICY_INPUT_PLANES,
                 NUM_POLICY_INPUT_PLANES*width*height, get_num_output_policy(),
-                conv_pol_w,
+                main_weights.conv_pol_w,
                 bn_pol_means, bn_pol_stddivs,
                 ip_pol_w_vec, ip_pol_b_vec);
 
         opencl_net->push_value(channels, NUM_VALUE_INPUT_PLANES,
                 NUM_VALUE_INPUT_PLANES*width*height, NUM_VALUE_CHANNELS,
-                conv_val_w,
+                main_weights.conv_val_w,
                 bn_val_means, bn_val_stddivs,
                 ip_val_w_vec, ip_val_b_vec);
     }
@@ -876,7 +982,8 @@ void batchnorm(size_t channels,
     }
 }
 
-void Network::forward_cpu(std::vector<float>& input,
+void Network::forward_cpu(const Weights& weights,
+                          std::vector<float>& input,
                           std::vector<float>& output_pol,
                           std::vector<float>& output_val) {
     // Input convolution
@@ -884,7 +991,7 @@ void Network::forward_cpu(std::vector<float>& input,
     constexpr int height = 8;
     constexpr int tiles = width * height / 4;
     // Calculate output channels
-    const auto output_channels = conv_biases[0].size();
+    const auto output_channels = weights.conv_biases[0].size();
     //input_channels is the maximum number of input channels of any convolution.
     //Residual blocks are identical, but the first convolution might be bigger
     //when the network has very few filters
@@ -899,45 +1006,45 @@ void Network::forward_cpu(std::vector<float>& input,
     std::vector<float> policy_data(Network::NUM_POLICY_INPUT_PLANES * width * height);
     std::vector<float> value_data(Network::NUM_VALUE_INPUT_PLANES * width * height);
 
-    winograd_convolve3(output_channels, input, conv_weights[0], V, M, conv_out);
+    winograd_convolve3(output_channels, input, weights.conv_weights[0], V, M, conv_out);
     batchnorm<64>(output_channels, conv_out,
-                  batchnorm_means[0].data(),
-                  batchnorm_stddivs[0].data());
+                  weights.batchnorm_means[0].data(),
+                  weights.batchnorm_stddivs[0].data());
 
     // Residual tower
     auto conv_in = std::vector<float>(output_channels * width * height);
     auto res = std::vector<float>(output_channels * width * height);
-    for (auto i = size_t{1}; i < conv_weights.size(); i += 2) {
-        auto output_channels = conv_biases[i].size();
+    for (auto i = size_t{1}; i < weights.conv_weights.size(); i += 2) {
+        auto output_channels = weights.conv_biases[i].size();
         std::swap(conv_out, conv_in);
         std::copy(begin(conv_in), end(conv_in), begin(res));
         winograd_convolve3(output_channels, conv_in,
-                           conv_weights[i], V, M, conv_out);
+                           weights.conv_weights[i], V, M, conv_out);
         batchnorm<64>(output_channels, conv_out,
-                      batchnorm_means[i].data(),
-                      batchnorm_stddivs[i].data());
+                      weights.batchnorm_means[i].data(),
+                      weights.batchnorm_stddivs[i].data());
 
-        output_channels = conv_biases[i + 1].size();
+        output_channels = weights.conv_biases[i + 1].size();
         std::swap(conv_out, conv_in);
         winograd_convolve3(output_channels, conv_in,
-                           conv_weights[i + 1], V, M, conv_out);
+                           weights.conv_weights[i + 1], V, M, conv_out);
         batchnorm<64>(output_channels, conv_out,
-                      batchnorm_means[i + 1].data(),
-                      batchnorm_stddivs[i + 1].data(),
+                      weights.batchnorm_means[i + 1].data(),
+                      weights.batchnorm_stddivs[i + 1].data(),
                       res.data());
     }
-    convolve<1>(NUM_POLICY_INPUT_PLANES, conv_out, conv_pol_w, conv_pol_b, policy_data);
-    convolve<1>(NUM_VALUE_INPUT_PLANES, conv_out, conv_val_w, conv_val_b, value_data);
-    batchnorm<width*height>(NUM_POLICY_INPUT_PLANES, policy_data, bn_pol_w1.data(), bn_pol_w2.data());
+    convolve<1>(NUM_POLICY_INPUT_PLANES, conv_out, weights.conv_pol_w, weights.conv_pol_b, policy_data);
+    convolve<1>(NUM_VALUE_INPUT_PLANES, conv_out, weights.conv_val_w, weights.conv_val_b, value_data);
+    batchnorm<width*height>(NUM_POLICY_INPUT_PLANES, policy_data, weights.bn_pol_w1.data(), weights.bn_pol_w2.data());
 
-    batchnorm<width*height>(NUM_VALUE_INPUT_PLANES, value_data, bn_val_w1.data(), bn_val_w2.data());
+    batchnorm<width*height>(NUM_VALUE_INPUT_PLANES, value_data, weights.bn_val_w1.data(), weights.bn_val_w2.data());
 
     if (m_format_version == 1) {
-        innerproduct<NUM_POLICY_INPUT_PLANES*width*height, V1_NUM_OUTPUT_POLICY>(policy_data, v1_ip_pol_w, v1_ip_pol_b, output_pol);
+        innerproduct<NUM_POLICY_INPUT_PLANES*width*height, V1_NUM_OUTPUT_POLICY>(policy_data, weights.v1_ip_pol_w, weights.v1_ip_pol_b, output_pol);
     } else {
-        innerproduct<NUM_POLICY_INPUT_PLANES*width*height, V2_NUM_OUTPUT_POLICY>(policy_data, v2_ip_pol_w, v2_ip_pol_b, output_pol);
+        innerproduct<NUM_POLICY_INPUT_PLANES*width*height, V2_NUM_OUTPUT_POLICY>(policy_data, weights.v2_ip_pol_w, weights.v2_ip_pol_b, output_pol);
     }
-    innerproduct<NUM_VALUE_INPUT_PLANES*width*height, NUM_VALUE_CHANNELS>(value_data, ip1_val_w, ip1_val_b, output_val);
+    innerproduct<NUM_VALUE_INPUT_PLANES*width*height, NUM_VALUE_CHANNELS>(value_data, weights.ip1_val_w, weights.ip1_val_b, output_val);
 }
 
 template<typename T>
@@ -1002,6 +1109,156 @@ bool compare_net_outputs(std::vector<float>& data,
     }
     return almost_equal;
 }
+
+#ifdef USE_OPENCL_SELFCHECK
+// Verifies sampled OpenCL results against forward_cpu on a background
+// thread, so the search thread that drew the sample does not stall for a
+// CPU evaluation. If the checker falls behind, new samples are dropped.
+class SelfCheck {
+public:
+    static constexpr size_t MAX_QUEUED = 4;
+
+    ~SelfCheck() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_exit = true;
+        }
+        m_cv.notify_one();
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    void submit(const std::vector<net_t>& input,
+                const std::vector<float>& policy,
+                const std::vector<float>& value,
+                const BoardHistory& pos) {
+        // Only the moves, the PGN is written if the check fails.
+        auto start_fen = pos.positions.front().fen();
+        auto moves = std::vector<Move>{};
+        moves.reserve(pos.positions.size());
+        for (size_t i = 1; i < pos.positions.size(); i++) {
+            moves.emplace_back(pos.positions[i].get_move());
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_queue.size() >= MAX_QUEUED) {
+                ++m_dropped;
+                return;
+            }
+            if (!m_thread.joinable()) {
+                m_thread = std::thread([this]() { worker(); });
+            }
+            m_queue.emplace_back(Sample{input, policy, value,
+                                        std::move(start_fen),
+                                        std::move(moves)});
+        }
+        m_cv.notify_one();
+    }
+
+    // Polled by the search before each evaluation.
+    void check_failed() const {
+        if (m_failed) {
+            throw std::runtime_error(m_error);
+        }
+    }
+
+private:
+    struct Sample {
+        std::vector<net_t> input;
+        std::vector<float> policy;
+        std::vector<float> value;
+        std::string start_fen;
+        std::vector<Move> moves;
+    };
+
+    static std::string pgn(const Sample& sample) {
+        BoardHistory bh;
+        bh.set(sample.start_fen);
+        for (const auto move : sample.moves) {
+            bh.do_move(move);
+        }
+        return bh.pgn();
+    }
+
+    void worker() {
+        while (true) {
+            Sample sample;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this]() { return m_exit || !m_queue.empty(); });
+                if (m_exit) {
+                    return;
+                }
+                sample = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            if (!verify(sample)) {
+                return;
+            }
+        }
+    }
+
+    bool verify(Sample& sample) {
+        auto& policy_data = sample.policy;
+        auto& value_data = sample.value;
+        auto cpu_policy_data = std::vector<float>(policy_data.size());
+        auto cpu_value_data = std::vector<float>(value_data.size());
+        auto fatal = false;
+        Network::forward_cpu(main_weights, sample.input,
+                             cpu_policy_data, cpu_value_data);
+        auto almost_equal = compare_net_outputs(policy_data, cpu_policy_data, fatal);
+        almost_equal &= compare_net_outputs(value_data, cpu_value_data, fatal);
+        if (almost_equal) {
+            return true;
+        }
+        myprintf("PGN\n%s\nEND\n", pgn(sample).c_str());
+        myprintf("Self-check samples dropped so far: %d\n", m_dropped.load());
+        // Compare again but with debug info
+        compare_net_outputs(policy_data, cpu_policy_data, fatal, true, "orig policy");
+        compare_net_outputs(value_data, cpu_value_data, fatal, true, "orig value");
+        // Call opencl.forward again to see if the error is reproduceable.
+        std::vector<float> value_data_retry(value_data.size());
+        std::vector<float> policy_data_retry(policy_data.size());
+        opencl.forward(sample.input, policy_data_retry, value_data_retry);
+        auto almost_equal_retry = compare_net_outputs(policy_data_retry, policy_data, fatal, true, "retry policy");
+        almost_equal_retry &= compare_net_outputs(value_data_retry, value_data, fatal, true, "retry value");
+        if (!almost_equal_retry) {
+            fail("OpenCL retry self-check mismatch.");
+            return false;
+        } else {
+            myprintf("compare_net_outputs retry was ok\n");
+        }
+        if (fatal) {
+            myprintf_so("Update your GPU drivers or reduce the amount of games "
+                       "played simultaneously.\n");
+            fail("OpenCL self-check mismatch.");
+            return false;
+        }
+        return true;
+    }
+
+    void fail(const std::string& error) {
+        m_error = error;
+        m_failed = true;
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Sample> m_queue;
+    std::thread m_thread;
+    bool m_exit{false};
+    std::atomic<int> m_dropped{0};
+    // m_error is written once, before m_failed is set.
+    std::string m_error;
+    std::atomic<bool> m_failed{false};
+};
+
+static SelfCheck& get_selfcheck() {
+    static SelfCheck selfcheck;
+    return selfcheck;
+}
+#endif
 #endif
 
 void Network::softmax(const std::vector<float>& input,
@@ -1031,14 +1288,13 @@ Network::Netresult Network::get_scored_moves(const BoardHistory& pos, DebugRawDa
 
     // See if we already have this in the cache.
     if (!skip_cache) {
-        if (NNCache::get_NNCache().lookup(full_key, result)) {
+        if (NNCache::get_NNCache().lookup(full_key, result,
+                                          pos.cur().game_ply())) {
             return result;
         }
     }
 
-    NNPlanes planes;
-    gather_features(pos, planes);
-    result = get_scored_moves_internal(pos, planes, debug_data);
+    result = get_scored_moves_nocache(pos, debug_data);
 
     // Insert result into cache.
     NNCache::get_NNCache().insert(full_key, result);
@@ -1046,11 +1302,48 @@ Network::Netresult Network::get_scored_moves(const BoardHistory& pos, DebugRawDa
     return result;
 }
 
-Network::Netresult Network::get_scored_moves_internal(const BoardHistory& pos, NNPlanes& planes, DebugRawData* debug_data) {
+Network::Netresult Network::get_scored_moves_nocache(const BoardHistory& pos, DebugRawData* debug_data) {
+    NNPlanes planes;
+    gather_features(pos, planes);
+    const auto start = std::chrono::steady_clock::now();
+    auto result = get_scored_moves_internal(pos, planes, debug_data,
+                                            main_weights);
+    AdaptiveThreads::count_eval(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start));
+    return result;
+}
+
+bool Network::has_small_network() {
+    return small_weights.format_version != 0;
+}
+
+Network::Netresult Network::get_scored_moves_small(const BoardHistory& pos) {
+    assert(has_small_network());
+    NNPlanes planes;
+    gather_features(pos, planes);
+    return get_scored_moves_internal(pos, planes, nullptr, small_weights);
+}
+
+// Data layout is [(c * height + h) * width + w]
+static std::vector<net_t> expand_input_planes(const std::vector<std::uint64_t>& masks,
+                                              const std::vector<float>& values) {
+    auto input_data = std::vector<net_t>{};
+    input_data.reserve(masks.size() * 64);
+    for (auto c = size_t{0}; c < masks.size(); ++c) {
+        for (int i = 0; i < 64; ++i) {
+            input_data.emplace_back(net_t((masks[c] >> i) & 1 ? values[c] : 0.0f));
+        }
+    }
+    return input_data;
+}
+
+Network::Netresult Network::get_scored_moves_internal(const BoardHistory& pos, NNPlanes& planes, DebugRawData* debug_data,
+                                                      const Weights& weights) {
     assert(MAX_INPUT_CHANNELS == planes.bit.size()+3);
     constexpr int width = 8;
     constexpr int height = 8;
-    const auto convolve_channels = conv_pol_w.size() / conv_pol_b.size();
+    const auto convolve_channels = weights.conv_pol_w.size() / weights.conv_pol_b.size();
     std::vector<net_t> input_data;
     std::vector<net_t> output_data(convolve_channels * width * height);
     std::vector<float> value_data(Network::NUM_VALUE_INPUT_PLANES * width * height);
@@ -1058,71 +1351,54 @@ Network::Netresult Network::get_scored_moves_internal(const BoardHistory& pos, N
     std::vector<float> softmax_data(get_num_output_policy());
     std::vector<float> winrate_data(Network::NUM_VALUE_CHANNELS);
     std::vector<float> winrate_out(1);
-    // Data layout is input_data[(c * height + h) * width + w]
-    input_data.reserve(MAX_INPUT_CHANNELS * width * height);
+    // Each input plane is a mask of the set squares and the value they are
+    // set to. The OpenCL path uploads the planes like this, and they are
+    // only expanded to floats where needed.
+    auto input_masks = std::vector<std::uint64_t>{};
+    auto input_values = std::vector<float>{};
+    input_masks.reserve(MAX_INPUT_CHANNELS);
+    input_values.reserve(MAX_INPUT_CHANNELS);
     for (int c = 0; c < MAX_INPUT_CHANNELS - 3; ++c) {
-        for (int i = 0; i < 64; ++i) {
-            input_data.emplace_back(net_t(planes.bit[c][i]));
-        }
-    }
-    for (int i = 0; i < 64; ++i) {
-        input_data.emplace_back(net_t(planes.rule50_count));
-    }
-    for (int i = 0; i < 64; ++i) {
-        input_data.emplace_back(net_t(planes.move_count));
+        input_masks.emplace_back(planes.bit[c].to_ullong());
+        input_values.emplace_back(1.0f);
     }
+    input_masks.emplace_back(~0ULL);
+    input_values.emplace_back(planes.rule50_count);
+    input_masks.emplace_back(~0ULL);
+    input_values.emplace_back(planes.move_count);
     // TODO: I changed this to a plane of ones for V2.
     // To help see the edge of the board
-    for (int i = 0; i < 64; ++i) {
-        input_data.emplace_back(net_t(m_format_version == 1 ? 0.0 : 1.0));
-    }
-    assert(input_data.size() == MAX_INPUT_CHANNELS * width * height);
+    input_masks.emplace_back(~0ULL);
+    input_values.emplace_back(m_format_version == 1 ? 0.0f : 1.0f);
+    assert(input_masks.size() == MAX_INPUT_CHANNELS);
+    if (&weights == &small_weights) {
+        input_data = expand_input_planes(input_masks, input_values);
+        forward_cpu(weights, input_data, policy_data, value_data);
+    } else {
 #ifdef USE_OPENCL
-    opencl.forward(input_data, policy_data, value_data);
+        opencl.forward(input_masks, input_values, policy_data, value_data);
 #elif defined(USE_BLAS) && !defined(USE_OPENCL)
-    forward_cpu(input_data, policy_data, value_data);
+        input_data = expand_input_planes(input_masks, input_values);
+        forward_cpu(weights, input_data, policy_data, value_data);
 #endif
 #ifdef USE_OPENCL_SELFCHECK
-    // Both implementations are available, self-check the OpenCL driver by
-    // running both with a probability of 1/2000.
-    if (Random::GetRng().RandInt(SELFCHECK_PROBABILITY) == 0) {
-        auto cpu_policy_data = std::vector<float>(policy_data.size());
-        auto cpu_value_data = std::vector<float>(value_data.size());
-        auto fatal = false;
-        forward_cpu(input_data, cpu_policy_data, cpu_value_data);
-        auto almost_equal = compare_net_outputs(policy_data, cpu_policy_data, fatal);
-        almost_equal &= compare_net_outputs(value_data, cpu_value_data, fatal);
-        if (!almost_equal) {
-            myprintf("PGN\n%s\nEND\n", pos.pgn().c_str());
-            // Compare again but with debug info
-            compare_net_outputs(policy_data, cpu_policy_data, fatal, true, "orig policy");
-            compare_net_outputs(value_data, cpu_value_data, fatal, true, "orig value");
-            // Call opencl.forward again to see if the error is reproduceable.
-            std::vector<float> value_data_retry(Network::NUM_VALUE_INPUT_PLANES * width * height);
-            std::vector<float> policy_data_retry(get_num_output_policy());
-            opencl.forward(input_data, policy_data_retry, value_data_retry);
-            auto almost_equal_retry = compare_net_outputs(policy_data_retry, policy_data, fatal, true, "retry policy");
-            almost_equal_retry &= compare_net_outputs(value_data_retry, value_data, fatal, true, "retry value");
-            if (!almost_equal_retry) {
-                throw std::runtime_error("OpenCL retry self-check mismatch.");
-            } else {
-                myprintf("compare_net_outputs retry was ok\n");
-            }
-            if (fatal) {
-                myprintf_so("Update your GPU drivers or reduce the amount of games "
-                           "played simultaneously.\n");
-                throw std::runtime_error("OpenCL self-check mismatch.");
-            }
+        // Both implementations are available, self-check the OpenCL driver by
+        // running both with a probability of 1/2000. The CPU side runs on the
+        // checker thread, a mismatch is reported on a later evaluation.
+        get_selfcheck().check_failed();
+        if (Random::GetRng().RandInt(SELFCHECK_PROBABILITY) == 0) {
+            input_data = expand_input_planes(input_masks, input_values);
+            get_selfcheck().submit(input_data, policy_data, value_data, pos);
         }
-    }
 #endif
+    }
 
     // Get the moves
     softmax(policy_data, softmax_data, cfg_softmax_temp);
     std::vector<float>& outputs = softmax_data;
 
     // Now get the score
-    innerproduct<NUM_VALUE_CHANNELS, 1>(value_data, ip2_val_w, ip2_val_b, winrate_out);
+    innerproduct<NUM_VALUE_CHANNELS, 1>(value_data, weights.ip2_val_w, weights.ip2_val_b, winrate_out);
 
     // Sigmoid
     auto winrate_sig = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
@@ -1134,7 +1410,7 @@ Network::Netresult Network::get_scored_moves_internal(const BoardHistory& pos, N
     }
 
     if (debug_data) {
-      debug_data->input = input_data;
+      debug_data->input = expand_input_planes(input_masks, input_values);
       debug_data->policy_output = outputs;
       debug_data->value_output = winrate_sig;
       debug_data->filtered_output = result;
@@ -96,6 +96,16 @@ public:
     static Netresult get_scored_moves(const BoardHistory& state,
                                       DebugRawData* debug_data=nullptr,
                                       bool skip_cache = false);
+    // Evaluate without looking up or inserting into the NNCache.
+    static Netresult get_scored_moves_nocache(const BoardHistory& state,
+                                              DebugRawData* debug_data=nullptr);
+    // Evaluate with the network loaded with --small-weights. It always
+    // runs on the CPU, and its results do not go into the NNCache.
+    static bool has_small_network();
+    static Netresult get_scored_moves_small(const BoardHistory& state);
+
+    // Defined in Network.cpp.
+    struct Weights;
 
     // Winograd filter transformation changes 3x3 filters to 4x4
     static constexpr auto WINOGRAD_ALPHA = 4;
@@ -109,11 +119,21 @@ public:
     static size_t get_input_channels();
     static size_t get_hist_planes();
     static size_t get_num_output_policy();
+    // Done by initialize(). Tests that need lookup() without loading a
+    // network call it directly.
+    static void init_move_map();
 
 private:
+#ifdef USE_OPENCL_SELFCHECK
+    friend class SelfCheck;
+#endif
     static bool initialized;
-    static std::pair<int, int> load_network(std::istream& wtfile);
-    static std::pair<int, int> load_network_file(std::string filename);
+    static std::pair<int, int> load_network(std::istream& wtfile,
+                                            Weights& w);
+    static std::pair<int, int> load_network_file(std::string filename,
+                                                 Weights& weights);
+    static void prepare_weights(Weights& weights, size_t channels,
+                                size_t residual_blocks);
     static void process_bn_var(std::vector<float>& weights,
                                const float epsilon=1e-5f);
     static size_t m_format_version;
@@ -143,10 +163,11 @@ private:
     static void winograd_sgemm(const std::vector<float>& U,
                                std::vector<float>& V,
                                std::vector<float>& M, const int C, const int K);
-    static void init_move_map();
-    static Netresult get_scored_moves_internal(const BoardHistory& state, NNPlanes& planes, DebugRawData* debug_data);
+    static Netresult get_scored_moves_internal(const BoardHistory& state, NNPlanes& planes, DebugRawData* debug_data,
+                                               const Weights& weights);
 #if defined(USE_BLAS)
-    static void forward_cpu(std::vector<float>& input,
+    static void forward_cpu(const Weights& weights,
+                            std::vector<float>& input,
                             std::vector<float>& output_pol,
                             std::vector<float>& output_val);
 
@@ -35,6 +35,7 @@
 
 #include "Utils.h"
 #include "Timing.h"
+#include "MemStats.h"
 #include "OpenCL.h"
 #include "Network.h"
 #include "Tuner.h"
@@ -154,6 +155,20 @@ __kernel void merge_bn(
     }
 )";
 
+static std::string sourceCode_expand_planes = R"(
+    // Expands the packed input, one mask of the set squares and one value
+    // per plane, into the input planes of the first layer.
+    __kernel void expand_planes(__global const ulong * restrict masks,
+                                __global const float * restrict values,
+                                __global net_t * restrict out) {
+        // cl::NDRange global(planes, 8*8);
+        const int plane = get_global_id(0);
+        const int square = get_global_id(1);
+        const float value = ((masks[plane] >> square) & 1) ? values[plane] : 0.0f;
+        vstore_net_t(value, plane * 64 + square, out);
+    }
+)";
+
 static std::string sourceCode_convolve3 = R"(
 void __in_transform_eq(float x[4][4], __global float * restrict V, int offset, int CPpad) {
     float T1[4][4];
@@ -406,31 +421,6 @@ const std::string sourceCode_sgemv =
     #include "clblast_level3/xgemv.opencl"
 ;
 
-thread_local ThreadData opencl_thread_data;
-
-void OpenCL::ensure_thread_initialized() {
-    if (!opencl_thread_data.m_is_initialized) {
-        // Make kernels
-        opencl_thread_data.m_convolve1_kernel =
-            cl::Kernel(m_program, "convolve1");
-        opencl_thread_data.m_merge_kernel =
-            cl::Kernel(m_program, "merge_bn");
-        opencl_thread_data.m_in_transform_kernel =
-            cl::Kernel(m_program, "in_transform");
-        opencl_thread_data.m_sgemm_kernel =
-            cl::Kernel(m_program, "XgemmBatched");
-        opencl_thread_data.m_out_transform_bn_kernel =
-            cl::Kernel(m_program, "out_transform_fused_bn");
-        opencl_thread_data.m_out_transform_bn_in_kernel =
-            cl::Kernel(m_program, "out_transform_fused_bn_in");
-        opencl_thread_data.m_sgemv_kernel =
-            cl::Kernel(m_program, "Xgemv");
-        opencl_thread_data.m_commandqueue =
-            cl::CommandQueue(m_context, m_device);
-        opencl_thread_data.m_is_initialized = true;
-    }
-}
-
 void OpenCL_Network::add_weights(size_t layer,
                                  size_t size,
                                  const float * weights) {
@@ -444,6 +434,7 @@ void OpenCL_Network::add_weights(size_t layer,
     }
 
     auto weightSize = size * sizeof(decltype(converted_weights)::value_type);
+    MemStats::add(MemStats::OPENCL_BUFFERS, weightSize);
     m_layers.back().weights.emplace_back(
         m_opencl.m_context,
         CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
@@ -451,11 +442,96 @@ void OpenCL_Network::add_weights(size_t layer,
         const_cast<net_t*>(converted_weights.data()));
 }
 
+class OpenCL_Network::ContextLease {
+public:
+    explicit ContextLease(OpenCL_Network& network)
+        : m_network(network), m_context(network.acquire_context()) {}
+    ~ContextLease() {
+        m_network.release_context(m_context);
+    }
+    ContextLease(const ContextLease&) = delete;
+    ContextLease& operator=(const ContextLease&) = delete;
+
+    ExecutionContext& get() {
+        return m_context;
+    }
+
+private:
+    OpenCL_Network& m_network;
+    ExecutionContext& m_context;
+};
+
 void OpenCL_Network::forward(const std::vector<net_t>& input,
                              std::vector<net_t>& output_pol,
                              std::vector<net_t>& output_val) {
+    ContextLease lease(*this);
+    auto& context = lease.get();
+
+    cl::CommandQueue & queue = context.m_commandqueue;
+    const auto inSize = sizeof(net_t) * input.size();
+    queue.enqueueWriteBuffer(context.m_inBuffer, CL_FALSE, 0,
+                             inSize, input.data());
+
+    forward_layers(context, output_pol, output_val);
+}
+
+void OpenCL_Network::forward(const std::vector<std::uint64_t>& input_masks,
+                             const std::vector<float>& input_values,
+                             std::vector<net_t>& output_pol,
+                             std::vector<net_t>& output_val) {
+    ContextLease lease(*this);
+    auto& context = lease.get();
+    expand_planes(context, input_masks, input_values);
+    forward_layers(context, output_pol, output_val);
+}
+
+void OpenCL_Network::expand_planes(ExecutionContext& context,
+                                   const std::vector<std::uint64_t>& input_masks,
+                                   const std::vector<float>& input_values) {
+    assert(input_masks.size() == input_values.size());
+    assert(input_masks.size() <= m_layers[0].channels);
+
+    cl::Kernel & expand_planes_kernel = context.m_expand_planes_kernel;
+    cl::CommandQueue & queue = context.m_commandqueue;
+
+    queue.enqueueWriteBuffer(context.m_maskBuffer, CL_FALSE, 0,
+                             input_masks.size() * sizeof(std::uint64_t),
+                             input_masks.data());
+    queue.enqueueWriteBuffer(context.m_valueBuffer, CL_FALSE, 0,
+                             input_values.size() * sizeof(float),
+                             input_values.data());
+    try {
+        expand_planes_kernel.setArg(0, context.m_maskBuffer);
+        expand_planes_kernel.setArg(1, context.m_valueBuffer);
+        expand_planes_kernel.setArg(2, context.m_inBuffer);
+
+        queue.enqueueNDRangeKernel(expand_planes_kernel, cl::NullRange,
+                                   cl::NDRange(input_masks.size(), 64));
+    } catch (const cl::Error &e) {
+        std::cerr << "Error in expand_planes: " << e.what() << ": "
+            << e.err() << std::endl;
+        throw;
+    }
+}
+
+std::unique_ptr<ExecutionContext> OpenCL_Network::create_context() {
     constexpr auto tiles = WINOGRAD_P;
 
+    auto context = std::make_unique<ExecutionContext>();
+    const auto& program = m_opencl.m_program;
+    context->m_convolve1_kernel = cl::Kernel(program, "convolve1");
+    context->m_merge_kernel = cl::Kernel(program, "merge_bn");
+    context->m_in_transform_kernel = cl::Kernel(program, "in_transform");
+    context->m_sgemm_kernel = cl::Kernel(program, "XgemmBatched");
+    context->m_out_transform_bn_kernel =
+        cl::Kernel(program, "out_transform_fused_bn");
+    context->m_out_transform_bn_in_kernel =
+        cl::Kernel(program, "out_transform_fused_bn_in");
+    context->m_sgemv_kernel = cl::Kernel(program, "Xgemv");
+    context->m_expand_planes_kernel = cl::Kernel(program, "expand_planes");
+    context->m_commandqueue = cl::CommandQueue(m_opencl.m_context,
+                                               m_opencl.m_device);
+
     auto finalSize_pol = m_layers[m_layers.size()-2].ip_out_size  * sizeof(net_t);
     auto finalSize_val = m_layers.back().ip_out_size  * sizeof(net_t);
 
@@ -463,62 +539,123 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
         std::swap(finalSize_pol, finalSize_val);
     }
 
-    m_opencl.ensure_thread_initialized();
+    auto max_channels = unsigned{0};
+    for (const auto& layer : m_layers) {
+        max_channels = std::max(max_channels,
+                                std::max(layer.channels, layer.outputs));
+    }
 
-    if (!opencl_thread_data.m_buffers_allocated) {
-        auto max_channels = unsigned{0};
-        for (const auto& layer : m_layers) {
-            max_channels = std::max(max_channels,
-                                    std::max(layer.channels, layer.outputs));
-        }
+    const auto mwg = m_opencl.m_sgemm_tuners.mwg;
+    const auto nwg = m_opencl.m_sgemm_tuners.nwg;
+    const auto vwm = m_opencl.m_sgemm_tuners.vwm;
+    const auto vwn = m_opencl.m_sgemm_tuners.vwn;
+
+    const auto m_ceil = ceilMultiple(ceilMultiple(max_channels, mwg), vwm);
+    const auto n_ceil = ceilMultiple(ceilMultiple(tiles, nwg), vwn);
+
+    const auto alloc_inSize =
+        m_ceil * m_ceil *  max_channels * sizeof(net_t);
+    const auto alloc_vm_size =
+        WINOGRAD_TILE * m_ceil * n_ceil * sizeof(net_t);
+
+    auto v_zeros = std::vector<float>(alloc_vm_size);
+
+    context->m_inBuffer = cl::Buffer(
+        m_opencl.m_context,
+        CL_MEM_READ_WRITE, alloc_inSize);
+    context->m_inBuffer2 = cl::Buffer(
+        m_opencl.m_context,
+        CL_MEM_READ_WRITE, alloc_inSize);
+    context->m_VBuffer = cl::Buffer(
+        m_opencl.m_context,
+        CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS | CL_MEM_COPY_HOST_PTR,
+        alloc_vm_size, v_zeros.data(), nullptr);
+    context->m_MBuffer = cl::Buffer(
+        m_opencl.m_context,
+        CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, alloc_vm_size);
+
+    context->m_pinnedOutBuffer_pol = cl::Buffer(
+        m_opencl.m_context,
+        CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, finalSize_pol);
+    context->m_pinnedOutBuffer_val = cl::Buffer(
+        m_opencl.m_context,
+        CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, finalSize_val);
+
+    const auto input_planes = m_layers[0].channels;
+    const auto alloc_maskSize = input_planes * sizeof(std::uint64_t);
+    const auto alloc_valueSize = input_planes * sizeof(float);
+    context->m_maskBuffer = cl::Buffer(
+        m_opencl.m_context,
+        CL_MEM_READ_ONLY, alloc_maskSize);
+    context->m_valueBuffer = cl::Buffer(
+        m_opencl.m_context,
+        CL_MEM_READ_ONLY, alloc_valueSize);
+
+    MemStats::add(MemStats::OPENCL_BUFFERS,
+                  2 * alloc_inSize + 2 * alloc_vm_size
+                  + finalSize_pol + finalSize_val
+                  + alloc_maskSize + alloc_valueSize);
+    return context;
+}
 
-        const auto mwg = m_opencl.m_sgemm_tuners.mwg;
-        const auto nwg = m_opencl.m_sgemm_tuners.nwg;
-        const auto vwm = m_opencl.m_sgemm_tuners.vwm;
-        const auto vwn = m_opencl.m_sgemm_tuners.vwn;
-
-        const auto m_ceil = ceilMultiple(ceilMultiple(max_channels, mwg), vwm);
-        const auto n_ceil = ceilMultiple(ceilMultiple(tiles, nwg), vwn);
-
-        const auto alloc_inSize =
-            m_ceil * m_ceil *  max_channels * sizeof(net_t);
-        const auto alloc_vm_size =
-            WINOGRAD_TILE * m_ceil * n_ceil * sizeof(net_t);
-
-        auto v_zeros = std::vector<float>(alloc_vm_size);
-
-        opencl_thread_data.m_inBuffer = cl::Buffer(
-            m_opencl.m_context,
-            CL_MEM_READ_WRITE, alloc_inSize);
-        opencl_thread_data.m_inBuffer2 = cl::Buffer(
-            m_opencl.m_context,
-            CL_MEM_READ_WRITE, alloc_inSize);
-        opencl_thread_data.m_VBuffer = cl::Buffer(
-            m_opencl.m_context,
-            CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS | CL_MEM_COPY_HOST_PTR,
-            alloc_vm_size, v_zeros.data(), nullptr);
-        opencl_thread_data.m_MBuffer = cl::Buffer(
-            m_opencl.m_context,
-            CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, alloc_vm_size);
-
-        opencl_thread_data.m_pinnedOutBuffer_pol = cl::Buffer(
-            m_opencl.m_context,
-            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, finalSize_pol);
-        opencl_thread_data.m_pinnedOutBuffer_val = cl::Buffer(
-            m_opencl.m_context,
-            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, finalSize_val);
-
-        opencl_thread_data.m_buffers_allocated = true;
+ExecutionContext& OpenCL_Network::acquire_context() {
+    std::unique_lock<std::mutex> lock(m_context_mutex);
+    const auto can_create = [this]() {
+        return m_contexts.size() + m_creating_contexts
+               < m_opencl.m_max_contexts;
+    };
+    m_context_cv.wait(lock, [this, &can_create]() {
+        return !m_free_contexts.empty() || can_create();
+    });
+    if (!m_free_contexts.empty()) {
+        auto context = m_free_contexts.back();
+        m_free_contexts.pop_back();
+        return *context;
     }
 
-    cl::Buffer & inBuffer = opencl_thread_data.m_inBuffer;
-    cl::Buffer & inBuffer2 = opencl_thread_data.m_inBuffer2;
-    cl::Buffer & VBuffer = opencl_thread_data.m_VBuffer;
-    cl::Buffer & MBuffer = opencl_thread_data.m_MBuffer;
-    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+    // Creating one allocates buffers and builds kernels, so it is done
+    // without the lock, with a slot reserved for it.
+    m_creating_contexts++;
+    lock.unlock();
+    auto context = std::unique_ptr<ExecutionContext>{};
+    try {
+        context = create_context();
+    } catch (...) {
+        lock.lock();
+        m_creating_contexts--;
+        lock.unlock();
+        m_context_cv.notify_one();
+        throw;
+    }
+    lock.lock();
+    m_creating_contexts--;
+    m_contexts.emplace_back(std::move(context));
+    return *m_contexts.back();
+}
 
-    const auto inSize = sizeof(net_t) * input.size();
-    queue.enqueueWriteBuffer(inBuffer, CL_FALSE, 0, inSize, input.data());
+void OpenCL_Network::release_context(ExecutionContext& context) {
+    {
+        std::lock_guard<std::mutex> lock(m_context_mutex);
+        m_free_contexts.push_back(&context);
+    }
+    m_context_cv.notify_one();
+}
+
+void OpenCL_Network::forward_layers(ExecutionContext& context,
+                                    std::vector<net_t>& output_pol,
+                                    std::vector<net_t>& output_val) {
+    auto finalSize_pol = m_layers[m_layers.size()-2].ip_out_size  * sizeof(net_t);
+    auto finalSize_val = m_layers.back().ip_out_size  * sizeof(net_t);
+
+    if (m_layers.back().is_policy) {
+        std::swap(finalSize_pol, finalSize_val);
+    }
+
+    cl::Buffer & inBuffer = context.m_inBuffer;
+    cl::Buffer & inBuffer2 = context.m_inBuffer2;
+    cl::Buffer & VBuffer = context.m_VBuffer;
+    cl::Buffer & MBuffer = context.m_MBuffer;
+    cl::CommandQueue & queue = context.m_commandqueue;
 
     auto skip_in_trans = false;
     for (auto iter = cbegin(m_layers); iter != cend(m_layers); iter++) {
@@ -533,7 +670,7 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
             if (niter->is_residual_block) {
                 skip_next_in_trans = true;
             }
-            convolve3(layer.channels,
+            convolve3(context, layer.channels,
                      layer.outputs,
                      inBuffer,
                      inBuffer,
@@ -551,7 +688,7 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
             auto bn1_weights   = begin(layer.weights) + 1;
             auto conv2_weights = begin(layer.weights) + 3;
             auto bn2_weights   = begin(layer.weights) + 4;
-            convolve3(layer.channels,
+            convolve3(context, layer.channels,
                       layer.outputs,
                       inBuffer,
                       inBuffer2,
@@ -566,7 +703,7 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
             if (niter->is_residual_block) {
                 skip_next_in_trans = true;
             }
-            convolve3(layer.channels,
+            convolve3(context, layer.channels,
                       layer.outputs,
                       inBuffer2,
                       inBuffer,
@@ -582,22 +719,22 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
 
             cl::Buffer out_buffer;
             if (layer.is_policy) {
-                out_buffer = opencl_thread_data.m_pinnedOutBuffer_pol;
+                out_buffer = context.m_pinnedOutBuffer_pol;
             } else {
-                out_buffer = opencl_thread_data.m_pinnedOutBuffer_val;
+                out_buffer = context.m_pinnedOutBuffer_val;
             }
 
             auto ip_w = begin(layer.weights) + 3;
             auto ip_b = begin(layer.weights) + 4;
 
-            convolve1(layer.channels,
+            convolve1(context, layer.channels,
                     layer.outputs,
                     inBuffer,
                     inBuffer2,
                     VBuffer,
                     begin(layer.weights));
 
-            innerproduct(inBuffer2,
+            innerproduct(context, inBuffer2,
                     ip_w,
                     ip_b,
                     out_buffer,
@@ -608,10 +745,10 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
     }
 
     auto pinnedOutBufferHost_pol = queue.enqueueMapBuffer(
-        opencl_thread_data.m_pinnedOutBuffer_pol, CL_FALSE,
+        context.m_pinnedOutBuffer_pol, CL_FALSE,
         CL_MAP_READ, 0, finalSize_pol);
     auto pinnedOutBufferHost_val = queue.enqueueMapBuffer(
-        opencl_thread_data.m_pinnedOutBuffer_val, CL_FALSE,
+        context.m_pinnedOutBuffer_val, CL_FALSE,
         CL_MAP_READ, 0, finalSize_val);
 
     {
@@ -624,14 +761,15 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
     std::memcpy(output_pol.data(), pinnedOutBufferHost_pol, finalSize_pol);
     std::memcpy(output_val.data(), pinnedOutBufferHost_val, finalSize_val);
 
-    queue.enqueueUnmapMemObject(opencl_thread_data.m_pinnedOutBuffer_pol,
+    queue.enqueueUnmapMemObject(context.m_pinnedOutBuffer_pol,
             pinnedOutBufferHost_pol);
-    queue.enqueueUnmapMemObject(opencl_thread_data.m_pinnedOutBuffer_val,
+    queue.enqueueUnmapMemObject(context.m_pinnedOutBuffer_val,
             pinnedOutBufferHost_val);
 
 }
 
-void OpenCL_Network::convolve3(int channels, int outputs,
+void OpenCL_Network::convolve3(ExecutionContext& context,
+                              int channels, int outputs,
                               cl::Buffer& bufferIn,
                               cl::Buffer& bufferOut,
                               cl::Buffer& bufferV,
@@ -643,12 +781,12 @@ void OpenCL_Network::convolve3(int channels, int outputs,
                               bool fuse_in_transform,
                               bool store_inout) {
 
-    cl::Kernel & in_transform_kernel = opencl_thread_data.m_in_transform_kernel;
-    cl::Kernel & sgemm_kernel = opencl_thread_data.m_sgemm_kernel;
+    cl::Kernel & in_transform_kernel = context.m_in_transform_kernel;
+    cl::Kernel & sgemm_kernel = context.m_sgemm_kernel;
     cl::Kernel & out_transform_bn_kernel =
-        opencl_thread_data.m_out_transform_bn_kernel;
+        context.m_out_transform_bn_kernel;
     cl::Kernel & out_transform_bn_in_kernel =
-        opencl_thread_data.m_out_transform_bn_in_kernel;
+        context.m_out_transform_bn_in_kernel;
 
     auto mwg = m_opencl.m_sgemm_tuners.mwg;
     auto nwg = m_opencl.m_sgemm_tuners.nwg;
@@ -658,6 +796,7 @@ void OpenCL_Network::convolve3(int channels, int outputs,
     auto mdimc = m_opencl.m_sgemm_tuners.mdimc;
     auto ndimc = m_opencl.m_sgemm_tuners.ndimc;
     auto wavefront_size = m_opencl.m_wavefront_size;
+    const auto& tuners = m_opencl.m_kernel_tuners;
 
     assert(mwg != 0);
     assert(nwg != 0);
@@ -677,7 +816,7 @@ void OpenCL_Network::convolve3(int channels, int outputs,
     auto n_ceil = int(ceilMultiple(ceilMultiple(tiles, nwg), vwn));
     auto k_ceil = int(ceilMultiple(ceilMultiple(channels, kwg), vwm));
 
-    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+    cl::CommandQueue & queue = context.m_commandqueue;
 
     if (!skip_in_transform) {
         try {
@@ -687,8 +826,17 @@ void OpenCL_Network::convolve3(int channels, int outputs,
             in_transform_kernel.setArg(3, k_ceil);
             in_transform_kernel.setArg(4, n_ceil);
 
+            auto in_wgs = wgs;
+            auto in_local = cl::NullRange;
+            if (tuners.in_wg0 != 0) {
+                in_wgs = ceilMultiple(tiles, tuners.in_wg0);
+                if (channels % tuners.in_wg1 == 0) {
+                    in_local = cl::NDRange(tuners.in_wg0, tuners.in_wg1);
+                }
+            }
             queue.enqueueNDRangeKernel(in_transform_kernel, cl::NullRange,
-                                       cl::NDRange(wgs, channels));
+                                       cl::NDRange(in_wgs, channels),
+                                       in_local);
         } catch (const cl::Error &e) {
             std::cerr << "Error in convolve3: " << e.what() << ": "
                 << e.err() << std::endl;
@@ -720,8 +868,10 @@ void OpenCL_Network::convolve3(int channels, int outputs,
 
     try {
         if (fuse_in_transform) {
-            // TODO : Eventually this might also be something tuneable?
-            constexpr auto dim_size = 2;
+            auto dim_size = size_t{2};
+            if (outputs % tuners.outin_wg0 == 0) {
+                dim_size = tuners.outin_wg0;
+            }
             out_transform_bn_in_kernel.setArg(0, bufferM);
             if (store_inout) {
                 out_transform_bn_in_kernel.setArg(1, bufferOut);
@@ -763,8 +913,17 @@ void OpenCL_Network::convolve3(int channels, int outputs,
             out_transform_bn_kernel.setArg(6, bn_weights[0]);
             out_transform_bn_kernel.setArg(7, bn_weights[1]);
 
+            auto out_wgs = wgs;
+            auto out_local = cl::NullRange;
+            if (tuners.out_wg0 != 0) {
+                out_wgs = ceilMultiple(tiles, tuners.out_wg1);
+                if (outputs % tuners.out_wg0 == 0) {
+                    out_local = cl::NDRange(tuners.out_wg0, tuners.out_wg1);
+                }
+            }
             queue.enqueueNDRangeKernel(out_transform_bn_kernel, cl::NullRange,
-                                       cl::NDRange(outputs, wgs));
+                                       cl::NDRange(outputs, out_wgs),
+                                       out_local);
         }
     } catch (const cl::Error &e) {
         std::cerr << "Error in convolve3: " << e.what() << ": "
@@ -773,7 +932,8 @@ void OpenCL_Network::convolve3(int channels, int outputs,
     }
 }
 
-void OpenCL_Network::convolve1(int channels, int outputs,
+void OpenCL_Network::convolve1(ExecutionContext& context,
+                              int channels, int outputs,
                               cl::Buffer& bufferInput,
                               cl::Buffer& bufferOutput,
                               cl::Buffer& bufferMerge,
@@ -789,8 +949,11 @@ void OpenCL_Network::convolve1(int channels, int outputs,
     constexpr int channelShift = 3;
     constexpr int rowGroup = 1;
     size_t outputGroup = std::min(outputs, 32);
+    if (outputs % m_opencl.m_kernel_tuners.conv1_outg == 0) {
+        outputGroup = m_opencl.m_kernel_tuners.conv1_outg;
+    }
 
-    auto m_convolve_kernel = &opencl_thread_data.m_convolve1_kernel;
+    auto m_convolve_kernel = &context.m_convolve1_kernel;
 
 #ifndef NDEBUG
     // Total output size after reducing
@@ -807,7 +970,7 @@ void OpenCL_Network::convolve1(int channels, int outputs,
     int rowBuffer = std::min<int>(channelGroup, 7);
     size_t rowSize = channelGroup * outputGroup * rowBuffer * sizeof(float);
 
-    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+    cl::CommandQueue & queue = context.m_commandqueue;
 
     try {
         m_convolve_kernel->setArg(0, bufferInput);
@@ -825,7 +988,7 @@ void OpenCL_Network::convolve1(int channels, int outputs,
         throw;
     }
 
-    cl::Kernel & merge_kernel = opencl_thread_data.m_merge_kernel;
+    cl::Kernel & merge_kernel = context.m_merge_kernel;
     assert(channels % (1 << channelShift) == 0);
 
     try {
@@ -845,19 +1008,20 @@ void OpenCL_Network::convolve1(int channels, int outputs,
     }
 }
 
-void OpenCL_Network::innerproduct(cl::Buffer& input,
+void OpenCL_Network::innerproduct(ExecutionContext& context,
+                                  cl::Buffer& input,
                   weight_slice_t weights,
                   weight_slice_t biases,
                   cl::Buffer& output,
                   const int inputs, const int outputs,
                   const int relu) {
 
-    auto sgemv_kernel = opencl_thread_data.m_sgemv_kernel;
-    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+    auto sgemv_kernel = context.m_sgemv_kernel;
+    cl::CommandQueue & queue = context.m_commandqueue;
 
-    //TODO: Tune these
-    size_t wgs1 = 64;
-    size_t wpt1 = 1;
+    // These are compiled into the kernel.
+    size_t wgs1 = m_opencl.m_kernel_tuners.wgs1;
+    size_t wpt1 = m_opencl.m_kernel_tuners.wpt1;
 
     auto m_ceil = int(ceilMultiple(outputs, wgs1*wpt1));
     auto global_size = m_ceil / wpt1;
@@ -982,6 +1146,37 @@ void OpenCL::process_tuners(std::string tuners) {
     }
 }
 
+void OpenCL::process_kernel_tuners(std::string tuners) {
+    std::string buf;
+    std::stringstream ss(tuners);
+    while (ss >> buf) {
+        auto found = buf.find("=");
+        if (found == std::string::npos) {
+            std::cerr << "Invalid tuner string: " << tuners << std::endl;
+            std::exit(-1);
+        }
+        std::string name = buf.substr(0, found);
+        auto value = std::stoul(buf.substr(found + 1, std::string::npos));
+        if (name == "-DIN_WG0") {
+            m_kernel_tuners.in_wg0 = value;
+        } else if (name == "-DIN_WG1") {
+            m_kernel_tuners.in_wg1 = value;
+        } else if (name == "-DOUT_WG0") {
+            m_kernel_tuners.out_wg0 = value;
+        } else if (name == "-DOUT_WG1") {
+            m_kernel_tuners.out_wg1 = value;
+        } else if (name == "-DOUTIN_WG0") {
+            m_kernel_tuners.outin_wg0 = value;
+        } else if (name == "-DCONV1_OUTG") {
+            m_kernel_tuners.conv1_outg = value;
+        } else if (name == "-DWGS1") {
+            m_kernel_tuners.wgs1 = value;
+        } else if (name == "-DWPT1") {
+            m_kernel_tuners.wpt1 = value;
+        }
+    }
+}
+
 std::vector<size_t> OpenCL::get_sgemm_tuners(void) {
     std::vector<size_t> tuners;
 
@@ -1111,14 +1306,21 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
     m_context = context;
     m_device = best_device;
 
+    // Two contexts let a GPU run one forward pass while the next is being
+    // uploaded or the last one read back. A CPU device already uses all
+    // its cores for one pass.
+    if (cfg_gpu_contexts > 0) {
+        m_max_contexts = cfg_gpu_contexts;
+    } else if (best_device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU) {
+        m_max_contexts = 1;
+    } else {
+        m_max_contexts = 2;
+    }
+    myprintf("Execution contexts: %zu\n", m_max_contexts);
+
     // Make program of the source code in the context
     try {
-        m_program = cl::Program(m_context,
-                                  sourceCode_config
-                                + sourceCode_convolve1
-                                + sourceCode_convolve3
-                                + sourceCode_sgemm
-                                + sourceCode_sgemv);
+        m_program = cl::Program(m_context, get_program_source());
     } catch (const cl::Error &e) {
         myprintf("Error getting kernels: %s: %d", e.what(), e.err());
         throw std::runtime_error("Error getting OpenCL kernels.");
@@ -1129,6 +1331,8 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
     auto t = Tuner(*this, m_context, m_device);
     auto sgemm_tuners =
         t.load_sgemm_tuners(channels, WINOGRAD_P, channels, WINOGRAD_TILE);
+    // One position per forward pass.
+    auto kernel_tuners = t.load_kernel_tuners(channels, 1);
 
     // Exit immediately after tuning. Some NVIDIA drivers are buggy
     // and will fail to compile the rest of the kernels after a tuning
@@ -1141,6 +1345,7 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
     try {
         std::string args = cl_args;
         args += sgemm_tuners;
+        args += kernel_tuners;
         m_program.build(args.c_str());
     } catch (const cl::Error&) {
         myprintf("Error building kernels: %s\n",
@@ -1148,12 +1353,12 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
         throw std::runtime_error("Error building OpenCL kernels.");
     }
 
-    ensure_thread_initialized();
     process_tuners(sgemm_tuners);
+    process_kernel_tuners(kernel_tuners);
 
     m_wavefront_size =
-        opencl_thread_data.m_sgemm_kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(
-            best_device);
+        cl::Kernel(m_program, "XgemmBatched").getWorkGroupInfo<
+            CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(best_device);
     myprintf("Wavefront/Warp size: %d\n", m_wavefront_size);
 
     m_max_workgroup_size = best_device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
@@ -1169,6 +1374,15 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
     m_init_ok = true;
 }
 
+std::string OpenCL::get_program_source() {
+    return sourceCode_config
+         + sourceCode_convolve1
+         + sourceCode_expand_planes
+         + sourceCode_convolve3
+         + sourceCode_sgemm
+         + sourceCode_sgemv;
+}
+
 std::string OpenCL::get_device_name() {
     std::stringstream ss;
 
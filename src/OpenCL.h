@@ -26,9 +26,11 @@
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include <CL/cl2.hpp>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
+#include <condition_variable>
 #include <mutex>
 
 #include "Tuner.h"
@@ -53,11 +55,14 @@ private:
     std::vector<cl::Buffer> weights;
 };
 
-class ThreadData {
-    friend class OpenCL;
+// What one forward pass needs for itself on the device: a command queue,
+// the kernels, whose arguments are set per pass, and the work buffers.
+// OpenCL_Network keeps a bounded pool of these for the search threads to
+// share, so device memory and the number of queues do not grow with the
+// number of threads.
+class ExecutionContext {
     friend class OpenCL_Network;
 private:
-    bool m_is_initialized{false};
     cl::CommandQueue m_commandqueue;
     cl::Kernel m_convolve1_kernel;
     cl::Kernel m_merge_kernel;
@@ -66,13 +71,15 @@ private:
     cl::Kernel m_sgemv_kernel;
     cl::Kernel m_out_transform_bn_kernel;
     cl::Kernel m_out_transform_bn_in_kernel;
+    cl::Kernel m_expand_planes_kernel;
     cl::Buffer m_inBuffer;
     cl::Buffer m_inBuffer2;
     cl::Buffer m_VBuffer;
     cl::Buffer m_MBuffer;
     cl::Buffer m_pinnedOutBuffer_pol;
     cl::Buffer m_pinnedOutBuffer_val;
-    bool m_buffers_allocated{false};
+    cl::Buffer m_maskBuffer;
+    cl::Buffer m_valueBuffer;
 };
 
 class OpenCL_Network {
@@ -171,16 +178,39 @@ public:
     void forward(const std::vector<net_t>& input,
             std::vector<net_t>& output_pol,
             std::vector<net_t>& output_val);
+    // Same, but with the input packed as a mask of the set squares and
+    // the value they are set to, per plane. The planes are expanded on the
+    // device, so only 12 bytes per plane are uploaded instead of 256.
+    void forward(const std::vector<std::uint64_t>& input_masks,
+            const std::vector<float>& input_values,
+            std::vector<net_t>& output_pol,
+            std::vector<net_t>& output_val);
 
 private:
     using weight_slice_t = std::vector<cl::Buffer>::const_iterator;
+    // Holds a context from the pool for one forward pass.
+    class ContextLease;
+
+    std::unique_ptr<ExecutionContext> create_context();
+    // Check out a context, creating it if the pool is not full yet, or
+    // waiting until another thread returns one.
+    ExecutionContext& acquire_context();
+    void release_context(ExecutionContext& context);
+    // Runs the network on the input in the context's m_inBuffer.
+    void forward_layers(ExecutionContext& context,
+                        std::vector<net_t>& output_pol,
+                        std::vector<net_t>& output_val);
+    void expand_planes(ExecutionContext& context,
+                       const std::vector<std::uint64_t>& input_masks,
+                       const std::vector<float>& input_values);
 
     void push_weights(size_t layer, const std::vector<float>& weights) {
         add_weights(layer, weights.size(), weights.data());
     }
     void add_weights(size_t layer, size_t size, const float* weights);
 
-    void convolve3(int channels, int outputs,
+    void convolve3(ExecutionContext& context,
+                    int channels, int outputs,
                     cl::Buffer& bufferIn,
                     cl::Buffer& bufferOut,
                     cl::Buffer& bufferV,
@@ -190,13 +220,15 @@ private:
                     bool skip_in_transform,
                     bool fuse_in_transform, bool store_inout);
 
-    void convolve1(int channels, int outputs,
+    void convolve1(ExecutionContext& context,
+                  int channels, int outputs,
                   cl::Buffer& bufferInput,
                   cl::Buffer& bufferOutput,
                   cl::Buffer& bufferMerge,
                   weight_slice_t weights);
 
-    void innerproduct(cl::Buffer& input,
+    void innerproduct(ExecutionContext& context,
+                  cl::Buffer& input,
                   weight_slice_t weights,
                   weight_slice_t biases,
                   cl::Buffer& output,
@@ -211,6 +243,14 @@ private:
     // isn't busy wait so it should be better.
     std::mutex m_queue_finish_mutex;
     std::vector<Layer> m_layers;
+
+    std::mutex m_context_mutex;
+    std::condition_variable m_context_cv;
+    // All contexts created so far, at most OpenCL::m_max_contexts.
+    std::vector<std::unique_ptr<ExecutionContext>> m_contexts;
+    std::vector<ExecutionContext*> m_free_contexts;
+    // Contexts being created outside the lock, counted against the limit.
+    size_t m_creating_contexts{0};
 };
 
 class OpenCL {
@@ -219,16 +259,18 @@ class OpenCL {
 public:
     void initialize(const int channels, const std::vector<int> & gpus,
                     bool silent = false);
-    void ensure_thread_initialized(void);
     std::string get_device_name();
 
     std::vector<size_t> get_sgemm_tuners(void);
+    // Source of all kernels, the SGEMM and SGEMV ones included.
+    static std::string get_program_source();
 
     cl::Device m_device;
     cl::Context m_context;
 private:
     void tune_sgemm(void);
     void process_tuners(std::string tuners);
+    void process_kernel_tuners(std::string tuners);
 
     cl::Program m_program;
     std::string m_cl_args;
@@ -239,13 +281,25 @@ private:
         size_t mdimc, ndimc;
     };
     sgemm_tuners m_sgemm_tuners;
+    // Work-group sizes of the other kernels, see Tuner::load_kernel_tuners.
+    // A local size of 0 leaves the choice to the driver. The defaults are
+    // what was used before these were tuned.
+    struct kernel_tuners {
+        size_t in_wg0{0}, in_wg1{0};
+        size_t out_wg0{0}, out_wg1{0};
+        size_t outin_wg0{2};
+        size_t conv1_outg{32};
+        size_t wgs1{64}, wpt1{1};
+    };
+    kernel_tuners m_kernel_tuners;
     size_t m_wavefront_size{0};
+    // Size of the pool of execution contexts, see --gpu-contexts.
+    size_t m_max_contexts{1};
     size_t m_max_workgroup_size{0};
     std::vector<size_t> m_max_workgroup_dims;
     bool m_init_ok{false};
 };
 
-extern thread_local ThreadData opencl_thread_data;
 extern const std::string sourceCode_sgemm;
 
 #endif
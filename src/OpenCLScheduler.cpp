@@ -36,10 +36,6 @@ void OpenCLScheduler::initialize(const int channels) {
             m_opencl.push_back(std::move(opencl));
             m_networks.push_back(std::move(net));
 
-            // Clear thread data on every init call.  We don't know which GPU
-            // this thread will be eventually be assigned to
-            opencl_thread_data = ThreadData();
-
             // starting next GPU, let's not dump full list of GPUs
             silent = true;
         }
@@ -79,4 +75,22 @@ void OpenCLScheduler::forward(const std::vector<net_t>& input,
 
     f.get();
 }
+
+void OpenCLScheduler::forward(const std::vector<std::uint64_t>& input_masks,
+                              const std::vector<float>& input_values,
+                              std::vector<net_t>& output_pol,
+                              std::vector<net_t>& output_val) {
+    if (m_networks.size() == 1) {
+        m_networks[0]->forward(input_masks, input_values, output_pol, output_val);
+        return;
+    }
+
+    auto f = m_threadpool.add_task([this, &input_masks, &input_values,
+                                    &output_pol, &output_val]{
+        m_networks[current_thread_gpu_num]->forward(input_masks, input_values,
+                                                    output_pol, output_val);
+    });
+
+    f.get();
+}
 #endif
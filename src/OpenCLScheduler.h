@@ -35,6 +35,10 @@ public:
     void forward(const std::vector<net_t>& input,
                  std::vector<net_t>& output_pol,
                  std::vector<net_t>& output_val);
+    void forward(const std::vector<std::uint64_t>& input_masks,
+                 const std::vector<float>& input_values,
+                 std::vector<net_t>& output_pol,
+                 std::vector<net_t>& output_val);
 private:
     class ForwardTask {
     public:
@@ -41,9 +41,15 @@ using namespace Utils;
 
 // Configuration flags
 bool cfg_allow_pondering;
+bool cfg_ponder;
+int cfg_ponder_replies;
 bool cfg_noinitialize;
 int cfg_max_threads;
 int cfg_num_threads;
+int cfg_root_trees;
+bool cfg_auto_threads;
+bool cfg_deterministic;
+size_t cfg_max_memory;
 int cfg_max_playouts;
 int cfg_max_visits;
 int cfg_lagbuffer_ms;
@@ -58,23 +64,38 @@ uint64_t cfg_rng_seed;
 std::vector<int> cfg_gpus;
 bool cfg_sgemm_exhaustive;
 bool cfg_tune_only;
+int cfg_gpu_contexts;
 #endif
 float cfg_puct;
 float cfg_softmax_temp;
 float cfg_fpu_reduction;
 bool cfg_fpu_dynamic_eval;
 std::string cfg_weightsfile;
+std::string cfg_small_weightsfile;
+int cfg_small_net_visits;
 std::string cfg_logfile;
 std::string cfg_supervise;
+std::string cfg_transcode;
+std::string cfg_analyze;
 FILE* cfg_logfile_handle;
 bool cfg_quiet;
+bool cfg_startup_profile;
+bool cfg_large_pages;
+bool cfg_chunk_index;
+int cfg_secondary_samples;
 
 void Parameters::setup_default_parameters() {
     cfg_allow_pondering = true;
+    cfg_ponder = false;
+    cfg_ponder_replies = 3;
     cfg_noinitialize = false;
     int num_cpus = std::thread::hardware_concurrency();
     cfg_max_threads = std::max(1, std::min(num_cpus, MAX_CPUS));
     cfg_num_threads = 2;
+    cfg_root_trees = 1;
+    cfg_auto_threads = false;
+    cfg_deterministic = false;
+    cfg_max_memory = 0;
 
     cfg_max_playouts = MAXINT_DIV2;
     cfg_max_visits   = 800;
@@ -83,6 +104,7 @@ void Parameters::setup_default_parameters() {
     cfg_gpus = { };
     cfg_sgemm_exhaustive = false;
     cfg_tune_only = false;
+    cfg_gpu_contexts = 0;
 #endif
     cfg_puct = 0.85f;
     cfg_softmax_temp = 1.0f;
@@ -96,7 +118,13 @@ void Parameters::setup_default_parameters() {
     cfg_timemanage = true;
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
+    cfg_startup_profile = false;
+    cfg_large_pages = false;
+    cfg_chunk_index = false;
+    cfg_secondary_samples = 0;
     cfg_rng_seed = 0;
     cfg_weightsfile = "weights.txt";
+    cfg_small_weightsfile = "";
+    cfg_small_net_visits = 8;
 }
 
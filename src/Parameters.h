@@ -24,9 +24,15 @@
 
 constexpr int MAXINT_DIV2 = std::numeric_limits<int>::max() / 2;
 extern bool cfg_allow_pondering;
+extern bool cfg_ponder;
+extern int cfg_ponder_replies;
 extern bool cfg_noinitialize;
 extern int cfg_max_threads;
 extern int cfg_num_threads;
+extern int cfg_root_trees;
+extern bool cfg_auto_threads;
+extern bool cfg_deterministic;
+extern size_t cfg_max_memory;
 extern int cfg_max_playouts;
 extern int cfg_max_visits;
 extern int cfg_lagbuffer_ms;
@@ -41,6 +47,7 @@ extern uint64_t cfg_rng_seed;
 extern std::vector<int> cfg_gpus;
 extern bool cfg_sgemm_exhaustive;
 extern bool cfg_tune_only;
+extern int cfg_gpu_contexts;
 #endif
 extern float cfg_puct;
 extern float cfg_softmax_temp;
@@ -48,9 +55,17 @@ extern float cfg_fpu_reduction;
 extern bool cfg_fpu_dynamic_eval;
 extern std::string cfg_logfile;
 extern std::string cfg_weightsfile;
+extern std::string cfg_small_weightsfile;
+extern int cfg_small_net_visits;
 extern std::string cfg_supervise;
+extern std::string cfg_transcode;
+extern std::string cfg_analyze;
 extern FILE* cfg_logfile_handle;
 extern bool cfg_quiet;
+extern bool cfg_startup_profile;
+extern bool cfg_large_pages;
+extern bool cfg_chunk_index;
+extern int cfg_secondary_samples;
 
 class Parameters {
 public:
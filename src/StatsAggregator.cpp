@@ -0,0 +1,529 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <zlib.h>
+
+#include "StatsAggregator.h"
+#include "Movegen.h"
+#include "Position.h"
+#include "Training.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+const std::vector<float> StatsAggregator::RESIGN_THRESHOLDS = {
+    0.01f, 0.02f, 0.03f, 0.04f, 0.05f, 0.06f, 0.07f, 0.08f, 0.09f, 0.10f,
+    0.15f, 0.20f, 0.25f, 0.30f, 0.35f, 0.40f, 0.45f, 0.50f
+};
+
+namespace {
+
+// Binary record sizes, see Training::dump_training_v2.
+constexpr auto V2_RECORD_SIZE = 8604;
+constexpr auto V3_RECORD_SIZE = 8276;
+// Lines per record of the text format, see Training::dump_training.
+constexpr auto TEXT_RECORD_LINES = 8 * 14 + 5 + 2 + 1 + 1;
+constexpr auto TEXT_SIDE_TO_MOVE_LINE = 8 * 14 + 4;
+
+// Reads a line without the line end. False at the end of the file.
+bool read_line(gzFile in, std::string& line) {
+    char buff[65536];
+    line.clear();
+    while (gzgets(in, buff, sizeof(buff))) {
+        line.append(buff);
+        if (!line.empty() && line.back() == '\n') {
+            line.pop_back();
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+// Game results from a training chunk, in either format. Secondary
+// samples are skipped, they have no line in the stats chunk.
+class TrainingReader {
+public:
+    explicit TrainingReader(const std::string& name) : m_name(name) {
+        m_in = gzopen(name.c_str(), "rb");
+        if (!m_in) {
+            throw std::runtime_error("Could not open " + name);
+        }
+        gzbuffer(m_in, 1 << 17);
+        unsigned char v[4];
+        if (gzread(m_in, v, sizeof(v)) == int(sizeof(v))) {
+            auto version = (v[0] | v[1] << 8 | v[2] << 16 | v[3] << 24)
+                           & ~Training::SECONDARY_FLAG;
+            if (version == 2) {
+                m_record_size = V2_RECORD_SIZE;
+            } else if (version == 3) {
+                m_record_size = V3_RECORD_SIZE;
+            }
+        }
+        gzrewind(m_in);
+        m_record.resize(m_record_size);
+    }
+
+    ~TrainingReader() {
+        gzclose(m_in);
+    }
+
+    // Result for the side to move of the next record. False at the end.
+    bool next(int& result, bool& black_to_move) {
+        return m_record_size ? next_binary(result, black_to_move)
+                             : next_text(result, black_to_move);
+    }
+
+private:
+    bool next_binary(int& result, bool& black_to_move) {
+        for (;;) {
+            auto n = gzread(m_in, &m_record[0], m_record_size);
+            if (n == 0) {
+                return false;
+            }
+            if (n != m_record_size) {
+                throw std::runtime_error("Truncated record in " + m_name);
+            }
+            if (static_cast<unsigned char>(m_record[1]) & 1) {
+                // SECONDARY_FLAG is bit 8 of the little endian version.
+                continue;
+            }
+            // The last bytes are side to move, rule 50, move count and
+            // the result.
+            black_to_move = m_record[m_record_size - 4] != 0;
+            result = static_cast<std::int8_t>(m_record[m_record_size - 1]);
+            return true;
+        }
+    }
+
+    bool next_text(int& result, bool& black_to_move) {
+        for (auto i = 0; i < TEXT_RECORD_LINES; i++) {
+            if (!read_line(m_in, m_line)) {
+                if (i == 0) {
+                    return false;
+                }
+                throw std::runtime_error("Truncated record in " + m_name);
+            }
+            if (i == TEXT_SIDE_TO_MOVE_LINE) {
+                black_to_move = m_line == "1";
+            }
+        }
+        result = std::atoi(m_line.c_str());
+        return true;
+    }
+
+    std::string m_name;
+    gzFile m_in;
+    int m_record_size{0};
+    std::string m_record;
+    std::string m_line;
+};
+
+bool is_result(const std::string& token) {
+    return token == "1-0" || token == "0-1" || token == "1/2-1/2"
+        || token == "*";
+}
+
+// san_to_move asserts on anything that doesn't start like a move.
+bool looks_like_san(const std::string& token) {
+    return (token[0] >= 'a' && token[0] <= 'h')
+        || std::strchr("NBRQKO0o", token[0]) != nullptr;
+}
+
+} // namespace
+
+const char* StatsAggregator::termination_name(int t) {
+    switch (t) {
+        case CHECKMATE:             return "checkmate";
+        case STALEMATE:             return "stalemate";
+        case INSUFFICIENT_MATERIAL: return "no material";
+        case REPETITION:            return "3-fold";
+        case FIFTY_MOVES:           return "50-move";
+        default:                    return "other";
+    }
+}
+
+void StatsAggregator::add_game(const std::vector<MoveStats>& moves) {
+    m_stats_games++;
+    m_stats_moves += moves.size();
+
+    // The first move where the search rates the position below the
+    // threshold is where the side to move would have resigned.
+    for (auto t = size_t{0}; t < RESIGN_THRESHOLDS.size(); t++) {
+        for (auto i = size_t{0}; i < moves.size(); i++) {
+            if (moves[i].child_uct_winrate < RESIGN_THRESHOLDS[t]) {
+                auto& counts = m_resign[t];
+                counts.resigned++;
+                if (moves[i].result != -1) {
+                    counts.false_positives++;
+                }
+                counts.plies_saved += moves.size() - i;
+                break;
+            }
+        }
+    }
+
+    auto bin = [](float winrate) {
+        return std::min(CALIBRATION_BINS - 1,
+                        std::max(0, int(winrate * CALIBRATION_BINS)));
+    };
+    for (const auto& move : moves) {
+        auto score = (move.result + 1) / 2.0;
+        auto& net = m_net_calibration[bin(move.net_winrate)];
+        net.count++;
+        net.score += score;
+        auto& uct = m_uct_calibration[bin(move.child_uct_winrate)];
+        uct.count++;
+        uct.score += score;
+    }
+}
+
+void StatsAggregator::add_stats_chunk(const std::string& stats_name,
+                                      const std::string& training_name) {
+    auto in = gzopen(stats_name.c_str(), "rb");
+    if (!in) {
+        throw std::runtime_error("Could not open " + stats_name);
+    }
+    auto training = TrainingReader{training_name};
+    auto moves = std::vector<MoveStats>{};
+    auto line = std::string{};
+    auto ok = true;
+    while (ok && read_line(in, line)) {
+        // Every game starts with the format version.
+        if (line.find(' ') == std::string::npos) {
+            if (!moves.empty()) {
+                add_game(moves);
+                moves.clear();
+            }
+            ok = line == "1";
+            continue;
+        }
+        auto move = MoveStats{};
+        auto black_to_move = false;
+        auto ss = std::istringstream{line};
+        auto root_uct_winrate = 0.0f;
+        auto bestmove_visits = 0;
+        ss >> move.net_winrate >> root_uct_winrate
+           >> move.child_uct_winrate >> bestmove_visits;
+        ok = !ss.fail() && training.next(move.result, black_to_move);
+        moves.emplace_back(move);
+    }
+    gzclose(in);
+    if (!ok) {
+        // Don't count a game whose moves don't match the training data.
+        m_stats_errors++;
+        return;
+    }
+    if (!moves.empty()) {
+        add_game(moves);
+    }
+}
+
+void StatsAggregator::add_pgn_moves(const std::vector<std::string>& tokens) {
+    auto bh = BoardHistory{};
+    bh.set(Position::StartFEN);
+    auto in_comment = false;
+    for (auto token : tokens) {
+        if (in_comment || token[0] == '{') {
+            in_comment = token.back() != '}';
+            continue;
+        }
+        if (is_result(token)) {
+            continue;
+        }
+        // Move numbers, also when written against the move ("1.e4").
+        auto dot = token.find_last_of('.');
+        if (dot != std::string::npos) {
+            token = token.substr(dot + 1);
+        }
+        if (token.empty()) {
+            continue;
+        }
+        auto move = looks_like_san(token) ? bh.cur().san_to_move(token)
+                                          : MOVE_NONE;
+        if (move == MOVE_NONE) {
+            m_pgn_errors++;
+            return;
+        }
+        bh.do_move(move);
+    }
+
+    const auto& pos = bh.cur();
+    auto termination = OTHER;
+    if (MoveList<LEGAL>(pos).size() == 0) {
+        if (pos.checkers()) {
+            termination = CHECKMATE;
+            if (pos.side_to_move() == WHITE) {
+                m_black_wins++;
+            } else {
+                m_white_wins++;
+            }
+        } else {
+            termination = STALEMATE;
+        }
+    } else if (pos.repetitions_count() >= 2) {
+        termination = REPETITION;
+    } else if (pos.rule50_count() >= 100) {
+        termination = FIFTY_MOVES;
+    } else if (pos.is_draw()) {
+        // The only draw left is insufficient material.
+        termination = INSUFFICIENT_MATERIAL;
+    }
+
+    auto plies = bh.positions.size() - 1;
+    m_pgn_games++;
+    m_total_plies += plies;
+    m_terminations[termination]++;
+    auto bin = std::min(plies / PLY_BIN, m_length_histogram.size() - 1);
+    m_length_histogram[bin][termination]++;
+}
+
+void StatsAggregator::add_log(const std::string& name) {
+    // gzopen reads uncompressed files as they are.
+    auto in = gzopen(name.c_str(), "rb");
+    if (!in) {
+        throw std::runtime_error("Could not open " + name);
+    }
+    // Self-play logs have the moves between "PGN" and "END" lines. In PGN
+    // files they follow the tags, up to an empty line.
+    auto tokens = std::vector<std::string>{};
+    auto in_game = false;
+    auto line = std::string{};
+    auto token = std::string{};
+    while (read_line(in, line)) {
+        if (line == "PGN" || line.compare(0, 6, "[Event") == 0) {
+            in_game = true;
+            tokens.clear();
+            continue;
+        }
+        if (!in_game || line[0] == '[') {
+            continue;
+        }
+        if (line == "END" || (line.empty() && !tokens.empty())) {
+            in_game = false;
+            add_pgn_moves(tokens);
+            continue;
+        }
+        auto ss = std::istringstream{line};
+        while (ss >> token) {
+            tokens.emplace_back(token);
+        }
+    }
+    if (in_game && !tokens.empty()) {
+        add_pgn_moves(tokens);
+    }
+    gzclose(in);
+}
+
+void StatsAggregator::merge(const StatsAggregator& other) {
+    m_stats_games += other.m_stats_games;
+    m_stats_moves += other.m_stats_moves;
+    m_stats_errors += other.m_stats_errors;
+    for (auto t = size_t{0}; t < m_resign.size(); t++) {
+        m_resign[t].resigned += other.m_resign[t].resigned;
+        m_resign[t].false_positives += other.m_resign[t].false_positives;
+        m_resign[t].plies_saved += other.m_resign[t].plies_saved;
+    }
+    for (auto b = 0; b < CALIBRATION_BINS; b++) {
+        m_net_calibration[b].count += other.m_net_calibration[b].count;
+        m_net_calibration[b].score += other.m_net_calibration[b].score;
+        m_uct_calibration[b].count += other.m_uct_calibration[b].count;
+        m_uct_calibration[b].score += other.m_uct_calibration[b].score;
+    }
+    m_pgn_games += other.m_pgn_games;
+    m_pgn_errors += other.m_pgn_errors;
+    m_white_wins += other.m_white_wins;
+    m_black_wins += other.m_black_wins;
+    m_total_plies += other.m_total_plies;
+    for (auto t = 0; t < NUM_TERMINATIONS; t++) {
+        m_terminations[t] += other.m_terminations[t];
+        for (auto b = size_t{0}; b < m_length_histogram.size(); b++) {
+            m_length_histogram[b][t] += other.m_length_histogram[b][t];
+        }
+    }
+}
+
+void StatsAggregator::print() const {
+    auto pct = [](double part, double total) {
+        return total > 0.0 ? 100.0 * part / total : 0.0;
+    };
+
+    myprintf_so("Stats chunks: %llu games, %llu moves, %llu chunks did not "
+                "match their training data\n",
+                (unsigned long long)m_stats_games,
+                (unsigned long long)m_stats_moves,
+                (unsigned long long)m_stats_errors);
+    if (m_stats_games > 0) {
+        myprintf_so("Resigning below a search winrate of:\n");
+        myprintf_so("  threshold  resigned  false positives  plies saved\n");
+        for (auto t = size_t{0}; t < m_resign.size(); t++) {
+            const auto& counts = m_resign[t];
+            myprintf_so("  %8.1f%%  %7.2f%%  %14.2f%%  %10.2f%%\n",
+                        100.0 * RESIGN_THRESHOLDS[t],
+                        pct(counts.resigned, m_stats_games),
+                        pct(counts.false_positives, m_stats_games),
+                        pct(counts.plies_saved, m_stats_moves));
+        }
+        myprintf_so("Score of the side to move by winrate:\n");
+        myprintf_so("    winrate    net moves  score    uct moves  score\n");
+        for (auto b = 0; b < CALIBRATION_BINS; b++) {
+            const auto& net = m_net_calibration[b];
+            const auto& uct = m_uct_calibration[b];
+            myprintf_so("  %3d-%3d%%  %11llu  %5.3f  %11llu  %5.3f\n",
+                        100 * b / CALIBRATION_BINS,
+                        100 * (b + 1) / CALIBRATION_BINS,
+                        (unsigned long long)net.count,
+                        net.count ? net.score / net.count : 0.0,
+                        (unsigned long long)uct.count,
+                        uct.count ? uct.score / uct.count : 0.0);
+        }
+    }
+
+    myprintf_so("Games: %llu, %llu could not be parsed\n",
+                (unsigned long long)m_pgn_games,
+                (unsigned long long)m_pgn_errors);
+    if (m_pgn_games > 0) {
+        myprintf_so("  average length %.1f plies, white mates %.2f%%, "
+                    "black mates %.2f%%\n",
+                    double(m_total_plies) / m_pgn_games,
+                    pct(m_white_wins, m_pgn_games),
+                    pct(m_black_wins, m_pgn_games));
+        auto header = std::string{"    plies"};
+        for (auto t = 0; t < NUM_TERMINATIONS; t++) {
+            char buff[32];
+            std::snprintf(buff, sizeof(buff), " %11s", termination_name(t));
+            header += buff;
+        }
+        myprintf_so("%s\n", header.c_str());
+        for (auto b = size_t{0}; b < m_length_histogram.size(); b++) {
+            const auto& bin = m_length_histogram[b];
+            if (std::all_of(begin(bin), end(bin),
+                            [](std::uint64_t n) { return n == 0; })) {
+                continue;
+            }
+            char buff[32];
+            if (b + 1 < m_length_histogram.size()) {
+                std::snprintf(buff, sizeof(buff), "  %3zu-%3zu",
+                              b * PLY_BIN, (b + 1) * PLY_BIN - 1);
+            } else {
+                std::snprintf(buff, sizeof(buff), "     %3zu+", b * PLY_BIN);
+            }
+            auto row = std::string{buff};
+            for (auto t = 0; t < NUM_TERMINATIONS; t++) {
+                std::snprintf(buff, sizeof(buff), " %11llu",
+                              (unsigned long long)bin[t]);
+                row += buff;
+            }
+            myprintf_so("%s\n", row.c_str());
+        }
+        auto row = std::string{"    total"};
+        for (auto t = 0; t < NUM_TERMINATIONS; t++) {
+            char buff[32];
+            std::snprintf(buff, sizeof(buff), " %10.2f%%",
+                          pct(m_terminations[t], m_pgn_games));
+            row += buff;
+        }
+        myprintf_so("%s\n", row.c_str());
+    }
+}
+
+void StatsAggregator::analyze(const std::string& dir) {
+    namespace fs = boost::filesystem;
+
+    // Stats chunks are named like their training chunk with ".debug"
+    // inserted, training.debug.0.gz for training.0.gz.
+    auto stats_chunks = std::vector<std::pair<fs::path, fs::path>>{};
+    auto logs = std::vector<fs::path>{};
+    for (const auto& entry : fs::recursive_directory_iterator(dir)) {
+        const auto& path = entry.path();
+        if (!fs::is_regular_file(path)) {
+            continue;
+        }
+        auto name = path.filename().string();
+        auto debug = name.find(".debug");
+        if (debug != std::string::npos && path.extension() == ".gz") {
+            auto training = path.parent_path() / name.erase(debug, 6);
+            if (fs::exists(training)) {
+                stats_chunks.emplace_back(path, training);
+            } else {
+                myprintf_so("No training chunk for %s\n", path.c_str());
+            }
+            continue;
+        }
+        auto stem = path.extension() == ".gz" ? path.stem() : path;
+        auto ext = stem.extension();
+        if (ext == ".log" || ext == ".pgn" || ext == ".txt") {
+            logs.emplace_back(path);
+        }
+    }
+    myprintf_so("Reading %zu stats chunks and %zu logs\n",
+                stats_chunks.size(), logs.size());
+
+    const auto start = std::chrono::steady_clock::now();
+    auto total = StatsAggregator{};
+    std::mutex mutex;
+    auto merge_result = [&](const StatsAggregator& result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        total.merge(result);
+    };
+
+    ThreadGroup tg(thread_pool);
+    for (const auto& chunk : stats_chunks) {
+        tg.add_task([&, chunk]() {
+            auto result = StatsAggregator{};
+            try {
+                result.add_stats_chunk(chunk.first.string(),
+                                       chunk.second.string());
+            } catch (const std::exception& e) {
+                myprintf_so("%s\n", e.what());
+                result.m_stats_errors++;
+            }
+            merge_result(result);
+        });
+    }
+    for (const auto& log : logs) {
+        tg.add_task([&, log]() {
+            auto result = StatsAggregator{};
+            try {
+                result.add_log(log.string());
+            } catch (const std::exception& e) {
+                myprintf_so("%s\n", e.what());
+            }
+            merge_result(result);
+        });
+    }
+    tg.wait_all();
+
+    total.print();
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    myprintf_so("Done in %.1f s\n", elapsed);
+}
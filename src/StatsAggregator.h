@@ -0,0 +1,118 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATSAGGREGATOR_H_INCLUDED
+#define STATSAGGREGATOR_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Summarizes self-play data, what scripts/resign_analysis and
+// scripts/stats did in Python:
+//
+// - Stats chunks (Training::dump_stats, named like the training chunk
+//   with ".debug" inserted, as in training.debug.3.gz for training.3.gz)
+//   are read together with their training chunk, which has the game
+//   results. From those come the resign false positive rates for a range
+//   of thresholds, and how well the network and search winrates predict
+//   the result.
+// - Self-play logs (the "PGN ... END" blocks the engine prints) and PGN
+//   files give the game lengths and how the games ended.
+//
+// Files are read as streams, one file per thread pool task, and the
+// per-file results are merged at the end.
+class StatsAggregator {
+public:
+    // Per move of a game in a stats chunk, from the side to move's view.
+    struct MoveStats {
+        float net_winrate;
+        float child_uct_winrate;
+        // 1 win, 0 draw, -1 loss.
+        int result;
+    };
+
+    // Summarize everything under dir and print it.
+    static void analyze(const std::string& dir);
+
+    void add_stats_chunk(const std::string& stats_name,
+                         const std::string& training_name);
+    void add_log(const std::string& name);
+    void add_game(const std::vector<MoveStats>& moves);
+    void merge(const StatsAggregator& other);
+    void print() const;
+
+    // Resign thresholds of the false positive curve.
+    static const std::vector<float> RESIGN_THRESHOLDS;
+    static constexpr auto CALIBRATION_BINS = 20;
+    static constexpr auto PLY_BIN = 20;
+    static constexpr auto MAX_PLIES = 500;
+
+    struct ResignCounts {
+        std::uint64_t resigned{0};
+        // Resigned, but the side did not lose.
+        std::uint64_t false_positives{0};
+        std::uint64_t plies_saved{0};
+    };
+    // Counts per threshold, same order as RESIGN_THRESHOLDS.
+    const std::vector<ResignCounts>& resign_counts() const {
+        return m_resign;
+    }
+    std::uint64_t stats_games() const { return m_stats_games; }
+
+private:
+    struct Calibration {
+        std::uint64_t count{0};
+        double score{0.0};
+    };
+    enum Termination {
+        CHECKMATE,
+        STALEMATE,
+        INSUFFICIENT_MATERIAL,
+        REPETITION,
+        FIFTY_MOVES,
+        // Move limit, resignation or unknown.
+        OTHER,
+        NUM_TERMINATIONS
+    };
+    static const char* termination_name(int t);
+    void add_pgn_moves(const std::vector<std::string>& tokens);
+
+    std::uint64_t m_stats_games{0};
+    std::uint64_t m_stats_moves{0};
+    std::uint64_t m_stats_errors{0};
+    std::vector<ResignCounts> m_resign{
+        std::vector<ResignCounts>(RESIGN_THRESHOLDS.size())};
+    std::array<Calibration, CALIBRATION_BINS> m_net_calibration{};
+    std::array<Calibration, CALIBRATION_BINS> m_uct_calibration{};
+
+    std::uint64_t m_pgn_games{0};
+    std::uint64_t m_pgn_errors{0};
+    std::uint64_t m_white_wins{0};
+    std::uint64_t m_black_wins{0};
+    std::uint64_t m_total_plies{0};
+    std::array<std::uint64_t, NUM_TERMINATIONS> m_terminations{};
+    // Games per PLY_BIN plies, the last bin includes longer games.
+    std::array<std::array<std::uint64_t, NUM_TERMINATIONS>,
+               MAX_PLIES / PLY_BIN + 1> m_length_histogram{};
+};
+
+#endif
@@ -29,12 +29,16 @@
 #include "string.h"
 
 #include "Training.h"
+#include "Parameters.h"
+#include "MemStats.h"
 #include "UCTNode.h"
 #include "Random.h"
 #include "Utils.h"
 #include "UCTSearch.h"
 
 std::vector<TimeStep> Training::m_data{};
+std::unordered_map<Key, Training::Recorded> Training::m_recorded{};
+size_t Training::m_data_bytes{0};
 
 std::string OutputChunker::gen_chunk_name(void) const {
     auto base = std::string{m_basename};
@@ -45,21 +49,42 @@ std::string OutputChunker::gen_chunk_name(void) const {
 OutputChunker::OutputChunker(const std::string& basename,
                              bool compress,
                              size_t num_games)
-    : m_basename(basename), m_compress(compress), m_games_per_chunk(num_games) {
+    : m_basename(basename), m_compress(compress),
+      m_write_index(compress && cfg_chunk_index),
+      m_games_per_chunk(num_games) {
     namespace fs = boost::filesystem;
+    // Don't count the chunk indexes.
     m_chunk_count = std::count_if(
         fs::directory_iterator(fs::path(basename).parent_path()),
         fs::directory_iterator(),
-        static_cast<bool(*)(const fs::path&)>(fs::is_regular_file));
+        [](const fs::path& p) {
+            return fs::is_regular_file(p) && p.extension() != ".idx";
+        });
     Utils::myprintf("Found %d existing chunks in %s\n", m_chunk_count, basename.c_str());
 }
 
 OutputChunker::~OutputChunker() {
     flush_chunk();
+    MemStats::sub(MemStats::TRAINING, m_buffer_bytes);
 }
 
-void OutputChunker::append(const std::string& str) {
+void OutputChunker::account_memory() {
+    const auto bytes = m_buffer.capacity();
+    MemStats::add(MemStats::TRAINING, bytes);
+    MemStats::sub(MemStats::TRAINING, m_buffer_bytes);
+    m_buffer_bytes = bytes;
+}
+
+void OutputChunker::append(const std::string& str,
+                           const std::vector<size_t>& record_offsets) {
+    if (m_write_index && !record_offsets.empty()) {
+        m_game_starts.emplace_back(m_record_offsets.size());
+        for (auto offset : record_offsets) {
+            m_record_offsets.emplace_back(m_buffer.size() + offset);
+        }
+    }
     m_buffer.append(str);
+    account_memory();
     m_game_count++;
     if (m_game_count >= m_games_per_chunk) {
         flush_chunk();
@@ -74,14 +99,21 @@ void OutputChunker::flush_chunk() {
     if (m_compress) {
         auto chunk_name = gen_chunk_name();
         auto out = gzopen(chunk_name.c_str(), "wb9");
+        if (!out) {
+            throw std::runtime_error("Could not open " + chunk_name);
+        }
 
-        auto in_buff_size = m_buffer.size();
-        auto in_buff = std::make_unique<char[]>(in_buff_size);
-        memcpy(in_buff.get(), m_buffer.data(), in_buff_size);
+        if (m_write_index) {
+            write_indexed_chunk(out, chunk_name);
+        } else {
+            auto in_buff_size = m_buffer.size();
+            auto in_buff = std::make_unique<char[]>(in_buff_size);
+            memcpy(in_buff.get(), m_buffer.data(), in_buff_size);
 
-        auto comp_size = gzwrite(out, in_buff.get(), in_buff_size);
-        if (!comp_size) {
-            throw std::runtime_error("Error in gzip output");
+            auto comp_size = gzwrite(out, in_buff.get(), in_buff_size);
+            if (!comp_size) {
+                throw std::runtime_error("Error in gzip output");
+            }
         }
         Utils::myprintf("Writing chunk %d\n",  m_chunk_count);
         gzclose(out);
@@ -94,12 +126,163 @@ void OutputChunker::flush_chunk() {
     }
 
     m_buffer.clear();
+    m_record_offsets.clear();
+    m_game_starts.clear();
     m_chunk_count++;
     m_game_count = 0;
 }
 
+void OutputChunker::write_indexed_chunk(gzFile out, const std::string& chunk_name) {
+    auto restarts = std::vector<std::pair<size_t, z_off_t>>{};
+    auto written = size_t{0};
+    auto write_until = [&](size_t end) {
+        if (end > written) {
+            auto size = static_cast<unsigned>(end - written);
+            if (gzwrite(out, m_buffer.data() + written, size) != int(size)) {
+                throw std::runtime_error("Error in gzip output");
+            }
+            written = end;
+        }
+    };
+    // A full flush byte-aligns the output and resets the dictionary, so
+    // raw inflate can start right after it. The first one also pushes out
+    // the gzip header, so even the first restart point is plain deflate.
+    auto restart = [&]() {
+        if (gzflush(out, Z_FULL_FLUSH) != Z_OK) {
+            throw std::runtime_error("Error in gzip output");
+        }
+        restarts.emplace_back(written, gzoffset(out));
+    };
+
+    auto next_game = size_t{0};
+    auto last_restart = size_t{0};
+    for (auto i = size_t{0}; i < m_record_offsets.size(); i++) {
+        auto game_start = next_game < m_game_starts.size()
+                          && m_game_starts[next_game] == i;
+        if (game_start) {
+            next_game++;
+        }
+        if (i == 0 || game_start || i - last_restart >= RECORDS_PER_RESTART) {
+            write_until(m_record_offsets[i]);
+            restart();
+            last_restart = i;
+        }
+    }
+    write_until(m_buffer.size());
+
+    auto index = std::ofstream{chunk_name + ".idx"};
+    index << "1" << std::endl; // Index format version 1
+    index << m_buffer.size() << " " << m_record_offsets.size()
+          << " " << m_game_starts.size() << " " << restarts.size() << std::endl;
+    for (auto offset : m_record_offsets) {
+        index << offset << std::endl;
+    }
+    for (auto game_start : m_game_starts) {
+        index << game_start << std::endl;
+    }
+    for (const auto& restart : restarts) {
+        index << restart.first << " " << restart.second << std::endl;
+    }
+    if (!index) {
+        throw std::runtime_error("Error writing " + chunk_name + ".idx");
+    }
+}
+
+ChunkIndex::ChunkIndex(const std::string& chunk_name)
+    : m_chunk_name(chunk_name) {
+    auto in = std::ifstream{chunk_name + ".idx"};
+    auto version = 0;
+    auto num_records = size_t{0};
+    auto num_games = size_t{0};
+    auto num_restarts = size_t{0};
+    in >> version >> m_size >> num_records >> num_games >> num_restarts;
+    if (!in || version != 1) {
+        throw std::runtime_error("Bad chunk index for " + chunk_name);
+    }
+    m_record_offsets.resize(num_records);
+    for (auto& offset : m_record_offsets) {
+        in >> offset;
+    }
+    m_game_starts.resize(num_games);
+    for (auto& game_start : m_game_starts) {
+        in >> game_start;
+    }
+    m_restarts.resize(num_restarts);
+    for (auto& restart : m_restarts) {
+        in >> restart.offset >> restart.compressed_offset;
+    }
+    if (!in || m_restarts.empty() || m_restarts[0].offset != 0) {
+        throw std::runtime_error("Bad chunk index for " + chunk_name);
+    }
+}
+
+std::string ChunkIndex::read_record(size_t record) const {
+    assert(record < num_records());
+    auto first = m_record_offsets[record];
+    auto last = record + 1 < num_records() ? m_record_offsets[record + 1] : m_size;
+    // Last restart point at or before the record.
+    auto restart = std::upper_bound(
+        begin(m_restarts), end(m_restarts), first,
+        [](size_t offset, const RestartPoint& r) { return offset < r.offset; });
+    --restart;
+
+    auto file = std::ifstream{m_chunk_name, std::ios::binary};
+    file.seekg(restart->compressed_offset);
+
+    z_stream strm{};
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+        throw std::runtime_error("inflateInit failed");
+    }
+    auto result = std::string{};
+    auto pos = restart->offset;
+    char in_buff[16384];
+    char out_buff[16384];
+    auto ret = Z_OK;
+    while (pos < last && ret != Z_STREAM_END) {
+        if (strm.avail_in == 0) {
+            file.read(in_buff, sizeof(in_buff));
+            strm.avail_in = file.gcount();
+            strm.next_in = reinterpret_cast<Bytef*>(in_buff);
+            if (strm.avail_in == 0) {
+                break;
+            }
+        }
+        strm.avail_out = sizeof(out_buff);
+        strm.next_out = reinterpret_cast<Bytef*>(out_buff);
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            break;
+        }
+        auto produced = sizeof(out_buff) - strm.avail_out;
+        // Keep the part of [pos, pos + produced) which is in [first, last).
+        auto from = std::max(pos, first);
+        auto to = std::min(pos + produced, last);
+        if (from < to) {
+            result.append(out_buff + (from - pos), to - from);
+        }
+        pos += produced;
+    }
+    inflateEnd(&strm);
+    if (result.size() != last - first) {
+        throw std::runtime_error("Error reading record from " + m_chunk_name);
+    }
+    return result;
+}
+
 void Training::clear_training() {
     Training::m_data.clear();
+    Training::m_recorded.clear();
+    account_memory();
+}
+
+void Training::account_memory() {
+    auto bytes = m_data.capacity() * sizeof(TimeStep);
+    for (const auto& step : m_data) {
+        bytes += step.probabilities.capacity() * sizeof(float);
+    }
+    MemStats::add(MemStats::TRAINING, bytes);
+    MemStats::sub(MemStats::TRAINING, m_data_bytes);
+    m_data_bytes = bytes;
 }
 
 // Used by supervised learning
@@ -134,13 +317,85 @@ void Training::record(const BoardHistory& state, UCTNode& root) {
     step.child_uct_winrate = best_node.get_eval(step.to_move);
     step.bestmove_visits = best_node.get_visits();
 
+    if (!fill_probabilities(state, root, step)) {
+        return;
+    }
+
+    const auto key = state.cur().full_key();
+    auto recorded = m_recorded.find(key);
+    if (recorded != m_recorded.end() && recorded->second.secondary) {
+        // Recorded from the tree of an earlier move, with fewer visits.
+        const auto index = recorded->second.index;
+        m_data.erase(begin(m_data) + index);
+        for (auto& entry : m_recorded) {
+            if (entry.second.index > index) {
+                entry.second.index--;
+            }
+        }
+    }
+    m_recorded[key] = Recorded{m_data.size(), root.get_visits(), false};
+    m_data.emplace_back(step);
+
+    if (cfg_secondary_samples > 0) {
+        for (const auto& child : root.get_children()) {
+            if (child.is_inflated()
+                && child.get_visits() >= cfg_secondary_samples) {
+                auto child_state = state.shallow_clone();
+                child_state.do_move(child.get_move());
+                record_secondary(child_state, *child.get());
+            }
+        }
+    }
+    account_memory();
+}
+
+// Internal nodes that got many visits have a policy target about as good
+// as the root's, at no extra network evaluations. Record them too, in
+// preorder, and continue into their children that pass the threshold.
+// They get the result of the game that was actually played.
+void Training::record_secondary(const BoardHistory& state,
+                                const UCTNode& node) {
+    auto step = TimeStep{};
+    step.to_move = state.cur().side_to_move();
+    step.planes = Network::NNPlanes{};
+    Network::gather_features(state, step.planes);
+    step.root_uct_winrate = node.get_eval(step.to_move);
+    step.secondary = true;
+
+    if (!fill_probabilities(state, node, step)) {
+        return;
+    }
+    const auto key = state.cur().full_key();
+    const auto visits = node.get_visits();
+    auto recorded = m_recorded.find(key);
+    if (recorded == m_recorded.end()) {
+        m_recorded.emplace(key, Recorded{m_data.size(), visits, true});
+        m_data.emplace_back(step);
+    } else if (recorded->second.secondary
+               && visits > recorded->second.visits) {
+        m_data[recorded->second.index] = step;
+        recorded->second.visits = visits;
+    }
+
+    for (const auto& child : node.get_children()) {
+        if (child.is_inflated()
+            && child.get_visits() >= cfg_secondary_samples) {
+            auto child_state = state.shallow_clone();
+            child_state.do_move(child.get_move());
+            record_secondary(child_state, *child.get());
+        }
+    }
+}
+
+bool Training::fill_probabilities(const BoardHistory& state,
+                                  const UCTNode& node, TimeStep& step) {
     step.probabilities.resize(Network::get_num_output_policy());
 
     // Get total visit amount. We count rather
     // than trust the root to avoid ttable issues.
     auto sum_visits = 0.0;
-    for (const auto& child : root.get_children()) {
-        sum_visits += child->get_visits();
+    for (const auto& child : node.get_children()) {
+        sum_visits += child.get_visits();
     }
 
     // In a terminal position, we can have children, but we will not able to
@@ -148,16 +403,15 @@ void Training::record(const BoardHistory& state, UCTNode& root) {
     // bail immediately. So in this case there will be 0 total visits, and we
     // should not construct the (non-existent) probabilities.
     if (sum_visits <= 0.0) {
-        return;
+        return false;
     }
 
-    for (const auto& child : root.get_children()) {
-        auto prob = static_cast<float>(child->get_visits() / sum_visits);
-        auto move = child->get_move();
+    for (const auto& child : node.get_children()) {
+        auto prob = static_cast<float>(child.get_visits() / sum_visits);
+        auto move = child.get_move();
         step.probabilities[Network::lookup(move, state.cur().side_to_move())] = prob;
     }
-
-    m_data.emplace_back(step);
+    return true;
 }
 
 void Training::dump_training(int game_score, const std::string& out_filename) {
@@ -189,9 +443,12 @@ void Training::dump_training_v2(int game_score, OutputChunker& outchunk) {
     assert(VERSION == 2 || VERSION == 3);
 
     std::stringstream out;
+    auto record_offsets = std::vector<size_t>{};
     for (const auto& step : m_data) {
+        record_offsets.emplace_back(out.tellp());
         // Store the binary version number (4 bytes)
-        out.write(reinterpret_cast<char*>(&VERSION), sizeof(VERSION));
+        auto version = step.secondary ? (VERSION | SECONDARY_FLAG) : VERSION;
+        out.write(reinterpret_cast<char*>(&version), sizeof(version));
 
         // Then the move probabilities
         assert(step.probabilities.size() == Network::get_num_output_policy());
@@ -231,12 +488,18 @@ void Training::dump_training_v2(int game_score, OutputChunker& outchunk) {
     assert(Network::get_format_version() == 1
         ? out.str().size() == m_data.size() * 8604
         : out.str().size() == m_data.size() * 8276);
-    outchunk.append(out.str());
+    outchunk.append(out.str(), record_offsets);
 }
 
 void Training::dump_training(int game_score, OutputChunker& outchunk) {
     std::stringstream out;
+    auto record_offsets = std::vector<size_t>{};
     for (const auto& step : m_data) {
+        // The text format has no way to mark secondary samples.
+        if (step.secondary) {
+            continue;
+        }
+        record_offsets.emplace_back(out.tellp());
         int kFeatureBase = Network::T_HISTORY * 14;
         for (int p = 0; p < kFeatureBase; p++) {
             const auto& plane = step.planes.bit[p];
@@ -267,7 +530,7 @@ void Training::dump_training(int game_score, OutputChunker& outchunk) {
         // And the game result for the side to move
         out << (step.to_move == BLACK ? -game_score : game_score) << std::endl;
     }
-    outchunk.append(out.str());
+    outchunk.append(out.str(), record_offsets);
 }
 
 void Training::dump_stats(const std::string& filename) {
@@ -279,6 +542,10 @@ void Training::dump_stats(OutputChunker& outchunk) {
     std::stringstream out;
     out << "1" << std::endl; // File format version 1
     for (const auto& step : m_data) {
+        // The stats are per move played.
+        if (step.secondary) {
+            continue;
+        }
         out << step.net_winrate
             << " " << step.root_uct_winrate
             << " " << step.child_uct_winrate
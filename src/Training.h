@@ -20,7 +20,10 @@
 #define TRAINING_H_INCLUDED
 
 #include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
+#include <zlib.h>
 
 #include "config.h"
 #include "Network.h"
@@ -35,26 +38,71 @@ public:
     float root_uct_winrate;
     float child_uct_winrate;
     int bestmove_visits;
+    // Sample from an internal search node rather than from a move
+    // that was played. See Training::record_secondary.
+    bool secondary{false};
 };
 
 class OutputChunker {
 public:
     OutputChunker(const std::string& basename, bool compress = false, size_t num_games = NUM_GAMES);
     ~OutputChunker();
-    void append(const std::string& str);
+    // Append one game. record_offsets are the start offsets of the
+    // records within str, they are only needed for the chunk index.
+    void append(const std::string& str,
+                const std::vector<size_t>& record_offsets = {});
 
     // Group this many games in a chunk.
     static constexpr size_t NUM_GAMES = 5;
+    // With an index, the compressor is restarted at least this often,
+    // so reading a record never decompresses more than this many records.
+    static constexpr size_t RECORDS_PER_RESTART = 16;
 private:
     std::string gen_chunk_name() const;
     void flush_chunk();
+    void write_indexed_chunk(gzFile out, const std::string& chunk_name);
+    void account_memory();
 
     size_t m_game_count{0};
     size_t m_chunk_count{0};
     std::string m_buffer;
+    size_t m_buffer_bytes{0};
     std::string m_basename;
     bool m_compress{false};
+    bool m_write_index{false};
     size_t m_games_per_chunk;
+    // Offsets in m_buffer of all records, and the index of the first
+    // record of each game.
+    std::vector<size_t> m_record_offsets;
+    std::vector<size_t> m_game_starts;
+};
+
+// The index OutputChunker writes next to a chunk (chunk name + ".idx").
+// The chunk is a normal gzip file, but the compressor was fully flushed at
+// the restart points, so decompression can start at any of them. This
+// allows reading single records without decompressing the whole chunk.
+class ChunkIndex {
+public:
+    // Throws std::runtime_error if the index is missing or malformed.
+    explicit ChunkIndex(const std::string& chunk_name);
+
+    size_t num_records() const { return m_record_offsets.size(); }
+    size_t num_games() const { return m_game_starts.size(); }
+    // Index of the first record of the game.
+    size_t game_start(size_t game) const { return m_game_starts[game]; }
+    std::string read_record(size_t record) const;
+
+private:
+    struct RestartPoint {
+        size_t offset;             // in the uncompressed data
+        size_t compressed_offset;  // in the file
+    };
+
+    std::string m_chunk_name;
+    size_t m_size{0};
+    std::vector<size_t> m_record_offsets;
+    std::vector<size_t> m_game_starts;
+    std::vector<RestartPoint> m_restarts;
 };
 
 class Training {
@@ -66,10 +114,32 @@ public:
     static void dump_stats(const std::string& out_filename);
     static void record(const BoardHistory& state, Move move);
     static void record(const BoardHistory& state, UCTNode& node);
+    // The samples recorded since clear_training.
+    static const std::vector<TimeStep>& get_data() { return m_data; }
+
+    // Set in the version field of binary records for secondary samples.
+    static constexpr int SECONDARY_FLAG = 0x100;
 
 private:
+    static void record_secondary(const BoardHistory& state,
+                                 const UCTNode& node);
+    static bool fill_probabilities(const BoardHistory& state,
+                                   const UCTNode& node, TimeStep& step);
     static void dump_stats(OutputChunker& outchunker);
+    static void account_memory();
     static std::vector<TimeStep> m_data;
+    static size_t m_data_bytes;
+
+    // With tree reuse, the subtree recorded as secondary samples at one
+    // move is searched again at the next, and its root is recorded as the
+    // primary sample. Each position, by full_key, keeps one sample: the
+    // primary one if it was played, else the one with the most visits.
+    struct Recorded {
+        size_t index;  // in m_data
+        int visits;
+        bool secondary;
+    };
+    static std::unordered_map<Key, Recorded> m_recorded;
 };
 
 #endif
@@ -0,0 +1,341 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <zlib.h>
+
+#include "Transcoder.h"
+#include "Network.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+namespace {
+
+constexpr auto NUM_PLANES = Network::T_HISTORY * Network::V1_HIST_PLANES;
+constexpr auto NUM_PROBABILITIES = Network::V1_NUM_OUTPUT_POLICY;
+
+// Offsets in the binary record, see Training::dump_training_v2.
+constexpr auto PROBABILITIES_OFFSET = size_t{4};
+constexpr auto PLANES_OFFSET = PROBABILITIES_OFFSET + 4 * NUM_PROBABILITIES;
+constexpr auto FLAGS_OFFSET = PLANES_OFFSET + 8 * NUM_PLANES;
+constexpr auto RULE50_OFFSET = FLAGS_OFFSET + 5;
+constexpr auto MOVE_COUNT_OFFSET = RULE50_OFFSET + 1;
+constexpr auto RESULT_OFFSET = MOVE_COUNT_OFFSET + 1;
+static_assert(RESULT_OFFSET + 1 == Transcoder::RECORD_SIZE,
+              "Record layout does not match the record size");
+
+// Reads the text format line by line. Every method consumes exactly what
+// it parses, end_line() the newline.
+class TextParser {
+public:
+    TextParser(const char* text, size_t size)
+        : m_pos(text), m_end(text + size) {}
+
+    bool done() const { return m_pos >= m_end; }
+
+    // dump_training writes a plane as 16 hex digits, the first bit of the
+    // plane in the high bit of the first digit. The binary format stores
+    // the planes with the bit order of every byte reversed, which makes
+    // the bytes exactly what the hex digits spell out, in order.
+    void plane(char* out) {
+        for (auto i = 0; i < 8; i++) {
+            auto hi = hex_digit();
+            auto lo = hex_digit();
+            out[i] = static_cast<char>(hi << 4 | lo);
+        }
+    }
+
+    std::uint8_t flag() {
+        if (m_pos < m_end && (*m_pos == '0' || *m_pos == '1')) {
+            return *m_pos++ - '0';
+        }
+        fail("expected 0 or 1");
+    }
+
+    int integer() {
+        auto negative = m_pos < m_end && *m_pos == '-';
+        if (negative) {
+            m_pos++;
+        }
+        if (m_pos >= m_end || *m_pos < '0' || *m_pos > '9') {
+            fail("expected an integer");
+        }
+        auto value = 0;
+        while (m_pos < m_end && *m_pos >= '0' && *m_pos <= '9') {
+            if (value > 100000000) {
+                fail("integer out of range");
+            }
+            value = value * 10 + (*m_pos++ - '0');
+        }
+        return negative ? -value : value;
+    }
+
+    float probability() {
+        // Most of the policy is zero, don't go through strtof for those.
+        if (m_pos + 1 < m_end && m_pos[0] == '0'
+            && (m_pos[1] == ' ' || m_pos[1] == '\n')) {
+            m_pos++;
+            return 0.0f;
+        }
+        char* end;
+        auto value = std::strtof(m_pos, &end);
+        if (end == m_pos || end > m_end) {
+            fail("expected a probability");
+        }
+        m_pos = end;
+        return value;
+    }
+
+    void space() {
+        expect(' ');
+    }
+
+    void end_line() {
+        expect('\n');
+        m_line++;
+    }
+
+    [[noreturn]] void fail(const char* what) const {
+        throw std::runtime_error("line " + std::to_string(m_line) + ": "
+                                 + what);
+    }
+
+private:
+    int hex_digit() {
+        if (m_pos < m_end) {
+            auto c = *m_pos++;
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        }
+        fail("expected a hex digit");
+    }
+
+    void expect(char c) {
+        if (m_pos >= m_end || *m_pos != c) {
+            fail(c == '\n' ? "expected end of line" : "expected a space");
+        }
+        m_pos++;
+    }
+
+    const char* m_pos;
+    const char* m_end;
+    size_t m_line{1};
+};
+
+std::string read_gz(const std::string& filename) {
+    auto in = gzopen(filename.c_str(), "rb");
+    if (!in) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+    gzbuffer(in, 1 << 17);
+    auto result = std::string{};
+    auto buff = std::vector<char>(1 << 20);
+    auto n = 0;
+    while ((n = gzread(in, buff.data(), buff.size())) > 0) {
+        result.append(buff.data(), n);
+    }
+    // A damaged or truncated file shows up as a read error, or as a
+    // buffer error when closing.
+    auto err = Z_OK;
+    auto msg = std::string{gzerror(in, &err)};
+    auto close_err = gzclose_r(in);
+    if (n < 0 || err != Z_OK || close_err != Z_OK) {
+        // zlib puts the file name in front of the message.
+        throw std::runtime_error("Error reading "
+                                 + (msg.empty() ? filename : msg));
+    }
+    return result;
+}
+
+void write_gz(const std::string& filename, const std::string& data) {
+    auto out = gzopen(filename.c_str(), "wb");
+    if (!out) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+    gzbuffer(out, 1 << 17);
+    auto written = size_t{0};
+    while (written < data.size()) {
+        auto size = static_cast<unsigned>(
+            std::min(data.size() - written, size_t{1} << 20));
+        if (gzwrite(out, data.data() + written, size) != int(size)) {
+            gzclose_w(out);
+            throw std::runtime_error("Error writing " + filename);
+        }
+        written += size;
+    }
+    if (gzclose_w(out) != Z_OK) {
+        throw std::runtime_error("Error writing " + filename);
+    }
+}
+
+} // namespace
+
+size_t Transcoder::transcode_records(const char* text, size_t size,
+                                     std::string& out) {
+    auto parser = TextParser{text, size};
+    auto record = std::array<char, RECORD_SIZE>{};
+    auto records = size_t{0};
+
+    while (!parser.done()) {
+        auto version = htole32(uint32(VERSION));
+        std::memcpy(&record[0], &version, sizeof(version));
+
+        for (auto p = 0; p < NUM_PLANES; p++) {
+            parser.plane(&record[PLANES_OFFSET + 8 * p]);
+            parser.end_line();
+        }
+        for (auto i = 0; i < 5; i++) {
+            record[FLAGS_OFFSET + i] = parser.flag();
+            parser.end_line();
+        }
+        auto rule50 = parser.integer();
+        parser.end_line();
+        auto move_count = parser.integer();
+        parser.end_line();
+        if (rule50 < 0 || move_count < 0) {
+            parser.fail("negative move count");
+        }
+        record[RULE50_OFFSET] = static_cast<char>(std::min(255, rule50));
+        record[MOVE_COUNT_OFFSET] = static_cast<char>(std::min(255, move_count));
+
+        auto sum = 0.0;
+        for (auto i = 0; i < NUM_PROBABILITIES; i++) {
+            if (i > 0) {
+                parser.space();
+            }
+            auto p = parser.probability();
+            if (!(p >= 0.0f && p <= 1.0f)) {
+                parser.fail("probability out of range");
+            }
+            sum += p;
+            uint32 v;
+            std::memcpy(&v, &p, sizeof(v));
+            v = htole32(v);
+            std::memcpy(&record[PROBABILITIES_OFFSET + 4 * i], &v, sizeof(v));
+        }
+        parser.end_line();
+        // The probabilities are written with 6 significant digits.
+        if (std::abs(sum - 1.0) > 0.01) {
+            parser.fail("probabilities do not sum to 1");
+        }
+
+        auto result = parser.integer();
+        parser.end_line();
+        if (result < -1 || result > 1) {
+            parser.fail("result out of range");
+        }
+        record[RESULT_OFFSET] = static_cast<char>(result);
+
+        out.append(record.data(), record.size());
+        records++;
+    }
+    return records;
+}
+
+size_t Transcoder::transcode_file(const std::string& in_name,
+                                  const std::string& out_name) {
+    auto text = read_gz(in_name);
+    auto out = std::string{};
+    // The binary records are a bit larger than the text ones.
+    out.reserve(text.size() + text.size() / 2);
+    auto records = transcode_records(text.data(), text.size(), out);
+
+    // Write under a temporary name and read it back before putting it in
+    // place, so a failed write never leaves a chunk that looks complete.
+    auto tmp_name = out_name + ".tmp";
+    try {
+        write_gz(tmp_name, out);
+        if (read_gz(tmp_name) != out) {
+            throw std::runtime_error("Verification of " + tmp_name + " failed");
+        }
+        boost::filesystem::rename(tmp_name, out_name);
+    } catch (...) {
+        boost::system::error_code ec;
+        boost::filesystem::remove(tmp_name, ec);
+        throw;
+    }
+    return records;
+}
+
+int Transcoder::transcode_dir(const std::string& in_dir,
+                              const std::string& out_dir) {
+    namespace fs = boost::filesystem;
+
+    auto chunks = std::vector<fs::path>{};
+    for (const auto& entry : fs::directory_iterator(in_dir)) {
+        if (fs::is_regular_file(entry.path())
+            && entry.path().extension() == ".gz") {
+            chunks.emplace_back(entry.path());
+        }
+    }
+    std::sort(begin(chunks), end(chunks));
+    fs::create_directories(out_dir);
+    myprintf_so("Transcoding %zu chunks from %s to %s\n",
+                chunks.size(), in_dir.c_str(), out_dir.c_str());
+
+    const auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> total_records{0};
+    std::atomic<int> failed{0};
+
+    ThreadGroup tg(thread_pool);
+    for (const auto& chunk : chunks) {
+        tg.add_task([&, chunk]() {
+            const auto out_name = (fs::path(out_dir) / chunk.filename()).string();
+            const auto name = chunk.filename().string();
+            if (fs::exists(out_name)) {
+                myprintf_so("[%zu/%zu] %s: already done\n",
+                            ++done, chunks.size(), name.c_str());
+                return;
+            }
+            try {
+                auto records = transcode_file(chunk.string(), out_name);
+                total_records += records;
+                myprintf_so("[%zu/%zu] %s: %zu records\n",
+                            ++done, chunks.size(), name.c_str(), records);
+            } catch (const std::exception& e) {
+                failed++;
+                myprintf_so("[%zu/%zu] %s: FAILED, %s\n",
+                            ++done, chunks.size(), name.c_str(), e.what());
+            }
+        });
+    }
+    tg.wait_all();
+
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    myprintf_so("Transcoded %zu records in %.1f s (%.0f records/s), "
+                "%d chunks failed\n",
+                total_records.load(), elapsed,
+                total_records / std::max(elapsed, 1e-3), failed.load());
+    return failed;
+}
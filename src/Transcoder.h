@@ -0,0 +1,56 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRANSCODER_H_INCLUDED
+#define TRANSCODER_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <string>
+
+// Converts training chunks in the text format of Training::dump_training
+// to the binary records Training::dump_training_v2 writes for the same
+// (format 1) networks. The chunks are converted in parallel on the thread
+// pool, one file per task.
+class Transcoder {
+public:
+    // Convert all .gz chunks in in_dir and write them with the same name
+    // to out_dir. Chunks already in out_dir are skipped, so an interrupted
+    // run can be restarted. Returns the number of chunks that failed.
+    static int transcode_dir(const std::string& in_dir,
+                             const std::string& out_dir);
+
+    // Convert one chunk. Throws std::runtime_error on malformed input or
+    // when the written file does not read back the same.
+    static size_t transcode_file(const std::string& in_name,
+                                 const std::string& out_name);
+
+    // Parse the text records in [text, text + size) and append them to
+    // out in binary. text[size] must be readable and not part of a number,
+    // the terminating null of a std::string will do. Returns the number
+    // of records.
+    static size_t transcode_records(const char* text, size_t size,
+                                    std::string& out);
+
+    // Version field and size of the binary records.
+    static constexpr int VERSION = 2;
+    static constexpr size_t RECORD_SIZE = 8604;
+};
+
+#endif
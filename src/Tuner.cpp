@@ -30,6 +30,7 @@
 #include <fstream>
 
 #include "Parameters.h"
+#include "Network.h"
 #include "OpenCL.h"
 #include "Tuner.h"
 #include "Utils.h"
@@ -404,8 +405,339 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
     return best_params;
 }
 
-void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
-                               const int batch_size, std::string tuners) {
+TuneParameters Tuner::tune_kernel(const std::string& name,
+                                  const std::vector<TuneParameters>& candidates,
+                                  const KernelSetup& setup,
+                                  cl::Buffer& output, const size_t output_size,
+                                  const int runs) {
+    auto queue = cl::CommandQueue(m_context,
+                                  m_device,
+                                  CL_QUEUE_PROFILING_ENABLE);
+    auto event = cl::Event();
+    auto zeros = std::vector<float>(output_size);
+    auto result = std::vector<float>(output_size);
+    auto reference = std::vector<float>{};
+
+    myprintf("\nTuning %s, %zu configurations.\n",
+             name.c_str(), candidates.size());
+
+    // The first candidate is the untuned configuration, its output is
+    // the reference the others must match.
+    auto best_params = candidates[0];
+    auto best_time = cl_ulong{0};
+    auto param_counter = size_t{0};
+
+    for (const auto& p : candidates) {
+        param_counter++;
+
+        auto sum = cl_ulong{0};
+        auto max_error = 0.0f;
+        try {
+            auto launch = setup(p);
+            for (auto r = 0; r < runs; r++) {
+                queue.enqueueWriteBuffer(output, CL_FALSE, 0,
+                                         output_size * sizeof(float),
+                                         zeros.data());
+                launch(queue, event);
+                queue.enqueueReadBuffer(output, CL_FALSE, 0,
+                                        output_size * sizeof(float),
+                                        result.data());
+                queue.finish();
+
+                if (reference.empty()) {
+                    reference = result;
+                }
+                auto this_error = 0.0f;
+                for (auto i = size_t{0}; i < output_size; i++) {
+                    auto d = result[i] - reference[i];
+                    this_error += d * d;
+                }
+                max_error = std::max(max_error, this_error / output_size);
+
+                sum += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+                       event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            }
+        } catch (const cl::Error&) {
+            // Invalid work-group size or out of resources, try the next one.
+            if (reference.empty()) {
+                break;
+            }
+            continue;
+        }
+        if (max_error < MAX_ERROR && (best_time == 0 || sum < best_time)) {
+            auto param_str = parameters_to_string(p);
+            myprintf("(%zu/%zu) %s %.4f ms\n",
+                     param_counter, candidates.size(), param_str.c_str(),
+                     1e-6f * (sum / runs));
+            best_time = sum;
+            best_params = p;
+        }
+    }
+    if (reference.empty()) {
+        myprintf_so("Failed to run %s.\nCheck your OpenCL drivers.\n",
+                    name.c_str());
+        throw std::runtime_error("Tuner failed to run " + name + ".");
+    }
+    return best_params;
+}
+
+std::string Tuner::tune_kernels(const int channels, const int runs) {
+    constexpr auto width = 8;
+    constexpr auto height = 8;
+    constexpr auto tiles = WINOGRAD_P;
+    const auto max_wgs = m_device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+    auto program = cl::Program(m_context, OpenCL::get_program_source());
+    program.build(m_opencl.m_cl_args.c_str());
+
+    // Same as OpenCL_Network::convolve3 sizes the transforms with.
+    auto wavefront_size = cl::Kernel(program, "XgemmBatched")
+        .getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(m_device);
+    auto wgs = ceilMultiple(tiles, wavefront_size);
+
+    // Any input works as long as all configurations see the same one.
+    auto make_buffer = [&](const size_t size) {
+        auto data = std::vector<float>(size);
+        for (auto i = size_t{0}; i < size; i++) {
+            data[i] = 0.01f * (int(i * 37 % 200) - 100);
+        }
+        return cl::Buffer(m_context,
+                          CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                          size * sizeof(float), data.data());
+    };
+    auto means = make_buffer(channels);
+    auto stddivs = make_buffer(channels);
+
+    auto v_size = size_t(WINOGRAD_TILE * channels * tiles);
+    auto bufferIn = make_buffer(channels * width * height);
+    auto bufferV = make_buffer(v_size);
+    auto bufferM = make_buffer(v_size);
+    auto bufferOut = make_buffer(channels * width * height);
+
+    auto tuners = TuneParameters{};
+
+    // Winograd input transform, global (tiles, channels).
+    {
+        auto kernel = cl::Kernel(program, "in_transform");
+        auto candidates = std::vector<TuneParameters>{{{"IN_WG0", 0}, {"IN_WG1", 0}}};
+        for (auto wg0 : std::vector<size_t>{16, 32, 64}) {
+            for (auto wg1 : std::vector<size_t>{1, 2, 4, 8}) {
+                if (wg0 * wg1 <= max_wgs && channels % wg1 == 0) {
+                    candidates.push_back({{"IN_WG0", wg0}, {"IN_WG1", wg1}});
+                }
+            }
+        }
+        auto p = tune_kernel("in_transform", candidates,
+            [&](const TuneParameters& p) -> KernelLauncher {
+                kernel.setArg(0, bufferIn);
+                kernel.setArg(1, bufferV);
+                kernel.setArg(2, channels);
+                kernel.setArg(3, channels);
+                kernel.setArg(4, tiles);
+                auto wg0 = p.at("IN_WG0");
+                auto wg1 = p.at("IN_WG1");
+                auto global = cl::NDRange(wgs, channels);
+                auto local = cl::NullRange;
+                if (wg0 != 0) {
+                    global = cl::NDRange(ceilMultiple(tiles, wg0), channels);
+                    local = cl::NDRange(wg0, wg1);
+                }
+                return [&kernel, global, local](cl::CommandQueue& queue,
+                                                cl::Event& event) {
+                    queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                               global, local,
+                                               nullptr, &event);
+                };
+            }, bufferV, v_size, runs);
+        tuners.insert(begin(p), end(p));
+    }
+
+    // Winograd output transform with batchnorm, global (outputs, tiles).
+    {
+        auto kernel = cl::Kernel(program, "out_transform_fused_bn");
+        auto candidates = std::vector<TuneParameters>{{{"OUT_WG0", 0}, {"OUT_WG1", 0}}};
+        for (auto wg0 : std::vector<size_t>{1, 2, 4, 8, 16, 32}) {
+            for (auto wg1 : std::vector<size_t>{16, 32, 64}) {
+                if (wg0 * wg1 <= max_wgs && channels % wg0 == 0) {
+                    candidates.push_back({{"OUT_WG0", wg0}, {"OUT_WG1", wg1}});
+                }
+            }
+        }
+        auto p = tune_kernel("out_transform_fused_bn", candidates,
+            [&](const TuneParameters& p) -> KernelLauncher {
+                kernel.setArg(0, bufferM);
+                kernel.setArg(1, bufferOut);
+                kernel.setArg(2, channels);
+                kernel.setArg(3, channels);
+                kernel.setArg(4, tiles);
+                kernel.setArg(5, nullptr);
+                kernel.setArg(6, means);
+                kernel.setArg(7, stddivs);
+                auto wg0 = p.at("OUT_WG0");
+                auto wg1 = p.at("OUT_WG1");
+                auto global = cl::NDRange(channels, wgs);
+                auto local = cl::NullRange;
+                if (wg0 != 0) {
+                    global = cl::NDRange(channels, ceilMultiple(tiles, wg1));
+                    local = cl::NDRange(wg0, wg1);
+                }
+                return [&kernel, global, local](cl::CommandQueue& queue,
+                                                cl::Event& event) {
+                    queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                               global, local,
+                                               nullptr, &event);
+                };
+            }, bufferOut, channels * width * height, runs);
+        tuners.insert(begin(p), end(p));
+    }
+
+    // Output transform fused with the input transform of the next
+    // convolution. The second dimension of the work-group must cover
+    // all tiles, so only the number of outputs per group is free.
+    {
+        auto kernel = cl::Kernel(program, "out_transform_fused_bn_in");
+        auto candidates = std::vector<TuneParameters>{{{"OUTIN_WG0", 2}}};
+        for (auto wg0 : std::vector<size_t>{1, 4, 8, 16}) {
+            if (wg0 * wgs <= max_wgs && channels % wg0 == 0) {
+                candidates.push_back({{"OUTIN_WG0", wg0}});
+            }
+        }
+        auto p = tune_kernel("out_transform_fused_bn_in", candidates,
+            [&](const TuneParameters& p) -> KernelLauncher {
+                auto wg0 = p.at("OUTIN_WG0");
+                kernel.setArg(0, bufferM);
+                kernel.setArg(1, nullptr);
+                kernel.setArg(2, bufferV);
+                kernel.setArg(3, channels);
+                kernel.setArg(4, channels);
+                kernel.setArg(5, tiles);
+                kernel.setArg(6, channels);
+                kernel.setArg(7, nullptr);
+                kernel.setArg(8, means);
+                kernel.setArg(9, stddivs);
+                kernel.setArg(10, cl::Local(wg0 * width * height * sizeof(float)));
+                auto global = cl::NDRange(channels, wgs);
+                auto local = cl::NDRange(wg0, wgs);
+                return [&kernel, global, local](cl::CommandQueue& queue,
+                                                cl::Event& event) {
+                    queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                               global, local,
+                                               nullptr, &event);
+                };
+            }, bufferV, v_size, runs);
+        tuners.insert(begin(p), end(p));
+    }
+
+    // 1x1 convolution of the policy and value heads, global
+    // (channels, outputs, rows), local (8, output group, 1).
+    {
+        constexpr auto outputs = Network::NUM_POLICY_INPUT_PLANES;
+        constexpr auto channel_group = 8;
+        constexpr auto row_buffer = 7;
+        auto merge_size = size_t((channels / channel_group) * width * height * outputs);
+        auto bufferWeights = make_buffer(outputs * channels);
+        auto bufferMerge = make_buffer(merge_size);
+
+        auto kernel = cl::Kernel(program, "convolve1");
+        auto candidates = std::vector<TuneParameters>{{{"CONV1_OUTG", 32}}};
+        for (auto og : std::vector<size_t>{1, 2, 4, 8, 16}) {
+            if (channel_group * og <= max_wgs) {
+                candidates.push_back({{"CONV1_OUTG", og}});
+            }
+        }
+        auto p = tune_kernel("convolve1", candidates,
+            [&](const TuneParameters& p) -> KernelLauncher {
+                auto og = p.at("CONV1_OUTG");
+                kernel.setArg(0, bufferIn);
+                kernel.setArg(1, bufferMerge);
+                kernel.setArg(2, bufferWeights);
+                kernel.setArg(3, cl::Local(width * sizeof(float) * channel_group));
+                kernel.setArg(4, cl::Local(channel_group * og * row_buffer * sizeof(float)));
+                auto global = cl::NDRange(channels, outputs, height);
+                auto local = cl::NDRange(channel_group, og, 1);
+                return [&kernel, global, local](cl::CommandQueue& queue,
+                                                cl::Event& event) {
+                    queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                               global, local,
+                                               nullptr, &event);
+                };
+            }, bufferMerge, merge_size, runs);
+        tuners.insert(begin(p), end(p));
+    }
+
+    // Inner product of the policy head. The work-group size and the
+    // work per thread are compiled in, so every candidate needs its
+    // own build.
+    {
+        const auto inputs = Network::NUM_POLICY_INPUT_PLANES * width * height;
+        const auto outputs = int(Network::get_num_output_policy());
+        // Room for the largest WGS1 * WPT1 below.
+        auto output_size = ceilMultiple(outputs, 256 * 4);
+        auto bufferWeights = make_buffer(outputs * inputs);
+        auto bufferInput = make_buffer(inputs);
+        auto bufferBiases = make_buffer(outputs);
+        auto bufferOutput = make_buffer(output_size);
+
+        auto sgemv_program = cl::Program{};
+        auto kernel = cl::Kernel{};
+        auto candidates = std::vector<TuneParameters>{{{"WGS1", 64}, {"WPT1", 1}}};
+        for (auto wgs1 : std::vector<size_t>{32, 64, 128, 256}) {
+            for (auto wpt1 : std::vector<size_t>{1, 2, 4}) {
+                if (wgs1 <= max_wgs && !(wgs1 == 64 && wpt1 == 1)) {
+                    candidates.push_back({{"WGS1", wgs1}, {"WPT1", wpt1}});
+                }
+            }
+        }
+        auto p = tune_kernel("Xgemv", candidates,
+            [&](const TuneParameters& p) -> KernelLauncher {
+                auto wgs1 = p.at("WGS1");
+                auto wpt1 = p.at("WPT1");
+                sgemv_program = cl::Program(m_context,
+                                            OpenCL::get_program_source());
+                auto args = m_opencl.m_cl_args + parameters_to_defines(p);
+                sgemv_program.build(args.c_str());
+                kernel = cl::Kernel(sgemv_program, "Xgemv");
+                kernel.setArg(0, outputs);
+                kernel.setArg(1, inputs);
+                kernel.setArg(2, bufferWeights);
+                kernel.setArg(3, 0);
+                kernel.setArg(4, inputs);
+                kernel.setArg(5, bufferInput);
+                kernel.setArg(6, 0);
+                kernel.setArg(7, bufferOutput);
+                kernel.setArg(8, 0);
+                kernel.setArg(9, bufferBiases);
+                kernel.setArg(10, 0);
+                auto global = cl::NDRange(ceilMultiple(outputs, wgs1 * wpt1) / wpt1);
+                auto local = cl::NDRange(wgs1);
+                return [&kernel, global, local](cl::CommandQueue& queue,
+                                                cl::Event& event) {
+                    queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                               global, local,
+                                               nullptr, &event);
+                };
+            }, bufferOutput, outputs, runs);
+        tuners.insert(begin(p), end(p));
+    }
+
+    return parameters_to_defines(tuners);
+}
+
+std::string Tuner::load_kernel_tuners(const int channels,
+                                      const int batch_size) {
+    // The policy head shape goes into the key, it differs between
+    // network formats. The kernels see one position at a time, so the
+    // batch size is only part of the key.
+    return load_tuners("kernels", channels,
+                       int(Network::get_num_output_policy()),
+                       Network::NUM_POLICY_INPUT_PLANES, batch_size, [&]() {
+        return tune_kernels(channels);
+    });
+}
+
+void Tuner::store_tuners(const std::string& kernel,
+                         const int m, const int n, const int k,
+                         const int batch_size, std::string tuners) {
     auto file_contents = std::vector<std::string>();
     {
         // Read the previous contents to string
@@ -423,7 +755,7 @@ void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
     auto tuning_params = std::stringstream{};
     tuning_params << m << ";" << n << ";" << k << ";" << batch_size;
 
-    auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";XgemmBatched;"
+    auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";" + kernel + ";"
         + tuning_params.str() + ";";
     auto tuning_line = tuning_line_prefix + tuners + ";" + device_name;
 
@@ -446,9 +778,10 @@ void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
     }
 }
 
-std::string Tuner::sgemm_tuners_from_line(std::string line,
-                                          const int m, const int n, const int k,
-                                          const int batch_size) {
+std::string Tuner::tuners_from_line(std::string line,
+                                    const std::string& kernel,
+                                    const int m, const int n, const int k,
+                                    const int batch_size) {
     auto s = std::vector<std::string>{};
     auto ss = std::stringstream{line};
     auto item = std::string{};
@@ -465,7 +798,7 @@ std::string Tuner::sgemm_tuners_from_line(std::string line,
         return "";
     }
 
-    if (s[1] != "XgemmBatched") {
+    if (s[1] != kernel) {
         return "";
     }
 
@@ -492,22 +825,31 @@ std::string Tuner::sgemm_tuners_from_line(std::string line,
     return s[6];
 }
 
-std::string Tuner::load_sgemm_tuners(const int m, const int n, const int k,
-                                     const int batch_size) {
+std::string Tuner::load_tuners(const std::string& kernel,
+                               const int m, const int n, const int k,
+                               const int batch_size,
+                               const std::function<std::string()>& tune) {
     auto file = std::ifstream{TUNER_FILE_LOCAL};
     if (!cfg_sgemm_exhaustive && file.good()) {
         auto line = std::string{};
         while (std::getline(file, line)) {
-            auto tuners = sgemm_tuners_from_line(line, m, n, k, batch_size);
+            auto tuners = tuners_from_line(line, kernel, m, n, k, batch_size);
             if (tuners.size() != 0) {
-                myprintf("Loaded existing SGEMM tuning.\n");
+                myprintf("Loaded existing tuning for %s.\n", kernel.c_str());
                 return tuners;
             }
         }
     }
-    auto tuners = tune_sgemm(m, n, k, batch_size);
-    store_sgemm_tuners(m, n, k, batch_size, tuners);
+    auto tuners = tune();
+    store_tuners(kernel, m, n, k, batch_size, tuners);
     return tuners;
 }
 
+std::string Tuner::load_sgemm_tuners(const int m, const int n, const int k,
+                                     const int batch_size) {
+    return load_tuners("XgemmBatched", m, n, k, batch_size, [&]() {
+        return tune_sgemm(m, n, k, batch_size);
+    });
+}
+
 #endif
@@ -20,12 +20,17 @@
 #define SGEMM_TUNER_H_INCLUDED
 
 #include "config.h"
+#include <functional>
 #include <vector>
 #include <map>
 #include <string>
 
 using Configurations = std::pair<std::string, std::vector<size_t>>;
 using TuneParameters = std::map<std::string, size_t>;
+// Sets up a kernel for one configuration and returns a function that
+// enqueues it, recording the run in the event.
+using KernelLauncher = std::function<void(cl::CommandQueue&, cl::Event&)>;
+using KernelSetup = std::function<KernelLauncher(const TuneParameters&)>;
 
 class OpenCL;
 
@@ -38,21 +43,35 @@ public:
                            const int batch_size, const int runs = 4);
     std::string load_sgemm_tuners(const int m, const int n, const int k,
                                   const int batch_size);
+    // Work-group sizes of the Winograd transforms, the 1x1 convolution
+    // and the inner product, as defines for OpenCL::process_kernel_tuners.
+    std::string tune_kernels(const int channels, const int runs = 4);
+    std::string load_kernel_tuners(const int channels, const int batch_size);
 
     static constexpr auto TUNER_VERSION = 0;
     Tuner(OpenCL & opencl, cl::Context context, cl::Device device) :
         m_opencl(opencl), m_context(context), m_device(device) {}
 private:
-    void store_sgemm_tuners(const int m, const int n, const int k,
-                            const int batch_size, std::string tuners);
+    std::string load_tuners(const std::string& kernel,
+                            const int m, const int n, const int k,
+                            const int batch_size,
+                            const std::function<std::string()>& tune);
+    void store_tuners(const std::string& kernel,
+                      const int m, const int n, const int k,
+                      const int batch_size, std::string tuners);
+    TuneParameters tune_kernel(const std::string& name,
+                               const std::vector<TuneParameters>& candidates,
+                               const KernelSetup& setup,
+                               cl::Buffer& output, const size_t output_size,
+                               const int runs);
     bool valid_config_sgemm(TuneParameters p, bool exhaustive);
     std::string parameters_to_defines(const TuneParameters& p);
     std::string parameters_to_string(const TuneParameters& p);
     TuneParameters get_parameters_by_int(const std::vector<Configurations>& opts,
                                      const int n);
-    std::string sgemm_tuners_from_line(std::string line, const int m,
-                                       const int n, const int k,
-                                       const int batch_size);
+    std::string tuners_from_line(std::string line, const std::string& kernel,
+                                 const int m, const int n, const int k,
+                                 const int batch_size);
 };
 
 #endif
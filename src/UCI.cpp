@@ -24,7 +24,10 @@
 #include <sstream>
 #include <string>
 
+#include "LargePages.h"
+#include "MemStats.h"
 #include "Movegen.h"
+#include "NNCache.h"
 #include "Parameters.h"
 #include "pgn.h"
 #include "Position.h"
@@ -87,7 +90,10 @@ namespace {
     while (is >> token)
         value += string(" ", value.empty() ? 0 : 1) + token;
 
-    myprintf_so("No such option: %s\n", name.c_str());
+    if (name == "Ponder")
+        cfg_ponder = (value == "true");
+    else
+        myprintf_so("No such option: %s\n", name.c_str());
   }
 
   // called when receiving the 'perft Depth' command
@@ -101,7 +107,14 @@ namespace {
   }
 
 void printVersion() {
-  myprintf_so("id name lczero " PROGRAM_VERSION "\nid author The LCZero Authors\nuciok\n");
+  myprintf_so("id name lczero " PROGRAM_VERSION "\nid author The LCZero Authors\n"
+              "option name Ponder type check default false\nuciok\n");
+}
+
+// Thinking on the opponent's time needs the GUI to set Ponder. Not with
+// --deterministic, whose trees must not depend on timing.
+bool can_ponder() {
+  return cfg_ponder && cfg_allow_pondering && !cfg_deterministic;
 }
 
 // Return the score from the self-play game
@@ -246,15 +259,23 @@ uint64_t UCI::perft(BoardHistory& bh, Depth depth) {
 
 void gohelper(UCTSearch & search, BoardHistory &bh) {
     Move move = search.think(bh.shallow_clone());
+    Move reply = can_ponder() ? search.expected_reply(move) : MOVE_NONE;
 
     bh.do_move(move);
-    myprintf_so("bestmove %s\n", UCI::move(move).c_str());
+    if (reply != MOVE_NONE)
+        myprintf_so("bestmove %s ponder %s\n", UCI::move(move).c_str(), UCI::move(reply).c_str());
+    else
+        myprintf_so("bestmove %s\n", UCI::move(move).c_str());
 }
 
-void go(UCTSearch& search, BoardHistory& bh, istringstream& is) {
+// "go ponder" searches until "ponderhit" or "stop" arrives. The loop is
+// synchronous, so pondering returns on any input and resumes after the
+// commands that may come in between, like "isready".
+void go(UCTSearch& search, BoardHistory& bh, istringstream& is, bool& pondering) {
 
     Limits = LimitsType();
     string token;
+    pondering = false;
 
     // TODO: See issue #287.
     //if ((is >> token) && token == "infinite") Limits.infinite = 1;
@@ -270,14 +291,40 @@ void go(UCTSearch& search, BoardHistory& bh, istringstream& is) {
         else if (token == "depth")     is >> Limits.depth;
         else if (token == "nodes")     is >> Limits.nodes;
         else if (token == "movetime")  is >> Limits.movetime;
+        else if (token == "ponder")    pondering = true;
     } while (is >> token);
 
+    // The limits are kept for the real search after "ponderhit".
+    if (pondering) {
+        if (can_ponder()) search.ponder(bh);
+        return;
+    }
+
     // TODO: See issue #287.
     //std::thread lol(gohelper, std::ref(search), std::ref(bh));
     //lol.detach();
     gohelper(search, bh);
 }
 
+// The opponent played the move we pondered on, so search it for real,
+// with our clock running from now.
+void ponderhit(UCTSearch& search, BoardHistory& bh, bool& pondering) {
+    if (!pondering) return;
+    pondering = false;
+    Limits.startTime = now();
+    gohelper(search, bh);
+}
+
+void stop(UCTSearch& search, BoardHistory& bh, bool& pondering) {
+    if (!pondering) {
+        search.please_stop();
+        return;
+    }
+    // A ponder miss. The GUI discards this move and sends the real position.
+    pondering = false;
+    myprintf_so("bestmove %s\n", UCI::move(search.pondered_move(bh)).c_str());
+}
+
 
 /// UCI::loop() waits for a command from stdin, parses it and calls the appropriate
 /// function. Also intercepts EOF from stdin to ensure gracefully exiting if the
@@ -290,6 +337,7 @@ void UCI::loop(const std::string& start) {
   BoardHistory bh;
   bh.set(Position::StartFEN);
   UCTSearch search (bh.shallow_clone());//std::make_unique<UCTSearch>(bh.shallow_clone());
+  bool pondering = false;
 
   do {
       if (start.empty() && !getline(cin, cmd)) // Block here waiting for input or EOF
@@ -302,34 +350,27 @@ void UCI::loop(const std::string& start) {
 
       if (token == "quit" || token == "exit") break;
 
-      /*
-      // The GUI sends 'ponderhit' to tell us the user has played the expected move.
-      // So 'ponderhit' will be sent if we were told to ponder on the same move the
-      // user has played. We should continue searching but switch from pondering to
-      // normal search. In case Threads.stopOnPonderhit is set we are waiting for
-      // 'ponderhit' to stop the search, for instance if max search depth is reached.
-      if (    token == "quit"
-          ||  token == "stop"
-          || (token == "ponderhit" && Threads.stopOnPonderhit))
-          Threads.stop = true;
-      else if (token == "ponderhit")
-          Threads.ponder = false; // Switch to normal search
-      */
-
       if (token == "uci")             printVersion();
       else if (token == "setoption")  setoption(is);
-      else if (token == "go")         go(search,bh,is);
-      else if (token == "stop")       search.please_stop();
+      else if (token == "go")         go(search,bh,is,pondering);
+      else if (token == "ponderhit")  ponderhit(search,bh,pondering);
+      else if (token == "stop")       stop(search,bh,pondering);
       else if (token == "perft")      uci_perft(bh, is);
       else if (token == "position")   position(bh, is);
       else if (token == "ucinewgame") ;
       else if (token == "isready") {
           Network::initialize();
           myprintf_so("readyok\n");
+          if (pondering && can_ponder()) search.ponder(bh);
       }
       // Additional custom non-UCI commands, mainly for debugging
       else if (token == "train")   generate_training_games(is);
       else if (token == "bench")   bench();
+      else if (token == "memstats") {
+          MemStats::dump();
+          if (cfg_large_pages) LargePages::dump();
+      }
+      else if (token == "nncache") NNCache::get_NNCache().dump_stats();
       else if (token == "d" || token == "showboard") {
 		  std::stringstream ss;
 		  ss << bh.cur();
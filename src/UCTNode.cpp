@@ -32,7 +32,13 @@
 #include <random>
 #include <numeric>
 #include <boost/range/adaptor/reversed.hpp>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
+#include "AdaptiveThreads.h"
+#include "LargePages.h"
+#include "MemStats.h"
 #include "Position.h"
 #include "Parameters.h"
 #include "Movegen.h"
@@ -41,6 +47,7 @@
 #include "UCTSearch.h"
 #include "Utils.h"
 #include "Network.h"
+#include "NNCache.h"
 #include "Random.h"
 
 using namespace Utils;
@@ -48,19 +55,66 @@ using namespace Utils;
 UCTNode::UCTNode(Move move, float score, float init_eval)
     : m_move(move), m_score(score), m_init_eval(init_eval) {
     assert(m_score >= 0.0 && m_score <= 1.0);
+    MemStats::add(MemStats::TREE_NODES, sizeof(UCTNode));
 }
 
 UCTNode::~UCTNode() {
     LOCK(m_nodemutex, lock);
+    MemStats::sub(MemStats::TREE_NODES, sizeof(UCTNode));
+    MemStats::sub(MemStats::CHILD_VECTORS,
+                  m_children.capacity() * sizeof(UCTNodePointer)
+                  + m_child_stats.capacity() * sizeof(float));
     // Empty the children array while the lock is held
     m_children.clear();
 }
 
+// Never destroyed, nodes may outlive static destruction.
+static LargePages::Pool& node_pool() {
+    static auto pool = new LargePages::Pool(sizeof(UCTNode));
+    return *pool;
+}
+
+void* UCTNode::operator new(std::size_t size) {
+    if (!cfg_large_pages) {
+        return ::operator new(size);
+    }
+    assert(size == sizeof(UCTNode));
+    return node_pool().allocate();
+}
+
+void UCTNode::operator delete(void* ptr) {
+    if (!cfg_large_pages) {
+        ::operator delete(ptr);
+        return;
+    }
+    if (ptr) {
+        node_pool().free(ptr);
+    }
+}
+
 bool UCTNode::first_visit() const {
     return m_visits == 0;
 }
 
 bool UCTNode::create_children(std::atomic<int>& nodecount, const BoardHistory& state, float& eval) {
+    if (!acquire_expansion()) {
+        return false;
+    }
+    // With a small network, new nodes get the main network's result
+    // only if it is in the NNCache already.
+    auto raw_netlist = Network::Netresult{};
+    if (!Network::has_small_network()) {
+        raw_netlist = Network::get_scored_moves(state);
+    } else if (!NNCache::get_NNCache().lookup(state.cur().full_key(),
+                                              raw_netlist,
+                                              state.cur().game_ply())) {
+        raw_netlist = Network::get_scored_moves_small(state);
+        m_small_net = true;
+    }
+    return expand(nodecount, state, raw_netlist, eval);
+}
+
+bool UCTNode::acquire_expansion() {
     // check whether somebody beat us to it (atomic)
     if (has_children()) {
         return false;
@@ -73,13 +127,40 @@ bool UCTNode::create_children(std::atomic<int>& nodecount, const BoardHistory& s
     }
     // Someone else is running the expansion
     if (m_is_expanding) {
+        AdaptiveThreads::count_collision();
         return false;
     }
     // We'll be the one queueing this node for expansion, stop others
     m_is_expanding = true;
-    lock.unlock();
+    return true;
+}
 
-    auto raw_netlist = Network::get_scored_moves(state);
+namespace {
+
+void normalize_priors(std::vector<Network::scored_node>& nodelist) {
+    auto legal_sum = 0.0f;
+    for (auto m : nodelist) {
+        legal_sum += m.first;
+    }
+
+    if (legal_sum > std::numeric_limits<float>::min()) {
+        // re-normalize after removing illegal moves.
+        for (auto& node : nodelist) {
+            node.first /= legal_sum;
+        }
+    } else {
+        // This can happen with new randomized nets.
+        auto uniform_prob = 1.0f / nodelist.size();
+        for (auto& node : nodelist) {
+            node.first = uniform_prob;
+        }
+    }
+}
+
+} // namespace
+
+bool UCTNode::expand(std::atomic<int>& nodecount, const BoardHistory& state,
+                     Network::Netresult& raw_netlist, float& eval) {
     // no successors in final state
     if (raw_netlist.first.empty()) {
         return false;
@@ -94,26 +175,58 @@ bool UCTNode::create_children(std::atomic<int>& nodecount, const BoardHistory& s
     }
     eval = net_eval;
 
-    auto legal_sum = 0.0f;
-    for (auto m : raw_netlist.first) {
-        legal_sum += m.first;
+    normalize_priors(raw_netlist.first);
+    link_nodelist(nodecount, raw_netlist.first, net_eval);
+
+    return true;
+}
+
+bool UCTNode::small_net_eval() const {
+    return m_small_net;
+}
+
+bool UCTNode::reevaluate(const BoardHistory& state, float& eval_change) {
+    auto expected = true;
+    if (!m_small_net.compare_exchange_strong(expected, false)) {
+        return false;
     }
+    auto raw_netlist = Network::get_scored_moves(state);
+    auto net_eval = raw_netlist.second;
+    if (state.cur().side_to_move() == BLACK) {
+        net_eval = 1.0f - net_eval;
+    }
+    normalize_priors(raw_netlist.first);
 
-    if (legal_sum > std::numeric_limits<float>::min()) {
-        // re-normalize after removing illegal moves.
-        for (auto& node : raw_netlist.first) {
-            node.first /= legal_sum;
+    LOCK(m_nodemutex, lock);
+    // The small network's eval went into this node and its ancestors
+    // once, when the node was expanded.
+    eval_change = net_eval - m_net_eval;
+    m_net_eval = net_eval;
+    accumulate_eval(eval_change);
+
+    for (auto& child : m_children) {
+        auto prior = 0.0f;
+        for (const auto& node : raw_netlist.first) {
+            if (node.second == child.get_move()) {
+                prior = node.first;
+                break;
+            }
         }
-    } else {
-        // This can happen with new randomized nets.
-        auto uniform_prob = 1.0f / raw_netlist.first.size();
-        for (auto& node : raw_netlist.first) {
-            node.first = uniform_prob;
+        if (child.is_inflated()) {
+            child->set_score(prior);
+        } else {
+            child = UCTNodePointer(child.get_move(), prior);
         }
     }
-
-    link_nodelist(nodecount, raw_netlist.first, net_eval);
-
+    // uct_select_child expects the children it did not select yet to be
+    // sorted by prior. Nobody holds an index into those.
+    std::stable_sort(begin(m_children) + m_selected_children, end(m_children),
+                     [](const UCTNodePointer& a, const UCTNodePointer& b) {
+                         return a.get_score() > b.get_score();
+                     });
+    for (size_t i = 0; i < m_children.size(); i++) {
+        write_child_stats(i);
+    }
     return true;
 }
 
@@ -127,17 +240,66 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount, std::vector<Network::sc
 
     LOCK(m_nodemutex, lock);
 
+    m_net_eval = init_eval;
     m_children.reserve(nodelist.size());
     for (const auto& node : nodelist) {
-        m_children.emplace_back(
-            std::make_unique<UCTNode>(node.second, node.first, init_eval)
-        );
+        m_children.emplace_back(node.second, node.first);
+    }
+    m_child_stats_stride = (m_children.size() + CHILD_STATS_ALIGN - 1)
+                           / CHILD_STATS_ALIGN * CHILD_STATS_ALIGN;
+    m_child_stats.assign(CHILD_STATS_ROWS * m_child_stats_stride, 0.0f);
+    for (size_t i = 0; i < m_children.size(); i++) {
+        write_child_stats(i);
     }
+    MemStats::add(MemStats::CHILD_VECTORS,
+                  m_children.capacity() * sizeof(UCTNodePointer)
+                  + m_child_stats.capacity() * sizeof(float));
 
     nodecount += m_children.size();
     m_has_children = true;
 }
 
+void UCTNode::write_child_stats(size_t index) {
+    const auto& child = m_children[index];
+    child_stats(CHILD_PRIOR)[index] = child.get_score();
+    child_stats(CHILD_VISITS)[index] = child.get_visits();
+    child_stats(CHILD_ACTIVE)[index] = child.active() ? 1.0f : 0.0f;
+    if (child.is_inflated()) {
+        child_stats(CHILD_WHITEEVALS)[index] = child->get_whiteevals();
+        child_stats(CHILD_VIRTUAL_LOSS)[index] = child->m_virtual_loss;
+    } else {
+        child_stats(CHILD_WHITEEVALS)[index] = 0.0f;
+        child_stats(CHILD_VIRTUAL_LOSS)[index] = 0.0f;
+    }
+}
+
+void UCTNode::update_child_stats(size_t index) {
+    LOCK(m_nodemutex, lock);
+    write_child_stats(index);
+}
+
+void UCTNode::update_all_child_stats() {
+    LOCK(m_nodemutex, lock);
+    for (size_t i = 0; i < m_children.size(); i++) {
+        write_child_stats(i);
+    }
+}
+
+bool UCTNode::is_most_visited_child(size_t index) {
+    LOCK(m_nodemutex, lock);
+    const auto visits = child_stats(CHILD_VISITS);
+    return std::all_of(visits, visits + m_children.size(),
+                       [visits, index](float v) { return v <= visits[index]; });
+}
+
+void UCTNode::inflate_all_children() {
+    LOCK(m_nodemutex, lock);
+    for (const auto& child : m_children) {
+        child.inflate(m_net_eval);
+    }
+}
+
+// Only called on the root, after inflate_all_children.
 void UCTNode::dirichlet_noise(float epsilon, float alpha) {
     auto child_cnt = m_children.size();
     auto dirichlet_vector = std::vector<float>{};
@@ -166,6 +328,7 @@ void UCTNode::dirichlet_noise(float epsilon, float alpha) {
         score = score * (1 - epsilon) + epsilon * eta_a;
         child->set_score(score);
     }
+    update_all_child_stats();
 }
 
 void UCTNode::randomize_first_proportionally(float tau) {
@@ -176,9 +339,9 @@ void UCTNode::randomize_first_proportionally(float tau) {
     // Calculate exponentiated visit count vector, normalised to the first child visits
     for (const auto& child : m_children) {
         if (normfactor == 0.0f) {
-            normfactor = child->get_visits();
+            normfactor = child.get_visits();
         }
-        accum += std::pow(child->get_visits()/normfactor,1/tau);
+        accum += std::pow(child.get_visits()/normfactor,1/tau);
         accum_vector.emplace_back(accum);
         // myprintf("Visits: %d Exponentiated visits: %11.9f Cumulative visits: %11.9f\n",child->get_visits(), std::pow(child->get_visits()/normfactor,1.0f/tau), accum); 
     }
@@ -205,6 +368,7 @@ void UCTNode::randomize_first_proportionally(float tau) {
     // Now swap the child at index with the first child
     assert(index < m_children.size());
     std::iter_swap(begin(m_children), begin(m_children) + index);
+    update_all_child_stats();
 }
 
 Move UCTNode::get_move() const {
@@ -282,28 +446,155 @@ void UCTNode::accumulate_eval(float eval) {
     atomic_add(m_whiteevals, (double)eval);
 }
 
-UCTNode* UCTNode::uct_select_child(Color color, bool is_root) {
-    UCTNode* best = nullptr;
-    auto best_value = std::numeric_limits<double>::lowest();
+namespace {
+
+// What puct_argmax needs from uct_select_child.
+struct PuctInput {
+    const float* prior;
+    const float* visits;
+    const float* whiteevals;
+    const float* virtual_loss;
+    const float* active;
+    size_t count;
+    float cpuct;
+    float numerator;
+    float fpu_eval;
+    // The eval for the side to move is (black * visits + sign * whiteevals)
+    // / (visits + virtual loss): virtual losses count as losses for either
+    // side, like in UCTNode::get_eval.
+    float black;
+    float sign;
+};
+
+// Returns the index of the first active child with the highest
+// winrate + cpuct * psa * sqrt(N) / (1 + n).
+size_t puct_argmax_scalar(const PuctInput& in) {
+    auto best_index = size_t{0};
+    auto best_value = std::numeric_limits<float>::lowest();
+    for (size_t i = 0; i < in.count; i++) {
+        if (in.active[i] == 0.0f) {
+            continue;
+        }
+        const auto visits = in.visits[i];
+        auto winrate = in.fpu_eval;
+        if (visits > 0.0f) {
+            winrate = (in.black * visits + in.sign * in.whiteevals[i])
+                      / (visits + in.virtual_loss[i]);
+        }
+        const auto puct = (in.cpuct * in.prior[i]) * (in.numerator / (1.0f + visits));
+        const auto value = winrate + puct;
+        if (value > best_value) {
+            best_value = value;
+            best_index = i;
+        }
+    }
+    return best_index;
+}
+
+#ifdef __AVX2__
+// Same as puct_argmax_scalar, 8 children at a time. The arrays must be
+// readable up to count rounded up to a multiple of 8.
+size_t puct_argmax_avx2(const PuctInput& in) {
+    const auto zero = _mm256_setzero_ps();
+    const auto one = _mm256_set1_ps(1.0f);
+    const auto cpuct = _mm256_set1_ps(in.cpuct);
+    const auto numerator = _mm256_set1_ps(in.numerator);
+    const auto fpu_eval = _mm256_set1_ps(in.fpu_eval);
+    const auto black = _mm256_set1_ps(in.black);
+    const auto sign = _mm256_set1_ps(in.sign);
+    const auto count = _mm256_set1_epi32(static_cast<int>(in.count));
+    const auto step = _mm256_set1_epi32(8);
+
+    // Best value and index per lane. As lanes only take strictly better
+    // values, each lane keeps its first best child.
+    auto best_value = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+    auto best_index = _mm256_setzero_si256();
+    auto index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (size_t i = 0; i < in.count; i += 8) {
+        const auto visits = _mm256_loadu_ps(in.visits + i);
+        const auto whiteevals = _mm256_loadu_ps(in.whiteevals + i);
+        const auto virtual_loss = _mm256_loadu_ps(in.virtual_loss + i);
+        const auto prior = _mm256_loadu_ps(in.prior + i);
+        const auto active = _mm256_loadu_ps(in.active + i);
+
+        const auto eval = _mm256_add_ps(_mm256_mul_ps(black, visits),
+                                        _mm256_mul_ps(sign, whiteevals));
+        auto winrate = _mm256_div_ps(eval, _mm256_add_ps(visits, virtual_loss));
+        const auto visited = _mm256_cmp_ps(visits, zero, _CMP_GT_OQ);
+        winrate = _mm256_blendv_ps(fpu_eval, winrate, visited);
+        const auto puct = _mm256_mul_ps(
+            _mm256_mul_ps(cpuct, prior),
+            _mm256_div_ps(numerator, _mm256_add_ps(one, visits)));
+        const auto value = _mm256_add_ps(winrate, puct);
+
+        const auto in_range = _mm256_castsi256_ps(_mm256_cmpgt_epi32(count, index));
+        const auto valid = _mm256_and_ps(in_range,
+                                         _mm256_cmp_ps(active, zero, _CMP_NEQ_OQ));
+        const auto better = _mm256_and_ps(valid,
+                                          _mm256_cmp_ps(value, best_value, _CMP_GT_OQ));
+        best_value = _mm256_blendv_ps(best_value, value, better);
+        best_index = _mm256_castps_si256(_mm256_blendv_ps(
+            _mm256_castsi256_ps(best_index), _mm256_castsi256_ps(index), better));
+        index = _mm256_add_epi32(index, step);
+    }
 
+    alignas(32) float values[8];
+    alignas(32) std::int32_t indices[8];
+    _mm256_store_ps(values, best_value);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(indices), best_index);
+    auto result_value = values[0];
+    auto result_index = indices[0];
+    for (auto lane = 1; lane < 8; lane++) {
+        if (values[lane] > result_value
+            || (values[lane] == result_value && indices[lane] < result_index)) {
+            result_value = values[lane];
+            result_index = indices[lane];
+        }
+    }
+    return static_cast<size_t>(result_index);
+}
+#endif
+
+size_t puct_argmax(const PuctInput& in) {
+#ifdef __AVX2__
+    return puct_argmax_avx2(in);
+#else
+    return puct_argmax_scalar(in);
+#endif
+}
+
+} // namespace
+
+UCTNode* UCTNode::uct_select_child(Color color, bool is_root, size_t& index) {
     LOCK(m_nodemutex, lock);
 
+    // Children are sorted best to worst by prior and only get visits through
+    // this function, so the unselected ones all come after the selected
+    // ones. They share the FPU eval, so the first of them dominates the rest.
+    // Only look at the selected children plus that one. The root children
+    // can be noised, reordered and pruned, so always scan all of them.
+    const auto candidates = is_root ? m_children.size()
+        : std::min(m_children.size(), size_t{m_selected_children} + 1);
+
+    auto input = PuctInput{};
+    input.prior = child_stats(CHILD_PRIOR);
+    input.visits = child_stats(CHILD_VISITS);
+    input.whiteevals = child_stats(CHILD_WHITEEVALS);
+    input.virtual_loss = child_stats(CHILD_VIRTUAL_LOSS);
+    input.active = child_stats(CHILD_ACTIVE);
+    input.count = candidates;
+
     // Count parentvisits manually to avoid issues with transpositions.
     auto total_visited_policy = 0.0f;
-    auto parentvisits = size_t{0};
-    // Net eval can be obtained from an unvisited child. This is invalid
-    // if there are no unvisited children, but then this isn't used in that case.
-    auto net_eval = 0.0f;
-    for (const auto& child : m_children) {
-        parentvisits += child->get_visits();
-        if (child->get_visits() > 0) {
-            total_visited_policy += child->get_score();
-        } else {
-            net_eval = child->get_eval(color);
+    auto parentvisits = 0.0f;
+    for (size_t i = 0; i < candidates; i++) {
+        parentvisits += input.visits[i];
+        if (input.visits[i] > 0.0f) {
+            total_visited_policy += input.prior[i];
         }
     }
+    auto net_eval = color == BLACK ? 1.0f - m_net_eval : m_net_eval;
 
-    auto numerator = std::sqrt((double)parentvisits);
     auto fpu_reduction = 0.0f;
     // Lower the expected eval for moves that are likely not the best.
     // Do not do this if we have introduced noise at this node exactly
@@ -314,47 +605,40 @@ UCTNode* UCTNode::uct_select_child(Color color, bool is_root) {
 
     // Estimated eval for unknown nodes = original parent NN eval - reduction
     // Or curent parent eval - reduction if dynamic_eval is enabled.
-    auto fpu_eval = (cfg_fpu_dynamic_eval ? get_eval(color) : net_eval) - fpu_reduction;
+    input.fpu_eval = (cfg_fpu_dynamic_eval ? get_eval(color) : net_eval) - fpu_reduction;
+    input.cpuct = cfg_puct;
+    input.numerator = std::sqrt(parentvisits);
+    input.black = color == BLACK ? 1.0f : 0.0f;
+    input.sign = color == BLACK ? -1.0f : 1.0f;
 
-    for (const auto& child : m_children) {
-        if (!child->active()) {
-            continue;
-        }
-
-        float winrate = fpu_eval;
-        if (child->get_visits() > 0) {
-            winrate = child->get_eval(color);
-        }
-        auto psa = child->get_score();
-        auto denom = 1.0f + child->get_visits();
-        auto puct = cfg_puct * psa * (numerator / denom);
-        auto value = winrate + puct;
-        assert(value > std::numeric_limits<double>::lowest());
+    const auto best_index = puct_argmax(input);
+    assert(m_children[best_index].active());
 
-        if (value > best_value) {
-            best_value = value;
-            best = child.get();
-        }
+    if (!is_root && best_index == m_selected_children) {
+        m_selected_children++;
     }
-
-    assert(best != nullptr);
-    return best;
+    // The child adds its own virtual loss, but show it here right away.
+    child_stats(CHILD_VIRTUAL_LOSS)[best_index] += VIRTUAL_LOSS_COUNT;
+    // First selection of this child, create the node.
+    m_children[best_index].inflate(m_net_eval);
+    index = best_index;
+    return m_children[best_index].get();
 }
 
-class NodeComp : public std::binary_function<UCTNode::node_ptr_t&,
-                                             UCTNode::node_ptr_t&, bool> {
+class NodeComp : public std::binary_function<UCTNodePointer&,
+                                             UCTNodePointer&, bool> {
 public:
     NodeComp(int color) : m_color(color) {};
-    bool operator()(const UCTNode::node_ptr_t& a,
-                    const UCTNode::node_ptr_t& b) {
+    bool operator()(const UCTNodePointer& a,
+                    const UCTNodePointer& b) {
         // if visits are not same, sort on visits
-        if (a->get_visits() != b->get_visits()) {
-            return a->get_visits() < b->get_visits();
+        if (a.get_visits() != b.get_visits()) {
+            return a.get_visits() < b.get_visits();
         }
 
         // neither has visits, sort on prior score
-        if (a->get_visits() == 0) {
-            return a->get_score() < b->get_score();
+        if (a.get_visits() == 0) {
+            return a.get_score() < b.get_score();
         }
 
         // both have same non-zero number of visits
@@ -368,14 +652,19 @@ void UCTNode::sort_root_children(Color color) {
     LOCK(m_nodemutex, lock);
     std::stable_sort(begin(m_children), end(m_children), NodeComp(color));
     std::reverse(begin(m_children), end(m_children));
+    for (size_t i = 0; i < m_children.size(); i++) {
+        write_child_stats(i);
+    }
 }
 
 UCTNode& UCTNode::get_best_root_child(Color color) {
     LOCK(m_nodemutex, lock);
     assert(!m_children.empty());
 
-    return *(std::max_element(begin(m_children), end(m_children),
-                              NodeComp(color))->get());
+    auto& best = *std::max_element(begin(m_children), end(m_children),
+                                   NodeComp(color));
+    best.inflate(m_net_eval);
+    return *best.get();
 }
 
 size_t UCTNode::count_nodes() const {
@@ -383,7 +672,9 @@ size_t UCTNode::count_nodes() const {
     if (m_has_children) {
         nodecount += m_children.size();
         for (auto& child : m_children) {
-            nodecount += child->count_nodes();
+            if (child.is_inflated()) {
+                nodecount += child->count_nodes();
+            }
         }
     }
     return nodecount;
@@ -393,10 +684,11 @@ UCTNode* UCTNode::get_first_child() const {
     if (m_children.empty()) {
         return nullptr;
     }
+    m_children.front().inflate(m_net_eval);
     return m_children.front().get();
 }
 
-const std::vector<UCTNode::node_ptr_t>& UCTNode::get_children() const {
+const std::vector<UCTNodePointer>& UCTNode::get_children() const {
     return m_children;
 }
 
@@ -427,12 +719,16 @@ UCTNode::node_ptr_t UCTNode::find_path(std::vector<Move>& moves) {
     auto move = moves.back();
     moves.pop_back();
     for (auto& node : m_children) {
-        if (node->get_move() == move) {
+        if (node.get_move() == move) {
+            if (!node.is_inflated()) {
+                // Never searched, nothing to reuse.
+                return nullptr;
+            }
             if (moves.size() > 0) {
                 // Keep going recursively through the move list.
                 return node->find_path(moves);
             } else {
-                return std::move(node);
+                return node.release();
             }
         }
     }
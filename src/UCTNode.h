@@ -29,6 +29,7 @@
 #include "Network.h"
 #include "Position.h"
 #include "SMP.h"
+#include "UCTNodePointer.h"
 
 class UCTNode {
 public:
@@ -42,12 +43,28 @@ public:
     explicit UCTNode(Move move, float score, float init_eval);
     UCTNode() = delete;
     ~UCTNode();
+    // With --large-pages, nodes come from a pool of large pages.
+    static void* operator new(std::size_t size);
+    static void operator delete(void* ptr);
     size_t count_nodes() const;
     bool first_visit() const;
     bool has_children() const;
     void set_active(const bool active);
     bool active() const;
     bool create_children(std::atomic<int> & nodecount, const BoardHistory& state, float& eval);
+    // create_children in two steps, for callers that evaluate the position
+    // themselves. Only the caller that acquired the expansion may expand.
+    bool acquire_expansion();
+    bool expand(std::atomic<int>& nodecount, const BoardHistory& state,
+                Network::Netresult& raw_netlist, float& eval);
+    // Was this node expanded with the small network, and not re-evaluated?
+    bool small_net_eval() const;
+    // Replace the priors and eval from the small network with those of the
+    // main network, and correct the evals of this node for it. eval_change
+    // is the correction that still has to go to the ancestors. Returns
+    // false if there was nothing to do. Not safe on the root during a
+    // search, it reorders the children that were not selected yet.
+    bool reevaluate(const BoardHistory& state, float& eval_change);
     Move get_move() const;
     int get_visits() const;
     float get_score() const;
@@ -62,10 +79,18 @@ public:
     void dirichlet_noise(float epsilon, float alpha);
     void randomize_first_proportionally(float tau);
     void update(float eval = std::numeric_limits<float>::quiet_NaN());
-
-    UCTNode* uct_select_child(Color color, bool is_root);
+    void inflate_all_children();
+
+    // Also returns the index of the child, for update_child_stats.
+    UCTNode* uct_select_child(Color color, bool is_root, size_t& index);
+    // Copy the stats of a child into the arrays uct_select_child scans.
+    // Call after updating the child, or after changing children directly
+    // (for all of them).
+    void update_child_stats(size_t index);
+    void update_all_child_stats();
+    bool is_most_visited_child(size_t index);
     UCTNode* get_first_child() const;
-    const std::vector<node_ptr_t>& get_children() const;
+    const std::vector<UCTNodePointer>& get_children() const;
 
     void sort_root_children(Color color);
     UCTNode& get_best_root_child(Color color);
@@ -79,6 +104,11 @@ private:
         ACTIVE
     };
     void link_nodelist(std::atomic<int>& nodecount, std::vector<Network::scored_node>& nodelist, float init_eval);
+    // m_nodemutex must be held.
+    void write_child_stats(size_t index);
+    float* child_stats(size_t row) {
+        return m_child_stats.data() + row * m_child_stats_stride;
+    }
 
     // Move
     Move m_move;
@@ -88,16 +118,37 @@ private:
     // UCT eval
     float m_score;
     float m_init_eval;
+    // NN eval of this node (white), handed to children when they inflate.
+    float m_net_eval{0.5f};
     std::atomic<double> m_whiteevals{0};
     std::atomic<Status> m_status{ACTIVE};
     // Is someone adding scores to this node?
     // We don't need to unset this.
     bool m_is_expanding{false};
+    std::atomic<bool> m_small_net{false};
+    // Number of children uct_select_child has picked so far (non-root only).
+    std::uint16_t m_selected_children{0};
     SMP::Mutex m_nodemutex;
 
     // Tree data
     std::atomic<bool> m_has_children{false};
-    std::vector<node_ptr_t> m_children;
+    std::vector<UCTNodePointer> m_children;
+
+    // Copies of the children's selection statistics, in the same order as
+    // m_children, so uct_select_child reads a few contiguous arrays instead
+    // of every child node. One row of floats per statistic, each padded to
+    // a multiple of CHILD_STATS_ALIGN children with inactive entries.
+    enum ChildStatsRow {
+        CHILD_PRIOR,
+        CHILD_VISITS,
+        CHILD_WHITEEVALS,
+        CHILD_VIRTUAL_LOSS,
+        CHILD_ACTIVE,
+        CHILD_STATS_ROWS
+    };
+    static constexpr size_t CHILD_STATS_ALIGN = 8;
+    std::vector<float> m_child_stats;
+    size_t m_child_stats_stride{0};
 };
 
 #endif
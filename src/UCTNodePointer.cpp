@@ -0,0 +1,126 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <assert.h>
+#include <cstring>
+
+#include "UCTNodePointer.h"
+#include "UCTNode.h"
+
+static_assert(alignof(UCTNode) > 1,
+              "UCTNode pointers must leave the lowest bit free");
+
+UCTNodePointer::UCTNodePointer(Move move, float score) {
+    std::uint32_t score_bits;
+    static_assert(sizeof(score_bits) == sizeof(score), "Unexpected float size");
+    std::memcpy(&score_bits, &score, sizeof(score_bits));
+    assert((static_cast<std::uint32_t>(move) & ~0xffffu) == 0);
+
+    m_data = (static_cast<std::uint64_t>(score_bits) << 32)
+           | (static_cast<std::uint64_t>(move) << 16)
+           | INFLATED_MASK;
+}
+
+UCTNodePointer::~UCTNodePointer() {
+    auto data = m_data.load();
+    if (is_inflated(data)) {
+        delete read_ptr(data);
+    }
+}
+
+UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
+    m_data = n.m_data.exchange(INFLATED_MASK);
+}
+
+UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
+    auto data = n.m_data.exchange(INFLATED_MASK);
+    auto old = m_data.exchange(data);
+    if (is_inflated(old)) {
+        delete read_ptr(old);
+    }
+    return *this;
+}
+
+bool UCTNodePointer::is_inflated() const {
+    return is_inflated(m_data.load());
+}
+
+void UCTNodePointer::inflate(float init_eval) const {
+    auto data = m_data.load();
+    if (is_inflated(data)) {
+        return;
+    }
+    auto node = new UCTNode(get_move(), get_score(), init_eval);
+    auto ptr = reinterpret_cast<std::uint64_t>(node);
+    // Someone else may have beaten us to it.
+    if (!m_data.compare_exchange_strong(data, ptr)) {
+        delete node;
+    }
+}
+
+UCTNode* UCTNodePointer::get() const {
+    auto data = m_data.load();
+    assert(is_inflated(data));
+    return read_ptr(data);
+}
+
+std::unique_ptr<UCTNode> UCTNodePointer::release() {
+    auto data = m_data.load();
+    if (!is_inflated(data)) {
+        return nullptr;
+    }
+    m_data = INFLATED_MASK;
+    return std::unique_ptr<UCTNode>(read_ptr(data));
+}
+
+Move UCTNodePointer::get_move() const {
+    auto data = m_data.load();
+    if (is_inflated(data)) {
+        return read_ptr(data)->get_move();
+    }
+    return static_cast<Move>((data >> 16) & 0xffff);
+}
+
+float UCTNodePointer::get_score() const {
+    auto data = m_data.load();
+    if (is_inflated(data)) {
+        return read_ptr(data)->get_score();
+    }
+    auto score_bits = static_cast<std::uint32_t>(data >> 32);
+    auto score = 0.0f;
+    std::memcpy(&score, &score_bits, sizeof(score));
+    return score;
+}
+
+int UCTNodePointer::get_visits() const {
+    auto data = m_data.load();
+    if (is_inflated(data)) {
+        return read_ptr(data)->get_visits();
+    }
+    return 0;
+}
+
+bool UCTNodePointer::active() const {
+    auto data = m_data.load();
+    if (is_inflated(data)) {
+        return read_ptr(data)->active();
+    }
+    return true;
+}
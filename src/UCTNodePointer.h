@@ -0,0 +1,81 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef UCTNODEPOINTER_H_INCLUDED
+#define UCTNODEPOINTER_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "Types.h"
+
+class UCTNode;
+
+// A child slot in the tree. Most children are never visited, so instead
+// of a full UCTNode a child starts out as just its move and prior packed
+// in 64 bits. The UCTNode is only created (inflated) when the search
+// first selects the child, and the slot then holds the pointer to it.
+//
+// Encoding: if the lowest bit is set, bits 16-31 hold the move and bits
+// 32-63 the prior as a float. Otherwise the value is a UCTNode*.
+class UCTNodePointer {
+public:
+    UCTNodePointer(Move move, float score);
+    ~UCTNodePointer();
+
+    UCTNodePointer(UCTNodePointer&& n);
+    UCTNodePointer& operator=(UCTNodePointer&& n);
+    UCTNodePointer(const UCTNodePointer&) = delete;
+    UCTNodePointer& operator=(const UCTNodePointer&) = delete;
+
+    bool is_inflated() const;
+    // Create the UCTNode if nobody did so yet. init_eval is the eval of
+    // the parent, which the node reports until it is visited.
+    void inflate(float init_eval) const;
+    // Only valid once inflated.
+    UCTNode* get() const;
+    UCTNode* operator->() const {
+        return get();
+    }
+    // Take ownership of the node, leaving this slot empty.
+    // Returns nullptr if the child was never inflated.
+    std::unique_ptr<UCTNode> release();
+
+    // These work whether inflated or not.
+    Move get_move() const;
+    float get_score() const;
+    int get_visits() const;
+    bool active() const;
+
+private:
+    static constexpr std::uint64_t INFLATED_MASK = 1ULL;
+
+    static bool is_inflated(std::uint64_t data) {
+        return (data & INFLATED_MASK) == 0;
+    }
+    static UCTNode* read_ptr(std::uint64_t data) {
+        return reinterpret_cast<UCTNode*>(data);
+    }
+
+    mutable std::atomic<std::uint64_t> m_data;
+};
+
+#endif
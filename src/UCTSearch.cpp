@@ -28,6 +28,9 @@
 #include <type_traits>
 #include <boost/range/adaptor/reversed.hpp>
 
+#include "AdaptiveThreads.h"
+#include "MemStats.h"
+#include "NNCache.h"
 #include "Position.h"
 #include "Movegen.h"
 #include "UCI.h"
@@ -58,7 +61,8 @@ void UCTSearch::set_quiet(bool quiet) {
     quiet_ = quiet;
 }
 
-SearchResult UCTSearch::play_simulation(BoardHistory& bh, UCTNode* const node) {
+SearchResult UCTSearch::play_simulation(BoardHistory& bh, UCTNode* const node,
+                                        bool on_pv) {
     const auto& cur = bh.cur();
     const auto color = cur.side_to_move();
 
@@ -71,7 +75,7 @@ SearchResult UCTSearch::play_simulation(BoardHistory& bh, UCTNode* const node) {
         if (drawn || !MoveList<LEGAL>(cur).size()) {
             float score = (drawn || !cur.checkers()) ? 0.0 : (color == Color::WHITE ? -1.0 : 1.0);
             result = SearchResult::from_score(score);
-        } else if (m_nodes < MAX_TREE_SIZE) {
+        } else if (tree_has_room()) {
             float eval;
             auto success = node->create_children(m_nodes, bh, eval);
             if (success) {
@@ -81,10 +85,26 @@ SearchResult UCTSearch::play_simulation(BoardHistory& bh, UCTNode* const node) {
     }
 
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color, node == m_root.get());
+        // Nodes expanded by the small network get the main network's
+        // priors and eval once they are worth it. The roots were
+        // re-evaluated before the search started.
+        auto eval_change = 0.0f;
+        if (node->small_net_eval() && !is_root_node(node)
+            && (on_pv || node->get_visits() >= cfg_small_net_visits)) {
+            node->reevaluate(bh, eval_change);
+        }
+        auto index = size_t{0};
+        auto next = node->uct_select_child(color, is_root_node(node), index);
+        const auto next_on_pv = on_pv && Network::has_small_network()
+                                && node->is_most_visited_child(index);
         auto move = next->get_move();
         bh.do_move(move);
-        result = play_simulation(bh, next);
+        result = play_simulation(bh, next, next_on_pv);
+        if (result.eval_change() != 0.0f) {
+            node->accumulate_eval(result.eval_change());
+        }
+        result.add_eval_change(eval_change);
+        node->update_child_stats(index);
     }
 
     if (result.valid()) {
@@ -95,6 +115,127 @@ SearchResult UCTSearch::play_simulation(BoardHistory& bh, UCTNode* const node) {
     return result;
 }
 
+// Search with --deterministic. The leaves of a batch are selected one
+// after the other on this thread, with virtual loss on their paths as in
+// play_simulation, so they spread over the tree like parallel simulations
+// would. The evaluations are shared out over all threads, and the results
+// are backed up in selection order. The tree then only depends on the
+// batch size, not on the number of threads or their timing.
+//
+// Only this thread uses the NNCache, in selection and backup order. What
+// a lookup finds would otherwise depend on which thread evaluated what.
+void UCTSearch::play_batch() {
+    auto batch_size = std::min({DETERMINISTIC_BATCH_SIZE,
+                                m_maxplayouts - m_playouts,
+                                m_maxvisits - get_root_visits()});
+    batch_size = std::max(batch_size, 1);
+
+    auto leaves = std::vector<BatchLeaf>(batch_size);
+    for (auto i = size_t{0}; i < leaves.size(); i++) {
+        select_leaf(leaves, i);
+    }
+
+    std::atomic<size_t> next_leaf{0};
+    auto evaluate = [&leaves, &next_leaf]() {
+        for (;;) {
+            const auto i = next_leaf++;
+            if (i >= leaves.size()) {
+                return;
+            }
+            if (leaves[i].needs_eval) {
+                leaves[i].netresult =
+                    Network::get_scored_moves_nocache(leaves[i].bh);
+            }
+        }
+    };
+    ThreadGroup tg(thread_pool);
+    for (int i = 1; i < m_threads; i++) {
+        tg.add_task(evaluate);
+    }
+    evaluate();
+    tg.wait_all();
+
+    for (auto i = size_t{0}; i < leaves.size(); i++) {
+        backup_leaf(leaves, i);
+        if (leaves[i].result.valid()) {
+            increment_playouts();
+        }
+    }
+}
+
+// The selection half of play_simulation.
+void UCTSearch::select_leaf(std::vector<BatchLeaf>& leaves, size_t i) {
+    auto& leaf = leaves[i];
+    leaf.bh = bh_.shallow_clone();
+    auto node = m_root.get();
+    auto index = size_t{0};
+    for (;;) {
+        const auto& cur = leaf.bh.cur();
+        const auto color = cur.side_to_move();
+        node->virtual_loss();
+        leaf.path.emplace_back(node, index);
+        if (node->has_children()) {
+            node = node->uct_select_child(color, is_root_node(node), index);
+            leaf.bh.do_move(node->get_move());
+            continue;
+        }
+
+        bool drawn = cur.is_draw();
+        if (drawn || !MoveList<LEGAL>(cur).size()) {
+            float score = (drawn || !cur.checkers()) ? 0.0 : (color == Color::WHITE ? -1.0 : 1.0);
+            leaf.result = SearchResult::from_score(score);
+            return;
+        }
+        // Fails if an earlier leaf of the batch is expanding this node,
+        // this leaf is then given up.
+        if (!tree_has_room() || !node->acquire_expansion()) {
+            return;
+        }
+        leaf.expand = true;
+        const auto key = cur.full_key();
+        if (NNCache::get_NNCache().lookup(key, leaf.netresult,
+                                          cur.game_ply())) {
+            return;
+        }
+        for (auto j = size_t{0}; j < i; j++) {
+            if (leaves[j].needs_eval && leaves[j].bh.cur().full_key() == key) {
+                leaf.same_as = static_cast<int>(j);
+                return;
+            }
+        }
+        leaf.needs_eval = true;
+        return;
+    }
+}
+
+// The backup half of play_simulation.
+void UCTSearch::backup_leaf(std::vector<BatchLeaf>& leaves, size_t i) {
+    auto& leaf = leaves[i];
+    if (leaf.needs_eval) {
+        NNCache::get_NNCache().insert(leaf.bh.cur().full_key(),
+                                      leaf.netresult);
+    } else if (leaf.same_as >= 0) {
+        leaf.netresult = leaves[leaf.same_as].netresult;
+    }
+    if (leaf.expand) {
+        float eval;
+        if (leaf.path.back().first->expand(m_nodes, leaf.bh,
+                                           leaf.netresult, eval)) {
+            leaf.result = SearchResult::from_eval(eval);
+        }
+    }
+    for (auto j = leaf.path.size(); j-- > 0; ) {
+        const auto node = leaf.path[j].first;
+        if (j + 1 < leaf.path.size()) {
+            node->update_child_stats(leaf.path[j + 1].second);
+        }
+        if (leaf.result.valid()) {
+            node->update(leaf.result.eval());
+        }
+        node->virtual_loss_undo();
+    }
+}
+
 void UCTSearch::dump_stats(BoardHistory& state, UCTNode& parent) {
     if (cfg_quiet || !parent.has_children()) {
         return;
@@ -151,7 +292,7 @@ void UCTSearch::dump_stats(BoardHistory& state, UCTNode& parent) {
 
         StateInfo si;
         state.cur().do_move(node->get_move(), si);
-        pvstring += " " + get_pv(state, *node);
+        pvstring += " " + get_pv(state, *node.get());
         state.cur().undo_move(node->get_move());
 
         myprintf_so("%s\n", pvstring.c_str());
@@ -249,17 +390,51 @@ void UCTSearch::dump_analysis(int64_t elapsed, bool force_output) {
     // To report nodes, use visits.
     //   - Only includes expanded nodes.
     //   - Includes nodes carried over from tree reuse.
-    auto visits = m_root->get_visits();
+    auto visits = get_root_visits();
     // To report nps, use m_playouts to exclude nodes added by tree reuse,
     // which is similar to a ponder hit. The user will expect to know how
     // fast nodes are being added, not how big the ponder hit was.
     myprintf_so("info depth %d nodes %d nps %0.f score cp %d winrate %5.2f%% time %lld pv %s\n",
              depth, visits, 1000.0 * m_playouts / (elapsed + 1),
              cp, winrate, elapsed, pvstring.c_str());
+    if (force_output) {
+        myprintf_so("info string %s\n", MemStats::summary().c_str());
+    }
 }
 
 bool UCTSearch::is_running() const {
-    return m_run && m_nodes < MAX_TREE_SIZE;
+    return m_run && tree_has_room();
+}
+
+bool UCTSearch::tree_has_room() const {
+    if (m_nodes >= MAX_TREE_SIZE) {
+        return false;
+    }
+    if (cfg_max_memory == 0) {
+        return true;
+    }
+    const auto tree_memory = MemStats::get(MemStats::TREE_NODES)
+                           + MemStats::get(MemStats::CHILD_VECTORS);
+    return tree_memory < m_max_tree_memory;
+}
+
+// Split the --memory budget between the NNCache and the tree. The weights,
+// OpenCL buffers and training data can't be resized, so they come first.
+void UCTSearch::set_memory_budget() {
+    if (cfg_max_memory == 0) {
+        return;
+    }
+    const auto fixed = MemStats::get(MemStats::CPU_WEIGHTS)
+                     + MemStats::get(MemStats::OPENCL_BUFFERS)
+                     + MemStats::get(MemStats::TRAINING);
+    if (fixed >= cfg_max_memory) {
+        myprintf("Memory budget of %zu MiB is used up by the weights.\n",
+                 cfg_max_memory / (1024 * 1024));
+    }
+    const auto available = cfg_max_memory > fixed ? cfg_max_memory - fixed : 0;
+    const auto cache_memory = available * NNCACHE_MEMORY_PERCENT / 100;
+    NNCache::get_NNCache().set_max_memory(cache_memory);
+    m_max_tree_memory = available - cache_memory;
 }
 
 int UCTSearch::est_playouts_left() const {
@@ -269,7 +444,7 @@ int UCTSearch::est_playouts_left() const {
         // No time control, use playouts or visits.
         const auto playouts_left =
                 std::max(0, std::min(m_maxplayouts - playouts,
-                                     m_maxvisits - m_root->get_visits()));
+                                     m_maxvisits - get_root_visits()));
         return playouts_left;
     } else if (elapsed_millis < 1000 || playouts < 100) {
         // Until we reach 1 second or 100 playouts playout_rate
@@ -283,25 +458,188 @@ int UCTSearch::est_playouts_left() const {
 }
 
 size_t UCTSearch::prune_noncontenders() {
+    const auto visits = get_merged_root_visits();
     auto Nfirst = 0;
-    for (const auto& node : m_root->get_children()) {
-        Nfirst = std::max(Nfirst, node->get_visits());
+    for (const auto v : visits) {
+        Nfirst = std::max(Nfirst, v);
     }
     const auto min_required_visits =
         Nfirst - est_playouts_left();
     auto pruned_nodes = size_t{0};
-    for (const auto& node : m_root->get_children()) {
-        const auto has_enough_visits =
-            node->get_visits() >= min_required_visits;
-        node->set_active(has_enough_visits);
+    const auto& children = m_root->get_children();
+    for (size_t i = 0; i < children.size(); i++) {
+        const auto has_enough_visits = visits[i] >= min_required_visits;
+        children[i]->set_active(has_enough_visits);
         if (!has_enough_visits) {
             ++pruned_nodes;
         }
     }
+    // Keep the other trees from spending playouts on pruned moves.
+    for (size_t t = 0; t < m_extra_roots.size(); t++) {
+        const auto& extra_children = m_extra_roots[t]->get_children();
+        const auto& index = m_extra_root_index[t];
+        for (size_t j = 0; j < extra_children.size(); j++) {
+            if (index[j] < children.size()) {
+                extra_children[j]->set_active(children[index[j]]->active());
+            }
+        }
+        m_extra_roots[t]->update_all_child_stats();
+    }
+    m_root->update_all_child_stats();
 
     return pruned_nodes;
 }
 
+// Set up the extra trees used for root parallelism. Each one is reused
+// from the previous search when possible, like m_root.
+void UCTSearch::prepare_root_trees(BoardHistory& new_bh) {
+    const auto num_trees = cfg_deterministic ? 1
+                         : std::min(cfg_root_trees, m_threads);
+    if (num_trees <= 1 || !m_root->has_children()) {
+        m_extra_roots.clear();
+        m_extra_root_index.clear();
+        return;
+    }
+
+    m_extra_roots.resize(num_trees - 1);
+    m_extra_root_index.resize(num_trees - 1);
+    for (auto& root : m_extra_roots) {
+        if (!root) {
+            root = std::make_unique<UCTNode>(new_bh.cur().get_move(), 0.0f, 0.5f);
+        }
+        m_nodes += root->count_nodes();
+        if (!root->has_children()) {
+            // The NNCache makes this cheap, the root was evaluated already.
+            float root_eval;
+            root->create_children(m_nodes, new_bh, root_eval);
+            root->update(root_eval);
+        }
+        float eval_change;
+        root->reevaluate(new_bh, eval_change);
+        root->inflate_all_children();
+        if (cfg_noise) {
+            // Independent noise per tree adds diversity to the root search.
+            root->dirichlet_noise(0.25f, 0.3f);
+        }
+    }
+
+    index_root_trees();
+}
+
+// Map the children of the extra roots to those of m_root by move. Needed
+// again whenever m_root's children were sorted.
+void UCTSearch::index_root_trees() {
+    const auto& children = m_root->get_children();
+    for (size_t t = 0; t < m_extra_roots.size(); t++) {
+        const auto& extra_children = m_extra_roots[t]->get_children();
+        auto& index = m_extra_root_index[t];
+        index.assign(extra_children.size(), children.size());
+        for (size_t j = 0; j < extra_children.size(); j++) {
+            for (size_t i = 0; i < children.size(); i++) {
+                if (children[i]->get_move() == extra_children[j]->get_move()) {
+                    index[j] = i;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Spread the worker threads evenly over the trees.
+UCTNode* UCTSearch::get_worker_root(int thread) {
+    const auto tree = thread % (m_extra_roots.size() + 1);
+    if (tree == 0) {
+        return m_root.get();
+    }
+    return m_extra_roots[tree - 1].get();
+}
+
+bool UCTSearch::is_root_node(const UCTNode* node) const {
+    if (node == m_root.get()) {
+        return true;
+    }
+    for (const auto& root : m_extra_roots) {
+        if (node == root.get()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int UCTSearch::get_root_visits() const {
+    auto visits = m_root->get_visits();
+    for (const auto& root : m_extra_roots) {
+        visits += root->get_visits();
+    }
+    return visits;
+}
+
+// Visits of m_root's children summed over all trees.
+std::vector<int> UCTSearch::get_merged_root_visits() const {
+    const auto& children = m_root->get_children();
+    auto visits = std::vector<int>(children.size());
+    for (size_t i = 0; i < children.size(); i++) {
+        visits[i] = children[i]->get_visits();
+    }
+    for (size_t t = 0; t < m_extra_roots.size(); t++) {
+        const auto& extra_children = m_extra_roots[t]->get_children();
+        const auto& index = m_extra_root_index[t];
+        for (size_t j = 0; j < extra_children.size(); j++) {
+            if (index[j] < children.size()) {
+                visits[index[j]] += extra_children[j]->get_visits();
+            }
+        }
+    }
+    return visits;
+}
+
+// Fold the root statistics of the extra trees into m_root, so move
+// selection, training data and output see the combined search. The extra
+// trees keep their own statistics and are reused at the next move, so
+// unmerge_root_trees() must take them out of m_root again once the move
+// is chosen. Must only be called once the workers have stopped.
+void UCTSearch::merge_root_trees() {
+    add_root_trees(1);
+    for (const auto& root : m_extra_roots) {
+        for (const auto& extra_child : root->get_children()) {
+            extra_child->set_active(true);
+        }
+        root->update_all_child_stats();
+    }
+}
+
+void UCTSearch::unmerge_root_trees() {
+    // Choosing the move sorted m_root's children.
+    index_root_trees();
+    add_root_trees(-1);
+}
+
+// Add the root statistics of the extra trees to m_root, times sign.
+void UCTSearch::add_root_trees(int sign) {
+    const auto& children = m_root->get_children();
+    for (size_t t = 0; t < m_extra_roots.size(); t++) {
+        const auto& root = m_extra_roots[t];
+        m_root->set_visits(m_root->get_visits() + sign * root->get_visits());
+        m_root->set_whiteevals(m_root->get_whiteevals()
+                               + sign * root->get_whiteevals());
+
+        const auto& extra_children = root->get_children();
+        const auto& index = m_extra_root_index[t];
+        for (size_t j = 0; j < extra_children.size(); j++) {
+            if (index[j] >= children.size()) {
+                continue;
+            }
+            auto& child = children[index[j]];
+            const auto& extra_child = extra_children[j];
+            child->set_visits(child->get_visits()
+                              + sign * extra_child->get_visits());
+            child->set_whiteevals(child->get_whiteevals()
+                                  + sign * extra_child->get_whiteevals());
+        }
+    }
+    m_root->update_all_child_stats();
+}
+
 bool UCTSearch::have_alternate_moves() {
     if (!cfg_timemanage) {
         // When timemanage is off always return true.
@@ -336,13 +674,13 @@ bool UCTSearch::have_alternate_moves() {
 
 bool UCTSearch::pv_limit_reached() const {
     return m_playouts >= m_maxplayouts
-        || m_root->get_visits() >= m_maxvisits;
+        || get_root_visits() >= m_maxvisits;
 }
 
 void UCTWorker::operator()() {
     do {
         BoardHistory bh = bh_.shallow_clone();
-        auto result = m_search->play_simulation(bh, m_root);
+        auto result = m_search->play_simulation(bh, m_root, true);
         if (result.valid()) {
             m_search->increment_playouts();
         }
@@ -359,13 +697,18 @@ Move UCTSearch::think(BoardHistory&& new_bh) {
 #endif
 
     uci_stop = false;
+    set_memory_budget();
 
     // See if the position is in our previous search tree.
     // If not, construct a new m_root.
+    check_ponder_hit(new_bh);
     m_root = m_root->find_new_root(m_prevroot_full_key, new_bh);
     if (!m_root) {
         m_root = std::make_unique<UCTNode>(new_bh.cur().get_move(), 0.0f, 0.5f);
     }
+    for (auto& root : m_extra_roots) {
+        root = root->find_new_root(m_prevroot_full_key, new_bh);
+    }
 
     m_playouts = 0;
     m_nodes = m_root->count_nodes();
@@ -373,6 +716,7 @@ Move UCTSearch::think(BoardHistory&& new_bh) {
     // Could optimize this.
     bh_ = new_bh.shallow_clone();
     m_prevroot_full_key = new_bh.cur().full_key();
+    NNCache::get_NNCache().set_root_ply(bh_.cur().game_ply());
 
 #ifndef NDEBUG
     myprintf("update_root, %d -> %d expanded nodes (%.1f%% reused)\n",
@@ -394,24 +738,39 @@ Move UCTSearch::think(BoardHistory&& new_bh) {
         m_root->create_children(m_nodes, bh_, root_eval);
         m_root->update(root_eval);
     }
+    // The root always has the main network's priors, play_simulation
+    // does not re-evaluate it.
+    float eval_change;
+    m_root->reevaluate(bh_, eval_change);
+    // Root children get pruned, noised and reported, so create them all.
+    m_root->inflate_all_children();
     if (cfg_noise) {
         m_root->dirichlet_noise(0.25f, 0.3f);
     }
+    m_threads = cfg_auto_threads ? AdaptiveThreads::get().threads()
+                                 : cfg_num_threads;
+    prepare_root_trees(new_bh);
 
+    if (cfg_auto_threads) {
+        AdaptiveThreads::get().search_started();
+    }
     m_run = true;
-    int cpus = cfg_num_threads;
     ThreadGroup tg(thread_pool);
-    for (int i = 1; i < cpus; i++) {
-        tg.add_task(UCTWorker(bh_, this, m_root.get()));
+    for (int i = 1; i < m_threads && !cfg_deterministic; i++) {
+        tg.add_task(UCTWorker(bh_, this, get_worker_root(i)));
     }
 
     bool keeprunning = true;
     int last_update = 0;
     do {
-        auto currstate = bh_.shallow_clone();
-        auto result = play_simulation(currstate, m_root.get());
-        if (result.valid()) {
-            increment_playouts();
+        if (cfg_deterministic) {
+            play_batch();
+        } else {
+            auto currstate = bh_.shallow_clone();
+            auto result = play_simulation(currstate, m_root.get(), true);
+            if (result.valid()) {
+                increment_playouts();
+            }
         }
 
         // assume nodes = 1.8 ^ depth.
@@ -435,6 +794,9 @@ Move UCTSearch::think(BoardHistory&& new_bh) {
     // stop the search
     m_run = false;
     tg.wait_all();
+    if (cfg_auto_threads) {
+        AdaptiveThreads::get().search_finished(m_playouts);
+    }
     if (!m_root->has_children()) {
         return MOVE_NONE;
     }
@@ -443,6 +805,7 @@ Move UCTSearch::think(BoardHistory&& new_bh) {
     for (const auto& node : m_root->get_children()) {
         node->set_active(true);
     }
+    merge_root_trees();
 
     // display search info
     dump_stats(bh_, *m_root);
@@ -453,35 +816,195 @@ Move UCTSearch::think(BoardHistory&& new_bh) {
         dump_analysis(milliseconds_elapsed, true);
     }
     Move bestmove = get_best_move();
+    unmerge_root_trees();
     return bestmove;
 }
 
-void UCTSearch::ponder() {
-    assert(m_playouts == 0);
-    assert(m_nodes == 0);
+// Replies are ordered by visits and then by prior.
+static bool more_likely(const UCTNodePointer& a, const UCTNodePointer& b) {
+    if (a.get_visits() != b.get_visits()) {
+        return a.get_visits() > b.get_visits();
+    }
+    return a.get_score() > b.get_score();
+}
+
+static Move likeliest_child(const UCTNode& node) {
+    const auto& children = node.get_children();
+    return std::min_element(begin(children), end(children), more_likely)->get_move();
+}
+
+void UCTSearch::ponder(const BoardHistory& ponder_bh) {
+    // After an interruption, like "isready", pondering resumes on the
+    // same replies and the visits saved count from the first start.
+    auto previous = std::move(m_ponder_replies);
+    m_ponder_replies.clear();
+    const auto plies = ponder_bh.positions.size();
+    if (!m_root->has_children() || plies < 3
+        || ponder_bh.positions[plies - 3].full_key() != m_prevroot_full_key) {
+        return;
+    }
+    const auto move = ponder_bh.positions[plies - 2].get_move();
+    m_root->inflate_all_children();
+    UCTNode* opponent = nullptr;
+    for (const auto& child : m_root->get_children()) {
+        if (child.get_move() == move) {
+            opponent = child.get();
+        }
+    }
+    // Not from bh_, whose states may be gone with the previous position.
+    auto bh = ponder_bh.shallow_clone();
+    bh.positions.pop_back();
+    if (!opponent || bh.cur().is_draw() || !MoveList<LEGAL>(bh.cur()).size()) {
+        return;
+    }
+
+    set_memory_budget();
+    NNCache::get_NNCache().set_root_ply(bh.cur().game_ply());
+    m_nodes = m_root->count_nodes();
+    if (!opponent->has_children()) {
+        float eval;
+        if (!opponent->create_children(m_nodes, bh, eval)) {
+            return;
+        }
+        opponent->update(eval);
+    }
+    opponent->inflate_all_children();
+
+    // The most likely replies first, by visits and then by prior.
+    const auto& children = opponent->get_children();
+    auto order = std::vector<size_t>(children.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(begin(order), end(order), [&children](size_t a, size_t b) {
+        return more_likely(children[a], children[b]);
+    });
+    order.resize(std::min(order.size(), size_t(cfg_ponder_replies)));
+
+    auto total_visits = 0;
+    auto total_prior = 0.0;
+    for (auto i : order) {
+        total_visits += children[i].get_visits();
+        total_prior += children[i].get_score();
+    }
+    const auto by_visits = total_visits >= PONDER_MIN_VISITS;
+    auto cumulative = 0.0;
+    for (auto i : order) {
+        auto share = by_visits ? double(children[i].get_visits()) / total_visits
+                     : total_prior > 0.0 ? children[i].get_score() / total_prior
+                     : 1.0 / order.size();
+        cumulative += share;
+        auto reply_bh = bh.shallow_clone();
+        reply_bh.do_move(children[i].get_move());
+        const auto key = reply_bh.cur().full_key();
+        auto visits_before = children[i].get_visits();
+        for (const auto& reply : previous) {
+            if (reply.full_key == key) {
+                visits_before = reply.visits_before;
+            }
+        }
+        m_ponder_replies.emplace_back(PonderReply{
+            children[i].get_move(), key, children[i].get(),
+            std::move(reply_bh), cumulative, visits_before, 0});
+    }
+    m_ponder_replies.back().cumulative_share = 1.0;
 
+    m_threads = cfg_auto_threads ? AdaptiveThreads::get().threads()
+                                 : cfg_num_threads;
+    m_playouts = 0;
+    m_ponder_count = 0;
     m_run = true;
-    int cpus = cfg_num_threads;
     ThreadGroup tg(thread_pool);
-    for (int i = 1; i < cpus; i++) {
-        tg.add_task(UCTWorker(bh_, this, m_root.get()));
+    for (int i = 1; i < m_threads; i++) {
+        tg.add_task([this]() {
+            do {
+                ponder_playout();
+            } while (is_running());
+        });
     }
     do {
-        auto bh = bh_.shallow_clone();
-        auto result = play_simulation(bh, m_root.get());
-        if (result.valid()) {
-            increment_playouts();
-        }
-    } while(!Utils::input_pending() && is_running());
+        ponder_playout();
+    } while (!Utils::input_pending() && is_running());
 
     // stop the search
     m_run = false;
     tg.wait_all();
-    // display search info
-    myprintf("\n");
-    dump_stats(bh_, *m_root);
 
-    myprintf("\n%d visits, %d expanded nodes\n\n", m_root->get_visits(), (int)m_nodes);
+    auto summary = std::string{};
+    for (auto& reply : m_ponder_replies) {
+        reply.visits_after = reply.node->get_visits();
+        summary += " " + UCI::move(reply.move) + " "
+                 + std::to_string(reply.visits_after - reply.visits_before);
+    }
+    myprintf("Pondered %d playouts on %s:%s\n", m_playouts.load(),
+             by_visits ? "visits" : "priors", summary.c_str());
+}
+
+Move UCTSearch::expected_reply(Move move) const {
+    for (const auto& child : m_root->get_children()) {
+        if (child.get_move() == move && child.is_inflated()
+            && child->has_children()) {
+            return likeliest_child(*child.get());
+        }
+    }
+    return MOVE_NONE;
+}
+
+Move UCTSearch::pondered_move(const BoardHistory& bh) const {
+    const auto key = bh.cur().full_key();
+    for (const auto& reply : m_ponder_replies) {
+        if (reply.full_key == key && reply.node->has_children()) {
+            return likeliest_child(*reply.node);
+        }
+    }
+    // Not pondered on, the GUI discards this move anyway.
+    for (const auto& m : MoveList<LEGAL>(bh.cur())) {
+        return m;
+    }
+    return MOVE_NONE;
+}
+
+// One playout into the reply picked by the playout number. Stepping by
+// the golden ratio spreads each reply's share evenly over time, without
+// threads having to agree on anything but the counter.
+void UCTSearch::ponder_playout() {
+    const auto n = m_ponder_count++;
+    const auto x = std::fmod(n * 0.6180339887498949, 1.0);
+    auto reply = begin(m_ponder_replies);
+    while (reply->cumulative_share <= x && std::next(reply) != end(m_ponder_replies)) {
+        ++reply;
+    }
+    auto bh = reply->bh.shallow_clone();
+    auto result = play_simulation(bh, reply->node, true);
+    if (result.valid()) {
+        increment_playouts();
+    }
+}
+
+// Called with the position of the next search, after pondering.
+void UCTSearch::check_ponder_hit(const BoardHistory& new_bh) {
+    if (m_ponder_replies.empty()) {
+        return;
+    }
+    m_ponder_searches++;
+    const auto key = new_bh.cur().full_key();
+    auto hit = std::find_if(begin(m_ponder_replies), end(m_ponder_replies),
+                            [key](const PonderReply& reply) {
+                                return reply.full_key == key;
+                            });
+    auto visits = 0;
+    if (hit != end(m_ponder_replies)) {
+        m_ponder_hits++;
+        visits = hit->visits_after - hit->visits_before;
+        m_ponder_visits_saved += visits;
+    }
+    myprintf_so("info string ponder %s, %d visits saved, "
+                "%d of %d hits (%.0f%%), %lld visits saved in total\n",
+                hit != end(m_ponder_replies) ? "hit" : "miss", visits,
+                m_ponder_hits, m_ponder_searches,
+                100.0 * m_ponder_hits / m_ponder_searches,
+                (long long)m_ponder_visits_saved);
+    m_ponder_replies.clear();
 }
 
 // Returns the amount of time to use for a turn in milliseconds
@@ -39,6 +39,10 @@ public:
     SearchResult() = default;
     bool valid() const { return m_valid;  }
     float eval() const { return m_eval;  }
+    // Correction for the evals backed up earlier through this path, after
+    // a node on it was re-evaluated by the main network.
+    float eval_change() const { return m_eval_change; }
+    void add_eval_change(float change) { m_eval_change += change; }
     static SearchResult from_eval(float eval) {
         return SearchResult(eval);
     }
@@ -56,23 +60,45 @@ private:
         : m_valid(true), m_eval(eval) {}
     bool m_valid{false};
     float m_eval{0.0f};
+    float m_eval_change{0.0f};
 };
 
 class UCTSearch {
 public:
     /*
-        Maximum size of the tree in memory. Nodes are about
-        40 bytes, so limit to ~1.6G.
+        Maximum number of children linked into the tree. A child takes
+        8 bytes until it is first selected, then a 64 byte UCTNode is
+        created for it, so this is at least ~320M. Use --memory to bound
+        the tree in bytes instead, memstats shows the actual usage.
     */
     static constexpr auto MAX_TREE_SIZE = 40'000'000;
 
+    // Share of the --memory budget given to the NNCache.
+    static constexpr auto NNCACHE_MEMORY_PERCENT = 10;
+
+    // Leaves selected per batch with --deterministic. The tree depends on
+    // this, but not on the number of threads.
+    static constexpr auto DETERMINISTIC_BATCH_SIZE = 16;
+
+    // When pondering, the replies get playouts in proportion to their
+    // visits if they had this many together, else to their priors.
+    static constexpr auto PONDER_MIN_VISITS = 100;
+
     UCTSearch(BoardHistory&& bh);
     Move think(BoardHistory&& bh);
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
     void set_analyzing(bool flag);
     void set_quiet(bool flag);
-    void ponder();
+    // Think on the opponent's time for "go ponder", until input arrives.
+    // bh ends with our move and the reply the GUI expects. The playouts
+    // go to the cfg_ponder_replies most likely replies to our move, and
+    // think() reuses the tree of the one that is played.
+    void ponder(const BoardHistory& bh);
+    // The reply to our move to suggest with "bestmove ... ponder".
+    Move expected_reply(Move move) const;
+    // Our best move in a pondered position, for a "stop" while pondering.
+    Move pondered_move(const BoardHistory& bh) const;
     bool is_running() const;
     int est_playouts_left() const;
     size_t prune_noncontenders();
@@ -81,20 +107,83 @@ public:
     void increment_playouts();
     bool should_halt_search();
     void please_stop();
-    SearchResult play_simulation(BoardHistory& bh, UCTNode* const node);
+    // on_pv: the path to node only took the most visited children.
+    SearchResult play_simulation(BoardHistory& bh, UCTNode* const node,
+                                 bool on_pv);
 
 private:
+    // A leaf of a deterministic batch, see play_batch.
+    struct BatchLeaf {
+        BoardHistory bh;
+        // The nodes from the root down to the leaf, each with its index
+        // in its parent's children.
+        std::vector<std::pair<UCTNode*, size_t>> path;
+        // The leaf node is expanded with netresult in the backup.
+        bool expand{false};
+        // netresult is computed in the evaluation stage.
+        bool needs_eval{false};
+        // Or copied from this earlier leaf of the batch, which has the
+        // same position.
+        int same_as{-1};
+        Network::Netresult netresult;
+        SearchResult result;
+    };
+    void play_batch();
+    void select_leaf(std::vector<BatchLeaf>& leaves, size_t i);
+    void backup_leaf(std::vector<BatchLeaf>& leaves, size_t i);
+
     void dump_stats(BoardHistory& pos, UCTNode& parent);
     std::string get_pv(BoardHistory& pos, UCTNode& parent);
     void dump_analysis(int64_t elapsed, bool force_output);
     Move get_best_move();
     float get_root_temperature();
+    void prepare_root_trees(BoardHistory& new_bh);
+    void index_root_trees();
+    UCTNode* get_worker_root(int thread);
+    bool is_root_node(const UCTNode* node) const;
+    int get_root_visits() const;
+    std::vector<int> get_merged_root_visits() const;
+    void merge_root_trees();
+    void unmerge_root_trees();
+    void add_root_trees(int sign);
+    void set_memory_budget();
+    bool tree_has_room() const;
+    void ponder_playout();
+    void check_ponder_hit(const BoardHistory& new_bh);
+
+    // A reply searched while pondering.
+    struct PonderReply {
+        Move move;
+        Key full_key;
+        UCTNode* node;
+        BoardHistory bh;
+        // Upper end of the reply's share of the playouts in [0, 1].
+        double cumulative_share;
+        int visits_before;
+        int visits_after;
+    };
+    std::vector<PonderReply> m_ponder_replies;
+    std::atomic<int> m_ponder_count{0};
+    // Over the whole game.
+    int m_ponder_searches{0};
+    int m_ponder_hits{0};
+    int64_t m_ponder_visits_saved{0};
 
     BoardHistory bh_;
     Key m_prevroot_full_key{0};
     std::unique_ptr<UCTNode> m_root;
+    // Root parallelism: extra trees searched independently from the same
+    // position, sharing only the NNCache. m_root is tree 0.
+    std::vector<std::unique_ptr<UCTNode>> m_extra_roots;
+    // For each extra tree, the index into m_root's children of every root
+    // child, so statistics can be merged by move without searching.
+    std::vector<std::vector<size_t>> m_extra_root_index;
     std::atomic<int> m_nodes{0};
+    // Tree memory limit in bytes, only used with --memory.
+    size_t m_max_tree_memory{0};
     std::atomic<int> m_playouts{0};
+    // Search threads, including the one running think().
+    int m_threads{1};
     int64_t m_target_time{0};
     int64_t m_start_time{0};
     std::atomic<bool> m_run{false};
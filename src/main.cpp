@@ -20,9 +20,12 @@
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <random>
+#include <utility>
+#include <vector>
 
 #include "config.h"
 #include "Bitboard.h"
@@ -34,6 +37,8 @@
 #include "Network.h"
 #include "UCTSearch.h"
 #include "Training.h"
+#include "StatsAggregator.h"
+#include "Transcoder.h"
 #include "Movegen.h"
 #include "pgn.h"
 
@@ -62,11 +67,26 @@ static std::string parse_commandline(int argc, char *argv[]) {
         ("threads,t", po::value<int>()->default_value
                       (std::min(cfg_num_threads, cfg_max_threads)),
                       "Number of threads to use.")
+        ("root-trees", po::value<int>(),
+                      "Split the threads over this many independent search "
+                      "trees, merging their root statistics. "
+                      "Can scale better with many threads.")
+        ("auto-threads", "Adjust the number of threads between moves "
+                         "to maximize evaluations per second, using "
+                         "at most --threads.")
+        ("deterministic", "Search in fixed batches, so the search tree "
+                          "does not depend on the number of threads. "
+                          "Allows --seed with multiple threads.")
         ("playouts,p", po::value<int>(),
                        "Weaken engine by limiting the number of playouts. "
                        "Requires --noponder.")
         ("visits,v", po::value<int>(),
                        "Weaken engine by limiting the number of visits.")
+        ("memory", po::value<int>(),
+                   "Memory budget in MiB. The search tree and NNCache are "
+                   "sized to fit in what the weights leave over.")
+        ("large-pages", "Back the search tree, NNCache and CPU weights "
+                        "with 2 MiB pages where the OS allows it.")
         ("resignpct,r", po::value<int>()->default_value(cfg_resignpct),
                        "Resign when winrate is less than x%.")
         ("noise,n", "Apply dirichlet noise to root.")
@@ -76,17 +96,46 @@ static std::string parse_commandline(int argc, char *argv[]) {
         ("seed,s", po::value<std::uint64_t>(),
                    "Random number generation seed.")
         ("weights,w", po::value<std::string>(), "File with network weights.")
+        ("small-weights", po::value<std::string>(),
+                          "File with the weights of a smaller network, run "
+                          "on the CPU for the first evaluation of new nodes.")
+        ("small-net-visits", po::value<int>(),
+                             "Re-evaluate a node with the main network "
+                             "when it has this many visits, or is on the "
+                             "principal variation.")
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
         ("quiet,q", "Disable all diagnostic output.")
-        ("noponder", "Disable thinking on opponent's time.")
+        ("startup-profile", "Print how long each phase of the startup took.")
+        ("noponder", "Disable thinking on opponent's time, even when "
+                     "the GUI sets the Ponder option.")
+        ("ponder-replies", po::value<int>(),
+                           "Number of likely opponent replies to search "
+                           "while pondering.")
         ("uci", "Don't initialize the engine until \"isready\" command is sent. Use this if your GUI is freezing on startup.")
         ("start", po::value<std::string>(), "Start command {train, bench}.")
         ("supervise", po::value<std::string>(), "Dump supervised learning data from the pgn.")
+        ("transcode", po::value<std::string>(),
+                      "Convert the text training chunks in this directory "
+                      "to binary, using --threads files at a time.")
+        ("analyze", po::value<std::string>(),
+                    "Summarize the stats chunks and self-play logs in this "
+                    "directory: resign false positives, winrate calibration "
+                    "and game lengths.")
+        ("chunk-index", "Write an index next to each training chunk, "
+                        "so single records can be read without "
+                        "decompressing the whole chunk.")
+        ("secondary-samples", po::value<int>(),
+                              "Also write training samples for internal "
+                              "search nodes with at least this many visits.")
         ("gpu",  po::value<std::vector<int> >(),
                 "ID of the OpenCL device(s) to use (disables autodetection).")
 #ifdef USE_OPENCL
         ("full-tuner", "Try harder to find an optimal OpenCL tuning.")
         ("tune-only", "Tune OpenCL only and then exit.")
+        ("gpu-contexts", po::value<int>(),
+                         "Command queues with their buffers per OpenCL "
+                         "device, shared by the search threads. Default: "
+                         "2 on GPUs, 1 on CPUs.")
 #endif
 #ifdef USE_TUNER
         ("puct", po::value<float>())
@@ -135,6 +184,22 @@ static std::string parse_commandline(int argc, char *argv[]) {
         cfg_quiet = true;
     }
 
+    if (vm.count("startup-profile")) {
+        cfg_startup_profile = true;
+    }
+
+    if (vm.count("large-pages")) {
+        cfg_large_pages = true;
+    }
+
+    if (vm.count("chunk-index")) {
+        cfg_chunk_index = true;
+    }
+
+    if (vm.count("secondary-samples")) {
+        cfg_secondary_samples = vm["secondary-samples"].as<int>();
+    }
+
 #ifdef USE_TUNER
     if (vm.count("puct")) {
         cfg_puct = vm["puct"].as<float>();
@@ -154,12 +219,41 @@ static std::string parse_commandline(int argc, char *argv[]) {
         cfg_supervise = vm["supervise"].as<std::string>();
     }
 
+    if (vm.count("transcode")) {
+        cfg_transcode = vm["transcode"].as<std::string>();
+    }
+
+    if (vm.count("analyze")) {
+        cfg_analyze = vm["analyze"].as<std::string>();
+    }
+
     if (vm.count("weights")) {
         cfg_weightsfile = vm["weights"].as<std::string>();
-    } else if (cfg_supervise.empty()) {
+    } else if (cfg_supervise.empty() && cfg_transcode.empty()
+               && cfg_analyze.empty()) {
         cfg_weightsfile = "weights.txt";
     }
 
+    if (vm.count("small-weights")) {
+        cfg_small_weightsfile = vm["small-weights"].as<std::string>();
+        // The batches of --deterministic are evaluated outside of
+        // UCTNode::create_children, and are never re-evaluated.
+        if (vm.count("deterministic")) {
+            myprintf("Nonsensical options: --small-weights does not work "
+                     "with --deterministic.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("small-net-visits")) {
+        cfg_small_net_visits = vm["small-net-visits"].as<int>();
+        if (cfg_small_net_visits < 1) {
+            myprintf("Nonsensical options: Nodes need at least one visit "
+                     "to be re-evaluated.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (vm.count("threads")) {
         int num_threads = vm["threads"].as<int>();
         if (num_threads > cfg_max_threads) {
@@ -172,6 +266,26 @@ static std::string parse_commandline(int argc, char *argv[]) {
         
     }
 
+    if (vm.count("auto-threads")) {
+        cfg_auto_threads = true;
+    }
+
+    if (vm.count("deterministic")) {
+        cfg_deterministic = true;
+    }
+
+    if (vm.count("root-trees")) {
+        cfg_root_trees = vm["root-trees"].as<int>();
+        if (cfg_root_trees < 1) {
+            myprintf("Nonsensical options: At least one search tree is needed.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (cfg_root_trees > cfg_num_threads) {
+            myprintf("Clamping root trees to number of threads = %d\n", cfg_num_threads);
+            cfg_root_trees = cfg_num_threads;
+        }
+    }
+
     if (vm.count("seed")) {
         cfg_rng_seed = vm["seed"].as<std::uint64_t>();
         if (cfg_rng_seed == 0) {
@@ -179,13 +293,13 @@ static std::string parse_commandline(int argc, char *argv[]) {
           exit(EXIT_FAILURE);
         }
 
-        if (vm.count("threads") && cfg_num_threads > 1) {
+        if (vm.count("threads") && cfg_num_threads > 1 && !cfg_deterministic) {
           myprintf("Nonsensical options: lczero loses deterministic property "
                    "of the random seed when using multiple threads.\n");
           exit(EXIT_FAILURE);
         }
 
-        if (cfg_num_threads > 1) {
+        if (cfg_num_threads > 1 && !cfg_deterministic) {
             cfg_num_threads = 1;
             myprintf("Using rng seed from cli, activating single thread mode!\n");
         }
@@ -196,6 +310,14 @@ static std::string parse_commandline(int argc, char *argv[]) {
         cfg_allow_pondering = false;
     }
 
+    if (vm.count("ponder-replies")) {
+        cfg_ponder_replies = vm["ponder-replies"].as<int>();
+        if (cfg_ponder_replies < 1) {
+            myprintf("Nonsensical options: At least one reply is needed to ponder on.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (vm.count("uci")) {
         cfg_noinitialize = true;
     }
@@ -241,6 +363,15 @@ static std::string parse_commandline(int argc, char *argv[]) {
         cfg_max_visits = vm["visits"].as<int>();
     }
 
+    if (vm.count("memory")) {
+        auto memory = vm["memory"].as<int>();
+        if (memory <= 0) {
+            myprintf("Nonsensical options: The memory budget must be positive.\n");
+            exit(EXIT_FAILURE);
+        }
+        cfg_max_memory = size_t(memory) * 1024 * 1024;
+    }
+
     if (vm.count("resignpct")) {
         cfg_resignpct = vm["resignpct"].as<int>();
     }
@@ -257,6 +388,15 @@ static std::string parse_commandline(int argc, char *argv[]) {
     if (vm.count("tune-only")) {
         cfg_tune_only = true;
     }
+
+    if (vm.count("gpu-contexts")) {
+        cfg_gpu_contexts = vm["gpu-contexts"].as<int>();
+        if (cfg_gpu_contexts < 1) {
+            myprintf("Nonsensical options: At least one OpenCL context "
+                     "is needed.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 #endif
 
     std::string start = "";
@@ -344,13 +484,45 @@ void generate_supervised_data(const std::string& filename) {
   }
 }
 
+// Times the phases of the startup, printed with --startup-profile.
+// The tables are set up before the command line is parsed, so every
+// phase is timed and printing is decided at the end.
+class StartupProfile {
+public:
+  void phase(const char* name) {
+    auto now = std::chrono::steady_clock::now();
+    m_phases.emplace_back(
+        name, std::chrono::duration<double>(now - m_last).count());
+    m_last = now;
+  }
+  void print() const {
+    if (!cfg_startup_profile) {
+      return;
+    }
+    auto total = 0.0;
+    for (const auto& p : m_phases) {
+      myprintf("startup %-14s %8.3f ms\n", p.first, p.second * 1000.0);
+      total += p.second;
+    }
+    myprintf("startup %-14s %8.3f ms\n", "total", total * 1000.0);
+  }
+private:
+  std::chrono::steady_clock::time_point m_last{
+    std::chrono::steady_clock::now()};
+  std::vector<std::pair<const char*, double>> m_phases;
+};
+
 int main(int argc, char* argv[]) {
+  StartupProfile profile;
 
   Bitboards::init();
+  profile.phase("bitboards");
   Position::init();
+  profile.phase("position");
 
   Parameters::setup_default_parameters();
   std::string uci_start = parse_commandline(argc, argv);
+  profile.phase("command line");
 
   // test_pgn_parse();
 
@@ -365,10 +537,29 @@ int main(int argc, char* argv[]) {
   setbuf(stdin, nullptr);
 #endif
   thread_pool.initialize(cfg_num_threads);
+  profile.phase("thread pool");
+
+  // Doesn't need a network.
+  if (!cfg_transcode.empty()) {
+      namespace fs = boost::filesystem;
+      auto dir = fs::path(cfg_transcode);
+      if (dir.filename() == ".") {
+          dir = dir.parent_path();
+      }
+      auto out_dir = "transcode-" + dir.filename().string();
+      return Transcoder::transcode_dir(cfg_transcode, out_dir) == 0 ? 0 : 1;
+  }
+  if (!cfg_analyze.empty()) {
+      StatsAggregator::analyze(cfg_analyze);
+      return 0;
+  }
+
   // Random::GetRng().seedrandom(cfg_rng_seed);
   if (!cfg_noinitialize) {
       Network::initialize();
+      profile.phase("network");
   }
+  profile.print();
 
   if (!cfg_supervise.empty()) {
       generate_supervised_data(cfg_supervise);
@@ -0,0 +1,53 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "NNCache.h"
+
+// Probe the shared cache from a thread with an empty L1.
+static bool in_shared_cache(std::uint64_t hash) {
+  auto found = false;
+  std::thread([&]() {
+    auto result = Network::Netresult{};
+    found = NNCache::get_NNCache().lookup(hash, result, 0);
+  }).join();
+  return found;
+}
+
+TEST(NNCacheTest, L1HitsGetASecondChance) {
+  auto& cache = NNCache::get_NNCache();
+  cache.resize(2);
+  const auto first = std::uint64_t{0x1234500001};
+  const auto second = std::uint64_t{0x1234500002};
+  const auto third = std::uint64_t{0x1234500003};
+  auto result = Network::Netresult{};
+  result.second = 0.5f;
+
+  cache.insert(first, result);
+  cache.insert(second, result);
+  // Served from this thread's L1, the shared entry is never probed.
+  EXPECT_TRUE(cache.lookup(first, result, 0));
+  // Over the size, the clock hand passes the first entry first.
+  cache.insert(third, result);
+
+  EXPECT_TRUE(in_shared_cache(first));
+  EXPECT_FALSE(in_shared_cache(second));
+  EXPECT_TRUE(in_shared_cache(third));
+
+  cache.resize(50000);
+}
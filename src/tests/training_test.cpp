@@ -0,0 +1,257 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "Movegen.h"
+#include "NNCache.h"
+#include "Network.h"
+#include "Parameters.h"
+#include "Position.h"
+#include "StatsAggregator.h"
+#include "Training.h"
+#include "Transcoder.h"
+#include "UCI.h"
+#include "UCTNode.h"
+
+namespace fs = boost::filesystem;
+
+// Records of varying size with contents that don't compress to nothing.
+static std::string make_record(int game, int record) {
+  auto str = "game " + std::to_string(game) + " record " + std::to_string(record) + ":";
+  for (auto i = 0; i < 500 + 37 * record; i++) {
+    str.push_back('a' + (i * i + game * 7 + record) % 26);
+  }
+  return str;
+}
+
+static std::string gunzip(const std::string& filename) {
+  auto in = gzopen(filename.c_str(), "rb");
+  auto result = std::string{};
+  char buff[4096];
+  auto n = 0;
+  while ((n = gzread(in, buff, sizeof(buff))) > 0) {
+    result.append(buff, n);
+  }
+  gzclose(in);
+  return result;
+}
+
+TEST(TrainingTest, ChunkIndexReadsRecords) {
+  auto dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  cfg_chunk_index = true;
+
+  const auto games = 3;
+  const auto records_per_game = 40;
+  auto all = std::string{};
+  auto records = std::vector<std::string>{};
+  {
+    auto chunker = OutputChunker{(dir / "training").string(), true, games};
+    for (auto g = 0; g < games; g++) {
+      auto game = std::string{};
+      auto offsets = std::vector<size_t>{};
+      for (auto r = 0; r < records_per_game; r++) {
+        offsets.emplace_back(game.size());
+        records.emplace_back(make_record(g, r));
+        game += records.back();
+      }
+      all += game;
+      chunker.append(game, offsets);
+    }
+  }
+  cfg_chunk_index = false;
+
+  auto chunk_name = (dir / "training.0.gz").string();
+  // Still a normal gzip file.
+  EXPECT_EQ(gunzip(chunk_name), all);
+
+  auto index = ChunkIndex{chunk_name};
+  ASSERT_EQ(index.num_records(), records.size());
+  ASSERT_EQ(index.num_games(), size_t(games));
+  for (auto g = 0; g < games; g++) {
+    EXPECT_EQ(index.game_start(g), size_t(g * records_per_game));
+  }
+  for (auto i = size_t{0}; i < records.size(); i++) {
+    EXPECT_EQ(index.read_record(i), records[i]);
+  }
+
+  // The index must not be counted as a chunk.
+  {
+    auto chunker = OutputChunker{(dir / "training").string(), true};
+    chunker.append("x");
+  }
+  EXPECT_TRUE(fs::exists(dir / "training.1.gz"));
+
+  fs::remove_all(dir);
+}
+
+TEST(TrainingTest, TranscodeTextRecord) {
+  // One record as Training::dump_training writes it.
+  auto text = std::string{};
+  for (auto p = 0; p < Network::T_HISTORY * Network::V1_HIST_PLANES; p++) {
+    text += p == 3 ? "80000000000000ff\n" : "0000000000000000\n";
+  }
+  text += "1\n0\n1\n0\n1\n";
+  text += "42\n300\n";
+  for (auto i = 0; i < Network::V1_NUM_OUTPUT_POLICY; i++) {
+    text += i == 0 ? "" : " ";
+    text += i == 5 ? "0.75" : i == 9 ? "0.25" : "0";
+  }
+  text += "\n-1\n";
+
+  auto out = std::string{};
+  ASSERT_EQ(Transcoder::transcode_records(text.data(), text.size(), out), size_t(1));
+  ASSERT_EQ(out.size(), size_t(Transcoder::RECORD_SIZE));
+
+  auto int_at = [&](size_t offset) {
+    auto v = 0;
+    memcpy(&v, &out[offset], sizeof(v));
+    return v;
+  };
+  auto float_at = [&](size_t offset) {
+    auto v = 0.0f;
+    memcpy(&v, &out[offset], sizeof(v));
+    return v;
+  };
+  EXPECT_EQ(int_at(0), int(Transcoder::VERSION));
+  EXPECT_EQ(float_at(4 + 4 * 5), 0.75f);
+  EXPECT_EQ(float_at(4 + 4 * 9), 0.25f);
+  EXPECT_EQ(float_at(4 + 4 * 6), 0.0f);
+  // The first square of the plane is its first bit in the text, and the
+  // high bit of the first byte in binary (see fix_v2 in Training.cpp).
+  const auto planes = size_t{4 + 4 * Network::V1_NUM_OUTPUT_POLICY};
+  EXPECT_EQ(uint8_t(out[planes + 3 * 8]), 0x80);
+  EXPECT_EQ(uint8_t(out[planes + 3 * 8 + 7]), 0xff);
+  EXPECT_EQ(out.substr(planes + 3 * 8 + 1, 6), std::string(6, '\0'));
+  const auto flags = planes + 8 * Network::T_HISTORY * Network::V1_HIST_PLANES;
+  EXPECT_EQ(out.substr(flags, 5), std::string("\1\0\1\0\1", 5));
+  EXPECT_EQ(uint8_t(out[flags + 5]), 42);
+  EXPECT_EQ(uint8_t(out[flags + 6]), 255);
+  EXPECT_EQ(int8_t(out[flags + 7]), -1);
+
+  // Damaged records are rejected.
+  auto bad = text;
+  bad[3] = 'x';
+  EXPECT_THROW(Transcoder::transcode_records(bad.data(), bad.size(), out),
+               std::runtime_error);
+  bad = text.substr(0, text.size() - 3);
+  EXPECT_THROW(Transcoder::transcode_records(bad.data(), bad.size(), out),
+               std::runtime_error);
+}
+
+TEST(TrainingTest, ResignFalsePositives) {
+  auto stats = StatsAggregator{};
+  // Lost after dropping to 3%, the resignation would have been right.
+  stats.add_game({{0.5f, 0.5f, 1}, {0.4f, 0.3f, -1}, {0.1f, 0.03f, -1},
+                  {0.9f, 0.97f, 1}, {0.05f, 0.02f, -1}});
+  // Drawn after dropping to 4%.
+  stats.add_game({{0.5f, 0.5f, 0}, {0.2f, 0.04f, 0}, {0.5f, 0.5f, 0}});
+  EXPECT_EQ(stats.stats_games(), 2u);
+
+  const auto& thresholds = StatsAggregator::RESIGN_THRESHOLDS;
+  const auto& counts = stats.resign_counts();
+  ASSERT_EQ(counts.size(), thresholds.size());
+  // 1%: nobody resigns.
+  EXPECT_EQ(thresholds[0], 0.01f);
+  EXPECT_EQ(counts[0].resigned, 0u);
+  // 3%: the first game resigns at its last move.
+  EXPECT_EQ(thresholds[2], 0.03f);
+  EXPECT_EQ(counts[2].resigned, 1u);
+  EXPECT_EQ(counts[2].false_positives, 0u);
+  EXPECT_EQ(counts[2].plies_saved, 1u);
+  // 5%: both resign, the drawn game wrongly.
+  EXPECT_EQ(thresholds[4], 0.05f);
+  EXPECT_EQ(counts[4].resigned, 2u);
+  EXPECT_EQ(counts[4].false_positives, 1u);
+  EXPECT_EQ(counts[4].plies_saved, 3u + 2u);
+}
+
+// Expand node with equal priors, through the NNCache so no network is needed.
+static UCTNode& expand(UCTNode& node, const BoardHistory& bh) {
+  auto result = Network::Netresult{};
+  for (const auto& m : MoveList<LEGAL>(bh.cur())) {
+    result.first.emplace_back(1.0f, m);
+  }
+  result.second = 0.5f;
+  NNCache::get_NNCache().insert(bh.cur().full_key(), result);
+  std::atomic<int> nodes{0};
+  float eval;
+  EXPECT_TRUE(node.create_children(nodes, bh, eval));
+  node.inflate_all_children();
+  return node;
+}
+
+static UCTNode& child(UCTNode& node, Move move) {
+  for (const auto& c : node.get_children()) {
+    if (c.get_move() == move) {
+      return *c.get();
+    }
+  }
+  throw std::runtime_error("No such child");
+}
+
+TEST(TrainingTest, ReusedTreeRecordsPositionsOnce) {
+  Bitboards::init();
+  Position::init();
+  Network::init_move_map();
+  cfg_secondary_samples = 10;
+
+  auto bh = BoardHistory{};
+  bh.set(Position::StartFEN);
+  const auto e2e4 = UCI::to_move(bh.cur(), "e2e4");
+  UCTNode root{MOVE_NONE, 0.0f, 0.5f};
+  expand(root, bh);
+
+  auto bh1 = bh.shallow_clone();
+  bh1.do_move(e2e4);
+  auto& reply = expand(child(root, e2e4), bh1);
+  const auto e7e5 = UCI::to_move(bh1.cur(), "e7e5");
+  auto bh2 = bh1.shallow_clone();
+  bh2.do_move(e7e5);
+  auto& deeper = expand(child(reply, e7e5), bh2);
+  child(deeper, UCI::to_move(bh2.cur(), "g1f3")).set_visits(5);
+  deeper.set_visits(20);
+  reply.set_visits(50);
+
+  // The root and the reply's subtree above the threshold.
+  Training::clear_training();
+  Training::record(bh, root);
+  ASSERT_EQ(Training::get_data().size(), 3u);
+
+  // The reply is played and its tree reused, with more visits.
+  deeper.set_visits(40);
+  Training::record(bh1, reply);
+
+  const auto& data = Training::get_data();
+  ASSERT_EQ(data.size(), 3u);
+  EXPECT_FALSE(data[0].secondary);
+  EXPECT_EQ(data[0].to_move, WHITE);
+  EXPECT_TRUE(data[1].secondary);
+  EXPECT_FALSE(data[2].secondary);
+  EXPECT_EQ(data[2].to_move, BLACK);
+  // The position after e7e5, kept once.
+  EXPECT_EQ(data[1].to_move, WHITE);
+
+  Training::clear_training();
+  cfg_secondary_samples = 0;
+}
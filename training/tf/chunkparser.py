@@ -151,7 +151,8 @@ class ChunkParser:
         Unpack a v3 binary record to 3-tuple (state, policy pi, result)
 
         v3 struct format is (8276 bytes total)
-            int32 version (4 bytes)
+            int32 version (4 bytes, 0x100 is set for secondary samples
+                           taken from internal search nodes)
             1858 float32 probabilities (7432 bytes)
             104 (13*8) packed bit planes of 8 bytes each (832 bytes)
             uint8 castling us_ooo (1 byte)